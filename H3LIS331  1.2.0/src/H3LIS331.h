@@ -8,6 +8,7 @@
 
 #define H3LIS331_Data_Address 0x28
 #define H3LIS331_WhoAmI_Address 0x0F
+#define H3LIS331_WhoAmI_Value 0x32
 
 #define H3LIS331_CTRL_REG1_Address 0x20 // CTRL_REG1 Power Mode & Output Data Rate
 #define H3LIS331_CTRL_REG2_Address 0x21 // CTRL_REG2 (Normally they do not have to be changed)
@@ -15,9 +16,21 @@
 #define H3LIS331_CTRL_REG4_Address 0x23 // CTRL_REG4 ACC_CONFIG
 #define H3LIS331_CTRL_REG5_Address 0x24 // CTRL_REG5 SleepToWake
 
+#define H3LIS331_HP_FILTER_RESET_Address 0x25 // 読むとハイパスフィルタの値を0に戻す
+#define H3LIS331_REFERENCE_Address 0x26
 #define H3LIS331_STATUS_REG_Address 0x27 // STATUS_REG Overrun
 
-#define H3LIS331_CTRL_REG1 0b00111111 // CTRL_REG1 Normal Mode & OutPut Data Rate 1000Hz ????????????
+// INT1: 0x30~0x33, INT2: 0x34~0x37 (CFG, SRC, THS, DURATION)
+#define H3LIS331_INT1_CFG_Address 0x30
+#define H3LIS331_INT1_SRC_Address 0x31
+#define H3LIS331_INT1_THS_Address 0x32
+#define H3LIS331_INT1_DURATION_Address 0x33
+#define H3LIS331_INT2_CFG_Address 0x34
+#define H3LIS331_INT2_SRC_Address 0x35
+#define H3LIS331_INT2_THS_Address 0x36
+#define H3LIS331_INT2_DURATION_Address 0x37
+
+#define H3LIS331_CTRL_REG1 0b00111111 // CTRL_REG1 Normal Mode & Output Data Rate 1000Hz & XYZ Enable
 // #define H3LIS331_CTRL_REG1 0b0001111       // CTRL_REG1 default value
 #define H3LIS331_CTRL_REG2 0b00000000      // CTRL_REG2 (Normally they do not have to be changed)
 #define H3LIS331_CTRL_REG3 0b00000000      // CTRL_REG3 Interrupt Active High
@@ -27,18 +40,191 @@
 #define H3LIS331_CTRL_REG5 0b00000000      // CTRL_REG5 SleepToWake_OFF
 #define H3LIS331_STATUS_REG 0b11111111     // STATUS_REG Overrun Available
 
+// CTRL_REG1のパワーモード (bit7-5)
+// ローパワーモードではODRがPMで決まり、DRはローパスフィルタの帯域になる
+#define H3LIS331_PM_POWER_DOWN 0x00
+#define H3LIS331_PM_NORMAL 0x20
+#define H3LIS331_PM_LOW_0_5HZ 0x40
+#define H3LIS331_PM_LOW_1HZ 0x60
+#define H3LIS331_PM_LOW_2HZ 0x80
+#define H3LIS331_PM_LOW_5HZ 0xA0
+#define H3LIS331_PM_LOW_10HZ 0xC0
+#define H3LIS331_PM_MASK 0xE0
+// CTRL_REG1のDR (bit4-3) ノーマルモードのODR
+#define H3LIS331_ODR_50 0x00
+#define H3LIS331_ODR_100 0x08
+#define H3LIS331_ODR_400 0x10
+#define H3LIS331_ODR_1000 0x18
+#define H3LIS331_ODR_MASK 0x18
+#define H3LIS331_XYZ_ENABLE 0x07
+
+// CTRL_REG2 ハイパスフィルタ
+// 遮断周波数 (HPCF) ODR/50, /100, /200, /400
+#define H3LIS331_HPCF_ODR_50 0x00
+#define H3LIS331_HPCF_ODR_100 0x01
+#define H3LIS331_HPCF_ODR_200 0x02
+#define H3LIS331_HPCF_ODR_400 0x03
+// フィルタを通す先 (FDS, HPen2, HPen1)
+#define H3LIS331_HPF_OUTPUT 0x10 // 出力レジスタ
+#define H3LIS331_HPF_INT2 0x08
+#define H3LIS331_HPF_INT1 0x04
+
+// CTRL_REG3 割り込みピン
+#define H3LIS331_INT_ACTIVE_LOW 0x80
+#define H3LIS331_INT_OPEN_DRAIN 0x40
+#define H3LIS331_INT_LIR2 0x20 // INT2をINT2_SRCを読むまで保持する
+#define H3LIS331_INT_LIR1 0x04
+
+// INTx_CFGのイベント
+#define H3LIS331_INT_AND 0x80 // 全部のイベントが揃ったとき (0なら、どれか1つ)
+#define H3LIS331_INT_ZH 0x20
+#define H3LIS331_INT_ZL 0x10
+#define H3LIS331_INT_YH 0x08
+#define H3LIS331_INT_YL 0x04
+#define H3LIS331_INT_XH 0x02
+#define H3LIS331_INT_XL 0x01
+#define H3LIS331_INT_HIGH_ANY 0x2A // どれかの軸がしきい値を超えた (衝撃)
+#define H3LIS331_INT_LOW_ALL 0x95  // 全部の軸がしきい値より小さい (自由落下)
+// INTx_SRCのbit
+#define H3LIS331_INT_SRC_IA 0x40 // 割り込みが起きている
+
+// CTRL_REG4
+#define H3LIS331_CTRL_REG4_BDU 0x80 // 上位と下位のbyteを両方読むまで値を更新しない
+#define H3LIS331_RANGE_MASK 0x30
+
+// STATUS_REGのbit
+#define H3LIS331_STATUS_ZYXOR 0x80 // 読む前に次の値で上書きされた
+#define H3LIS331_STATUS_ZYXDA 0x08 // 新しい値がある
+
+// STATUS_REG + 加速度 (0x27~0x2D)
+#define H3LIS331_SAMPLE_LENGTH 7
+
+struct H3LIS331_Sample
+{
+    int16_t acc[3];
+    uint8_t status; // STATUS_REGの値
+    bool fresh;     // 前に読んでから新しい値になった
+    bool overrun;   // 前に読んでから2回以上更新された (間の値は失われた)
+};
+
 class H3LIS331
 {
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *H3LIS331SPI;
 
+    uint8_t ctrlReg1 = H3LIS331_CTRL_REG1;
+    uint8_t ctrlReg2 = H3LIS331_CTRL_REG2;
+    uint8_t ctrlReg3 = H3LIS331_CTRL_REG3;
+    uint8_t ctrlReg4 = H3LIS331_CTRL_REG4_400G | H3LIS331_CTRL_REG4_BDU;
+    // setInterruptで書いた値 reinitで書き直す [0]: INT1, [1]: INT2 / CFG, THS, DURATION
+    uint8_t intRegs[2][3] = {};
+
+    // 割り込みピンごとの状態 [0]: INT1, [1]: INT2
+    struct InterruptHook
+    {
+        H3LIS331 *owner;
+        uint8_t line;
+        int pin;
+        TaskHandle_t task;
+        void (*callback)(void *arg, uint8_t line);
+        void *arg;
+    };
+    InterruptHook hooks[2] = {};
+    static void onInterrupt(void *arg);
+
 public:
+    // GetWithStatusで数える
+    uint32_t freshCount = 0;   // 新しい値だった回数
+    uint32_t staleCount = 0;   // 前と同じ値だった回数 (読む周期がODRより速い)
+    uint32_t overrunCount = 0; // 値を読み落とした回数 (読む周期がODRより遅い、または読むのが遅れた)
+
     void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000);
     uint8_t WhoImI();
     uint8_t WhoAmI();
+    /**
+     * @brief 今の設定 (CTRL_REG1~5) を書き直す センサの電源が落ちた等で設定が消えたときに使う
+     * addDeviceはしないので何度呼んでもよい setInterruptで設定したINT1, INT2も書き直す
+     * (INTx_SRCは読まないので、ラッチされた割り込みはそのまま残る)
+     * @retval false: WhoAmIか読み返した値が違う
+     */
+    bool reinit();
+    // このセンサのSPI通信のエラーの数
+    uint32_t spiErrorCount() { return H3LIS331SPI->getErrorCount(deviceHandle); }
     void Get(int16_t *rx);
     void Get2(int16_t *rx, uint8_t *rx_buf);
+
+    /**
+     * @brief パワーモードとODRを設定する (3軸とも有効) 書き込んだ後に読み返して確認する
+     * @param[in] pm H3LIS331_PM_NORMAL等
+     * @param[in] odr H3LIS331_ODR_1000等 ローパワーモードではローパスフィルタの帯域
+     * @retval false: 引数が範囲外、または読み返した値が違う
+     */
+    bool setDataRate(uint8_t pm, uint8_t odr = H3LIS331_ODR_1000);
+    /**
+     * @brief 測定範囲を設定する 書き込んだ後に読み返して確認する
+     * @param[in] range H3LIS331_CTRL_REG4_100G / 200G / 400G
+     * @retval false: 引数が範囲外、または読み返した値が違う
+     */
+    bool setRange(uint8_t range);
+    uint8_t getRange() { return ctrlReg4 & H3LIS331_RANGE_MASK; }
+    // 1Gあたりの生の値 (12bit左詰めの16bitの値として)
+    float lsbPerG();
+    // 値が更新される周期[us] パワーダウンなら0
+    uint32_t getPeriodUs();
+
+    /**
+     * @brief STATUS_REGと加速度を1回の通信で読む (0x27~0x2Dを連続で読む)
+     * 新しい値でなくてもsample->accには今の出力レジスタの値(前と同じ値)が入る
+     * @param[out] sample
+     * @param[out] rx_buf H3LIS331_SAMPLE_LENGTH byte [0]: STATUS_REG, [1~6]: 加速度 (little endian)
+     * @retval true: 新しい値
+     */
+    bool GetWithStatus(H3LIS331_Sample *sample, uint8_t *rx_buf);
+    void clearCounters();
+
+    /**
+     * @brief ハイパスフィルタを設定する 重力や取り付けのずれを除いて、衝撃だけで割り込みをかけたいとき用
+     * 設定した後にフィルタの値を0に戻す
+     * @param[in] cutoff H3LIS331_HPCF_ODR_50等 (ODR 1kHzでODR/50なら20Hz)
+     * @param[in] targets フィルタを通す先 H3LIS331_HPF_OUTPUT | H3LIS331_HPF_INT1 | H3LIS331_HPF_INT2 0ならフィルタを使わない
+     * @retval false: 引数が範囲外、または読み返した値が違う
+     */
+    bool setHighPass(uint8_t cutoff, uint8_t targets);
+    // ハイパスフィルタの値を0に戻す (静止した状態を基準にし直す)
+    void resetHighPass();
+
+    /**
+     * @brief 割り込みのしきい値と継続時間を設定する
+     * INTxの出力はINTx_SRCをそのまま出す (CTRL_REG3のIx_CFG = 00)
+     * @param[in] line 1: INT1, 2: INT2
+     * @param[in] events H3LIS331_INT_HIGH_ANY等 0なら割り込みを止める
+     * @param[in] thresholdG しきい値[G] 分解能はフルスケール/128 (400Gで約3.1G) 1~127LSBに丸める
+     * @param[in] durationUs しきい値を超えた状態がこれだけ続いたら割り込み 分解能は1/ODR 0~127サンプルに丸める
+     * @param[in] latch trueならINTx_SRCを読むまで割り込みを保持する
+     * @retval false: 引数が範囲外、または読み返した値が違う
+     */
+    bool setInterrupt(uint8_t line, uint8_t events, float thresholdG, uint32_t durationUs = 0, bool latch = false);
+    // INTx_SRCを読む (ラッチしていれば解除される) H3LIS331_INT_SRC_IAのbitが立っていれば割り込みが起きた
+    uint8_t readInterruptSource(uint8_t line);
+    // 割り込みピンの極性と出力形式 (H3LIS331_INT_ACTIVE_LOW | H3LIS331_INT_OPEN_DRAIN) 初期値はactive high, push-pull
+    bool setInterruptPin(uint8_t mode);
+
+    /**
+     * @brief INTxをつないだGPIOの割り込みを受ける
+     * 割り込みが来ると、callbackを割り込みの中で呼び、attachInterruptを呼んだタスクにタスク通知を送る
+     * callbackはIRAM_ATTRをつけ、SPIの通信などの重い処理はしないこと (waitInterruptで待つタスクで行う)
+     * @param[in] line 1: INT1, 2: INT2
+     * @param[in] pin GPIOの番号
+     * @param[in] callback NULLならタスク通知だけ
+     * @param[in] arg callbackに渡す値
+     */
+    bool attachInterrupt(uint8_t line, int pin, void (*callback)(void *arg, uint8_t line) = NULL, void *arg = NULL);
+    void detachInterrupt(uint8_t line);
+    // attachInterruptを呼んだタスクで、次の割り込みまで待つ タイムアウトしたらfalse
+    bool waitInterrupt(TickType_t timeout = portMAX_DELAY);
+    // 割り込みの回数 [0]: INT1, [1]: INT2
+    volatile uint32_t interruptCount[2] = {};
 };
 
 void H3LIS331::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
@@ -63,17 +249,40 @@ void H3LIS331::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
 
     deviceHandle = H3LIS331SPI->addDevice(&if_cfg, cs);
 
-    // 1kHzにする
-    H3LIS331SPI->setReg(H3LIS331_CTRL_REG1_Address, H3LIS331_CTRL_REG1, deviceHandle);
-    H3LIS331SPI->setReg(H3LIS331_CTRL_REG2_Address, H3LIS331_CTRL_REG2, deviceHandle);
-    H3LIS331SPI->setReg(H3LIS331_CTRL_REG3_Address, H3LIS331_CTRL_REG3, deviceHandle);
-    // Init
-    H3LIS331SPI->setReg(H3LIS331_CTRL_REG4_Address, H3LIS331_CTRL_REG4_400G, deviceHandle);
+    // ノーマルモード、1kHzにする
+    setDataRate(H3LIS331_PM_NORMAL, H3LIS331_ODR_1000);
+    // ハイパスフィルタと割り込みは使わない (setHighPass, setInterruptで設定する)
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG2_Address, ctrlReg2, deviceHandle);
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG3_Address, ctrlReg3, deviceHandle);
+    // 400G、連続して読む間に値が更新されて上位と下位で別のサンプルになるのを防ぐ
+    setRange(H3LIS331_CTRL_REG4_400G);
     // SleepAndWakeをOFFにする
     H3LIS331SPI->setReg(H3LIS331_CTRL_REG5_Address, H3LIS331_CTRL_REG5, deviceHandle);
-    H3LIS331SPI->setReg(H3LIS331_STATUS_REG_Address, H3LIS331_STATUS_REG, deviceHandle);
+    // STATUS_REGは読み出し専用なので書かない
     return;
 }
+bool H3LIS331::reinit()
+{
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG1_Address, ctrlReg1, deviceHandle);
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG2_Address, ctrlReg2, deviceHandle);
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG3_Address, ctrlReg3, deviceHandle);
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG4_Address, ctrlReg4, deviceHandle);
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG5_Address, H3LIS331_CTRL_REG5, deviceHandle);
+    bool ok = true;
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        uint8_t base = (i == 0) ? H3LIS331_INT1_CFG_Address : H3LIS331_INT2_CFG_Address;
+        // setInterruptと同じ順番で、イベントは最後に有効にする
+        H3LIS331SPI->setReg(base, 0x00, deviceHandle);
+        H3LIS331SPI->setReg(base + 2, intRegs[i][1], deviceHandle);
+        H3LIS331SPI->setReg(base + 3, intRegs[i][2], deviceHandle);
+        H3LIS331SPI->setReg(base, intRegs[i][0], deviceHandle);
+        ok = ok && H3LIS331SPI->readByte(base | 0x80, deviceHandle) == intRegs[i][0];
+    }
+    return ok && WhoAmI() == H3LIS331_WhoAmI_Value &&
+           H3LIS331SPI->readByte(H3LIS331_CTRL_REG1_Address | 0x80, deviceHandle) == ctrlReg1 &&
+           H3LIS331SPI->readByte(H3LIS331_CTRL_REG4_Address | 0x80, deviceHandle) == ctrlReg4;
+}
 uint8_t H3LIS331::WhoImI()
 {
     return H3LIS331::WhoAmI();
@@ -135,4 +344,239 @@ void H3LIS331::Get2(int16_t *rx, uint8_t *rx_buf)
     rx[2] |= ((uint16_t)rx_buf[5]) << 8;
     return;
 }
+bool H3LIS331::setDataRate(uint8_t pm, uint8_t odr)
+{
+    if ((pm & ~H3LIS331_PM_MASK) || pm > H3LIS331_PM_LOW_10HZ || (odr & ~H3LIS331_ODR_MASK))
+    {
+        return false;
+    }
+    ctrlReg1 = pm | odr | H3LIS331_XYZ_ENABLE;
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG1_Address, ctrlReg1, deviceHandle);
+    return H3LIS331SPI->readByte(H3LIS331_CTRL_REG1_Address | 0x80, deviceHandle) == ctrlReg1;
+}
+bool H3LIS331::setRange(uint8_t range)
+{
+    if (range != H3LIS331_CTRL_REG4_100G && range != H3LIS331_CTRL_REG4_200G && range != H3LIS331_CTRL_REG4_400G)
+    {
+        return false;
+    }
+    ctrlReg4 = (ctrlReg4 & ~H3LIS331_RANGE_MASK) | range;
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG4_Address, ctrlReg4, deviceHandle);
+    return H3LIS331SPI->readByte(H3LIS331_CTRL_REG4_Address | 0x80, deviceHandle) == ctrlReg4;
+}
+float H3LIS331::lsbPerG()
+{
+    // 感度 100G: 49mg/digit, 200G: 98mg/digit, 400G: 195mg/digit (12bit)
+    switch (getRange())
+    {
+    case H3LIS331_CTRL_REG4_100G:
+        return 16.0f / 0.049f;
+    case H3LIS331_CTRL_REG4_200G:
+        return 16.0f / 0.098f;
+    default:
+        return 16.0f / 0.195f;
+    }
+}
+uint32_t H3LIS331::getPeriodUs()
+{
+    switch (ctrlReg1 & H3LIS331_PM_MASK)
+    {
+    case H3LIS331_PM_POWER_DOWN:
+        return 0;
+    case H3LIS331_PM_NORMAL:
+        break;
+    case H3LIS331_PM_LOW_0_5HZ:
+        return 2000000;
+    case H3LIS331_PM_LOW_1HZ:
+        return 1000000;
+    case H3LIS331_PM_LOW_2HZ:
+        return 500000;
+    case H3LIS331_PM_LOW_5HZ:
+        return 200000;
+    default:
+        return 100000;
+    }
+    switch (ctrlReg1 & H3LIS331_ODR_MASK)
+    {
+    case H3LIS331_ODR_50:
+        return 20000;
+    case H3LIS331_ODR_100:
+        return 10000;
+    case H3LIS331_ODR_400:
+        return 2500;
+    default:
+        return 1000;
+    }
+}
+bool H3LIS331::GetWithStatus(H3LIS331_Sample *sample, uint8_t *rx_buf)
+{
+    spi_transaction_t comm = {};
+    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.length = (H3LIS331_SAMPLE_LENGTH) * 8;
+
+    // STATUS_REGからアドレスを進めながら読む
+    uint16_t register_address = H3LIS331_STATUS_REG_Address;
+    register_address |= 0x40;
+    comm.cmd = register_address | 0x80;
+
+    comm.tx_buffer = NULL;
+    comm.rx_buffer = rx_buf;
+    comm.user = (void *)CS;
+
+    spi_transaction_ext_t spi_transaction = {};
+    spi_transaction.base = comm;
+    spi_transaction.command_bits = 8;
+    H3LIS331SPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+
+    sample->status = rx_buf[0];
+    sample->fresh = (rx_buf[0] & H3LIS331_STATUS_ZYXDA) != 0;
+    sample->overrun = (rx_buf[0] & H3LIS331_STATUS_ZYXOR) != 0;
+    for (int i = 0; i < 3; i++)
+    {
+        sample->acc[i] = (int16_t)(rx_buf[1 + 2 * i] | rx_buf[2 + 2 * i] << 8);
+    }
+    if (sample->fresh)
+    {
+        freshCount++;
+    }
+    else
+    {
+        staleCount++;
+    }
+    if (sample->overrun)
+    {
+        overrunCount++;
+    }
+    return sample->fresh;
+}
+void H3LIS331::clearCounters()
+{
+    freshCount = 0;
+    staleCount = 0;
+    overrunCount = 0;
+}
+bool H3LIS331::setHighPass(uint8_t cutoff, uint8_t targets)
+{
+    if (cutoff > H3LIS331_HPCF_ODR_400 || (targets & ~(H3LIS331_HPF_OUTPUT | H3LIS331_HPF_INT1 | H3LIS331_HPF_INT2)))
+    {
+        return false;
+    }
+    // HPM = 00 (ノーマルモード、HP_FILTER_RESETを読むと0に戻る)
+    ctrlReg2 = targets | cutoff;
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG2_Address, ctrlReg2, deviceHandle);
+    bool ok = H3LIS331SPI->readByte(H3LIS331_CTRL_REG2_Address | 0x80, deviceHandle) == ctrlReg2;
+    resetHighPass();
+    return ok;
+}
+void H3LIS331::resetHighPass()
+{
+    H3LIS331SPI->readByte(H3LIS331_HP_FILTER_RESET_Address | 0x80, deviceHandle);
+}
+bool H3LIS331::setInterrupt(uint8_t line, uint8_t events, float thresholdG, uint32_t durationUs, bool latch)
+{
+    if (line != 1 && line != 2)
+    {
+        return false;
+    }
+    uint8_t base = (line == 1) ? H3LIS331_INT1_CFG_Address : H3LIS331_INT2_CFG_Address;
+    // しきい値の1LSBはフルスケール/128
+    float fullScale = (getRange() == H3LIS331_CTRL_REG4_100G) ? 100.0f : (getRange() == H3LIS331_CTRL_REG4_200G) ? 200.0f : 400.0f;
+    int32_t ths = (int32_t)(thresholdG * 128.0f / fullScale + 0.5f);
+    ths = (ths < 1) ? 1 : (ths > 127) ? 127 : ths;
+    uint32_t period = getPeriodUs();
+    uint32_t duration = (period == 0) ? 0 : durationUs / period;
+    duration = (duration > 127) ? 127 : duration;
+
+    // 設定を変える間に割り込みがかからないように、先にイベントを止める
+    H3LIS331SPI->setReg(base, 0x00, deviceHandle);
+    H3LIS331SPI->setReg(base + 2, (uint8_t)ths, deviceHandle);
+    H3LIS331SPI->setReg(base + 3, (uint8_t)duration, deviceHandle);
+    bool ok = H3LIS331SPI->readByte((base + 2) | 0x80, deviceHandle) == (uint8_t)ths;
+    ok = ok && H3LIS331SPI->readByte((base + 3) | 0x80, deviceHandle) == (uint8_t)duration;
+
+    // INTxのピンにはINTx_SRCを出す (I1_CFG, I2_CFG = 00)
+    uint8_t lir = (line == 1) ? H3LIS331_INT_LIR1 : H3LIS331_INT_LIR2;
+    uint8_t routing = (line == 1) ? 0x03 : 0x18;
+    ctrlReg3 = (ctrlReg3 & ~(lir | routing)) | (latch ? lir : 0);
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG3_Address, ctrlReg3, deviceHandle);
+    ok = ok && H3LIS331SPI->readByte(H3LIS331_CTRL_REG3_Address | 0x80, deviceHandle) == ctrlReg3;
+
+    // 前の割り込みを解除してからイベントを有効にする
+    readInterruptSource(line);
+    H3LIS331SPI->setReg(base, events, deviceHandle);
+    intRegs[line - 1][0] = events;
+    intRegs[line - 1][1] = (uint8_t)ths;
+    intRegs[line - 1][2] = (uint8_t)duration;
+    return ok && H3LIS331SPI->readByte(base | 0x80, deviceHandle) == events;
+}
+uint8_t H3LIS331::readInterruptSource(uint8_t line)
+{
+    uint8_t reg = (line == 2) ? H3LIS331_INT2_SRC_Address : H3LIS331_INT1_SRC_Address;
+    return H3LIS331SPI->readByte(reg | 0x80, deviceHandle);
+}
+bool H3LIS331::setInterruptPin(uint8_t mode)
+{
+    if (mode & ~(H3LIS331_INT_ACTIVE_LOW | H3LIS331_INT_OPEN_DRAIN))
+    {
+        return false;
+    }
+    ctrlReg3 = (ctrlReg3 & ~(H3LIS331_INT_ACTIVE_LOW | H3LIS331_INT_OPEN_DRAIN)) | mode;
+    H3LIS331SPI->setReg(H3LIS331_CTRL_REG3_Address, ctrlReg3, deviceHandle);
+    return H3LIS331SPI->readByte(H3LIS331_CTRL_REG3_Address | 0x80, deviceHandle) == ctrlReg3;
+}
+IRAM_ATTR void H3LIS331::onInterrupt(void *arg)
+{
+    InterruptHook *hook = (InterruptHook *)arg;
+    hook->owner->interruptCount[hook->line - 1]++;
+    if (hook->callback != NULL)
+    {
+        hook->callback(hook->arg, hook->line);
+    }
+    BaseType_t woken = pdFALSE;
+    if (hook->task != NULL)
+    {
+        vTaskNotifyGiveFromISR(hook->task, &woken);
+    }
+    if (woken == pdTRUE)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+bool H3LIS331::attachInterrupt(uint8_t line, int pin, void (*callback)(void *arg, uint8_t line), void *arg)
+{
+    if (line != 1 && line != 2)
+    {
+        return false;
+    }
+    InterruptHook *hook = &hooks[line - 1];
+    hook->owner = this;
+    hook->line = line;
+    hook->pin = pin;
+    hook->task = xTaskGetCurrentTaskHandle();
+    hook->callback = callback;
+    hook->arg = arg;
+    pinMode(pin, INPUT);
+    attachInterruptArg(digitalPinToInterrupt(pin), onInterrupt, hook, (ctrlReg3 & H3LIS331_INT_ACTIVE_LOW) ? FALLING : RISING);
+    return true;
+}
+void H3LIS331::detachInterrupt(uint8_t line)
+{
+    if (line != 1 && line != 2)
+    {
+        return;
+    }
+    InterruptHook *hook = &hooks[line - 1];
+    if (hook->owner == NULL)
+    {
+        return;
+    }
+    ::detachInterrupt(digitalPinToInterrupt(hook->pin));
+    hook->owner = NULL;
+    hook->task = NULL;
+    hook->callback = NULL;
+}
+bool H3LIS331::waitInterrupt(TickType_t timeout)
+{
+    return ulTaskNotifyTake(pdTRUE, timeout) > 0;
+}
 #endif
\ No newline at end of file
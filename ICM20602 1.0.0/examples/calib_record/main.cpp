@@ -0,0 +1,55 @@
+// タンブルテストの記録 (IMUCommonのtools/imu_calib_fit.pyの入力)
+// 200HzでFIFOに溜めた加速度、角速度、温度をCSVでシリアルに出す
+// 出力: t_us,ax,ay,az,gx,gy,gz,temp (生の値)
+// 手順: 基板を6面以上(できれば12~20の向き)に置き、それぞれ2秒以上静止させながら、間はゆっくり回す
+//       温度係数も求めるなら、数分かけて温めるか冷やしながら続ける
+// PC: 例えば pio device monitor -b 921600 > tumble.csv
+#include <Arduino.h>
+#include "ICM20602.h"
+
+namespace ICMPIN
+{
+    const int SCK = 14;
+    const int MISO = 12;
+    const int MOSI = 13;
+    const int CS = 15;
+}
+
+#define RECORD_PERIOD_US 5000
+#define RECORD_MAX_SAMPLES 64
+
+ICM20602 icm20602;
+
+SPICREATE::SPICreate SPIC;
+
+ICM20602_FifoSample samples[RECORD_MAX_SAMPLES];
+uint8_t rx_buf[RECORD_MAX_SAMPLES * ICM20602_FIFO_FRAME_LENGTH];
+
+void setup()
+{
+    Serial.begin(921600);
+    SPIC.begin(VSPI, ICMPIN::SCK, ICMPIN::MISO, ICMPIN::MOSI);
+    icm20602.begin(&SPIC, ICMPIN::CS, 8000000);
+    while (icm20602.WhoAmI() != 0x12)
+    {
+        delay(100);
+    }
+    // 1kHz / (1 + 4) = 200Hz, DLPF 41Hz
+    icm20602.setSampleRate(4, 3);
+    icm20602.beginFifo(RECORD_PERIOD_US);
+    Serial.println("t_us,ax,ay,az,gx,gy,gz,temp");
+}
+
+void loop()
+{
+    uint16_t n = icm20602.ReadFifo(samples, RECORD_MAX_SAMPLES, rx_buf);
+    char line[80];
+    for (uint16_t i = 0; i < n; i++)
+    {
+        const ICM20602_FifoSample &s = samples[i];
+        snprintf(line, sizeof(line), "%lld,%d,%d,%d,%d,%d,%d,%d", (long long)s.timestamp,
+                 s.acc[0], s.acc[1], s.acc[2], s.gyro[0], s.gyro[1], s.gyro[2], s.temp);
+        Serial.println(line);
+    }
+    delay(50);
+}
@@ -1,41 +1,136 @@
 #pragma once
 
-#ifndef ICM_H
-#define ICM_H
+#ifndef ICM20602_H
+#define ICM20602_H
 #include <SPICREATE.h>
+#include <IMUBase.h> // 1.0.0
 #include <Arduino.h>
+#include <esp_timer.h>
 
 #define ICM_CONFIG 0x1A
 #define ICM_PWR_MGMT_1 0x6B
-#define ICM_GYRO_CONFIG 0x1B
-#define ICM_ACC_CONFIG 0x1C
-#define ICM_16G 0b00011000
-#define ICM_8G 0b00010000
-#define ICM_4G 0b00001000
-#define ICM_2G 0b00000000
-#define ICM_2000dps 0b00011000
-#define ICM_1000dps 0b00010000
-#define ICM_500dps 0b00001000
-#define ICM_250dps 0b00000000
-#define ICM_WhoAmI_Adress 0x75
-#define ICM_Data_Adress 0x3B
+#define ICM20602_GYRO_CONFIG 0x1B
+#define ICM20602_ACC_CONFIG 0x1C
+#define ICM20602_16G 0b00011000
+#define ICM20602_8G 0b00010000
+#define ICM20602_4G 0b00001000
+#define ICM20602_2G 0b00000000
+#define ICM20602_2000dps 0b00011000
+#define ICM20602_1000dps 0b00010000
+#define ICM20602_500dps 0b00001000
+#define ICM20602_250dps 0b00000000
+#define ICM20602_WhoAmI_Adress 0x75
+#define ICM20602_Data_Adress 0x3B
 #define ICM_I2C_IF 0x70
 
-class ICM
+#define ICM20602_SMPLRT_DIV 0x19
+#define ICM20602_FIFO_EN 0x23     // bit4: GYRO_FIFO_EN (温度も入る), bit3: ACCEL_FIFO_EN
+#define ICM20602_INT_PIN_CFG 0x37 // bit5: LATCH_INT_EN, bit4: INT_RD_CLEAR
+#define ICM20602_INT_ENABLE 0x38  // bit4: FIFO_OFLOW_EN, bit0: DATA_RDY_INT_EN
+#define ICM20602_INT_STATUS 0x3A  // bit4: FIFO_OFLOW_INT, bit0: DATA_RDY_INT
+#define ICM20602_USER_CTRL 0x6A   // bit6: FIFO_EN, bit2: FIFO_RST
+#define ICM20602_FIFO_COUNTH 0x72 // FIFO_COUNTL 0x73
+#define ICM20602_FIFO_R_W 0x74
+#define ICM20602_FIFO_MODE_STOP 0b01000000 // CONFIGのbit6 満杯になったら止める
+// FIFOの1フレーム accel(6) temp(2) gyro(6)
+#define ICM20602_FIFO_FRAME_LENGTH 14
+#define ICM20602_FIFO_SIZE 1008
+
+// FIFOから読んだ1サンプル
+struct ICM20602_FifoSample
+{
+    int16_t acc[3];
+    int16_t temp; // raw / 326.8 + 25 [℃]
+    int16_t gyro[3];
+    int64_t timestamp; // esp_timer_get_time()基準 サンプル周期から復元した時刻[us]
+};
+
+class ICM20602 : public IMUBase<ICM20602>
 {
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *ICMSPI;
 
+    void readBurst(uint8_t reg, uint8_t *rx_buf, size_t len);
+    int16_t lastAcc[3] = {};
+
+    uint32_t fifoPeriodUs = 0;
+    int64_t fifoLastTimestamp = -1;
+
+    TaskHandle_t dataReadyTask = NULL;
+    static void onDataReady(void *arg);
+
+    // queueRead用 結果を受け取るまで残しておく
+    spi_transaction_ext_t imuTransaction = {};
+    uint8_t imuRx[16] __attribute__((aligned(4)));
+
 public:
     void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000);
     uint8_t WhoAmI(); // Return 0x12
     void Get(int16_t *rx);
     void Get(int16_t *rx, uint8_t *rx_raw);
+    // temp付き rx: accel(3), gyro(3), temp(1)
+    void GetWithTemp(int16_t *rx, uint8_t *rx_raw);
+
+    // 最後にGet (collect) した温度の生の値 加速度、角速度と一緒に読んでいるので追加の通信はない
+    int16_t TemperatureRaw = 0;
+    // 最後にGetした温度[℃] (IMUCalibの温度補正に使う)
+    float GetTemperature() { return TempToCelsius(TemperatureRaw); }
+    // 温度の生の値 (FIFOのtempも同じ) を℃にする
+    static float TempToCelsius(int16_t raw) { return raw / 326.8f + 25.0f; }
+
+    // trueならGetのたびにAccelNormを計算する (従来通り)
+    // falseにするとGetはSPI通信とバイトスワップだけになる 大きさは必要なときにGetAccelNorm()で計算する
+    bool autoNorm = true;
     float AccelNorm = 0.;
+    // 最後にGetした加速度の大きさ[G] (16G設定)
+    float GetAccelNorm();
+    // FIFOから読んだサンプルの加速度の大きさ[G]をまとめて計算する
+    static void AccelNormBatch(const ICM20602_FifoSample *samples, uint16_t n, float *norm);
+
+    /**
+     * @brief サンプルレートを設定する ODR = 1kHz / (1 + div)
+     * @param[in] div SMPLRT_DIV
+     * @param[in] dlpf DLPF_CFG 1~6 (0, 7だとdivが効かず8kHzになるのでここでは使わない)
+     * @retval false: dlpfが範囲外、または読み返した値が違う
+     */
+    bool setSampleRate(uint8_t div, uint8_t dlpf);
+
+    /**
+     * @brief 加速度、温度、角速度をFIFOに溜め始める 満杯になったら止める
+     * @param[in] samplePeriodUs サンプル周期[us] タイムスタンプの復元に使う
+     */
+    void beginFifo(uint32_t samplePeriodUs);
+    void endFifo();
+    void resetFifo();
+    uint16_t fifoCount(); // FIFOに溜まっているbyte数
+    /**
+     * @brief FIFOに溜まっているフレームを1回のSPI通信でまとめて読む
+     * @param[in] rx_buf maxSamples * ICM20602_FIFO_FRAME_LENGTH byte以上
+     * @return 読んだサンプル数 FIFOがあふれていたら0 (FIFOは空にする)
+     */
+    uint16_t ReadFifo(ICM20602_FifoSample *samples, uint16_t maxSamples, uint8_t *rx_buf);
+    uint32_t fifoOverflowCount = 0;
+
+    /**
+     * @brief データレディ割り込みを有効にする INTピンは50usのパルス
+     * 呼び出したタスクにタスク通知が届くので、waitDataReadyで待つ
+     * @param[in] intPin ICMのINTをつないだピン
+     */
+    void enableDataReady(int intPin);
+    void disableDataReady(int intPin);
+    // 次のデータレディまで待つ タイムアウトしたらfalse
+    bool waitDataReady(TickType_t timeout = portMAX_DELAY);
+    volatile uint32_t dataReadyCount = 0;
+
+    // IMUBaseから呼ばれる (直接呼ばずにqueueRead, collect, readを使う)
+    bool queueReadImpl();
+    bool collectImpl(IMUSample *sample);
+    float accelLsbPerG() { return 2048.0f; } // 16G
+    float gyroLsbPerDps() { return 16.4f; }  // 2000dps
 };
 
-IRAM_ATTR void ICM::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
+IRAM_ATTR void ICM20602::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
 {
     CS = cs;
     ICMSPI = targetSPI;
@@ -59,27 +154,27 @@ IRAM_ATTR void ICM::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq
     ICMSPI->setReg(ICM_I2C_IF, 0b01000000, deviceHandle);
     ICMSPI->setReg(ICM_CONFIG, 0x00, deviceHandle);
     ICMSPI->setReg(ICM_PWR_MGMT_1, 0x01, deviceHandle);
-    ICMSPI->setReg(ICM_ACC_CONFIG, ICM_16G, deviceHandle);
-    ICMSPI->setReg(ICM_GYRO_CONFIG, ICM_2000dps, deviceHandle);
+    ICMSPI->setReg(ICM20602_ACC_CONFIG, ICM20602_16G, deviceHandle);
+    ICMSPI->setReg(ICM20602_GYRO_CONFIG, ICM20602_2000dps, deviceHandle);
     return;
 }
-IRAM_ATTR uint8_t ICM::WhoAmI()
+IRAM_ATTR uint8_t ICM20602::WhoAmI()
 {
-    return ICMSPI->readByte(0x80 | ICM_WhoAmI_Adress, deviceHandle);
+    return ICMSPI->readByte(0x80 | ICM20602_WhoAmI_Adress, deviceHandle);
 }
 
-IRAM_ATTR void ICM::Get(int16_t *rx)
+IRAM_ATTR void ICM20602::Get(int16_t *rx)
 {
     uint8_t rx_raw[14];
     Get(rx, rx_raw);
 }
 
-IRAM_ATTR void ICM::Get(int16_t *rx, uint8_t *rx_raw)
+IRAM_ATTR void ICM20602::Get(int16_t *rx, uint8_t *rx_raw)
 {
     spi_transaction_t comm = {};
     comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
     comm.length = (14) * 8;
-    comm.cmd = ICM_Data_Adress | 0x80;
+    comm.cmd = ICM20602_Data_Adress | 0x80;
 
     comm.tx_buffer = NULL;
     comm.rx_buffer = rx_raw;
@@ -96,9 +191,243 @@ IRAM_ATTR void ICM::Get(int16_t *rx, uint8_t *rx_raw)
     rx[3] = (int16_t)(rx_raw[8] << 8 | rx_raw[9]);
     rx[4] = (int16_t)(rx_raw[10] << 8 | rx_raw[11]);
     rx[5] = (int16_t)(rx_raw[12] << 8 | rx_raw[13]);
+    TemperatureRaw = (int16_t)(rx_raw[6] << 8 | rx_raw[7]);
 
-    float Accel_Buf = rx[0] * rx[0] + rx[1] * rx[1] + rx[2] * rx[2];
-    AccelNorm = (float)(sqrt((float)(Accel_Buf)) * 16. / 32768.);
+    lastAcc[0] = rx[0];
+    lastAcc[1] = rx[1];
+    lastAcc[2] = rx[2];
+    if (autoNorm)
+    {
+        AccelNorm = GetAccelNorm();
+    }
     return;
 }
+
+IRAM_ATTR void ICM20602::GetWithTemp(int16_t *rx, uint8_t *rx_raw)
+{
+    Get(rx, rx_raw);
+    rx[6] = TemperatureRaw;
+}
+
+float ICM20602::GetAccelNorm()
+{
+    // int16の2乗3つの和はintからあふれることがある (最大3 * 2^30) ので、2乗ごとにuint32にしてから足す
+    uint32_t sq = (uint32_t)((int32_t)lastAcc[0] * lastAcc[0]) + (uint32_t)((int32_t)lastAcc[1] * lastAcc[1]) +
+                  (uint32_t)((int32_t)lastAcc[2] * lastAcc[2]);
+    return sqrtf((float)sq) * 16.0f / 32768.0f;
+}
+
+void ICM20602::AccelNormBatch(const ICM20602_FifoSample *samples, uint16_t n, float *norm)
+{
+    for (uint16_t i = 0; i < n; i++)
+    {
+        const int16_t *a = samples[i].acc;
+        uint32_t sq = (uint32_t)((int32_t)a[0] * a[0]) + (uint32_t)((int32_t)a[1] * a[1]) + (uint32_t)((int32_t)a[2] * a[2]);
+        norm[i] = sqrtf((float)sq) * (16.0f / 32768.0f);
+    }
+}
+
+void ICM20602::readBurst(uint8_t reg, uint8_t *rx_buf, size_t len)
+{
+    spi_transaction_t comm = {};
+    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.length = len * 8;
+    comm.cmd = reg | 0x80;
+
+    comm.tx_buffer = NULL;
+    comm.rx_buffer = rx_buf;
+    comm.user = (void *)CS;
+
+    spi_transaction_ext_t spi_transaction = {};
+    spi_transaction.base = comm;
+    spi_transaction.command_bits = 8;
+    ICMSPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+}
+
+bool ICM20602::setSampleRate(uint8_t div, uint8_t dlpf)
+{
+    if (dlpf < 1 || dlpf > 6)
+    {
+        return false;
+    }
+    uint8_t config = (ICMSPI->readByte(ICM_CONFIG | 0x80, deviceHandle) & ~0x07) | dlpf;
+    ICMSPI->setReg(ICM_CONFIG, config, deviceHandle);
+    ICMSPI->setReg(ICM20602_SMPLRT_DIV, div, deviceHandle);
+    return ICMSPI->readByte(ICM_CONFIG | 0x80, deviceHandle) == config &&
+           ICMSPI->readByte(ICM20602_SMPLRT_DIV | 0x80, deviceHandle) == div;
+}
+
+void ICM20602::beginFifo(uint32_t samplePeriodUs)
+{
+    fifoPeriodUs = samplePeriodUs;
+    uint8_t config = ICMSPI->readByte(ICM_CONFIG | 0x80, deviceHandle);
+    ICMSPI->setReg(ICM_CONFIG, config | ICM20602_FIFO_MODE_STOP, deviceHandle);
+    ICMSPI->setReg(ICM20602_FIFO_EN, 0b00011000, deviceHandle);
+    uint8_t enable = ICMSPI->readByte(ICM20602_INT_ENABLE | 0x80, deviceHandle);
+    ICMSPI->setReg(ICM20602_INT_ENABLE, enable | 0b00010000, deviceHandle);
+    resetFifo();
+    return;
+}
+
+void ICM20602::endFifo()
+{
+    ICMSPI->setReg(ICM20602_FIFO_EN, 0x00, deviceHandle);
+    ICMSPI->setReg(ICM20602_USER_CTRL, 0x00, deviceHandle);
+    return;
+}
+
+void ICM20602::resetFifo()
+{
+    // FIFO_RSTは自動で0に戻る
+    ICMSPI->setReg(ICM20602_USER_CTRL, 0b01000100, deviceHandle);
+    // FIFO_OFLOW_INTを読んで消しておく
+    ICMSPI->readByte(ICM20602_INT_STATUS | 0x80, deviceHandle);
+    fifoLastTimestamp = -1;
+    return;
+}
+
+uint16_t ICM20602::fifoCount()
+{
+    // FIFO_COUNTH, Lは1回で読むこと
+    uint8_t rx_buf[2];
+    readBurst(ICM20602_FIFO_COUNTH, rx_buf, 2);
+    return ((rx_buf[0] & 0x03) << 8) | rx_buf[1];
+}
+
+IRAM_ATTR uint16_t ICM20602::ReadFifo(ICM20602_FifoSample *samples, uint16_t maxSamples, uint8_t *rx_buf)
+{
+    if (ICMSPI->readByte(ICM20602_INT_STATUS | 0x80, deviceHandle) & 0b00010000)
+    {
+        fifoOverflowCount++;
+        resetFifo();
+        return 0;
+    }
+    uint16_t n = fifoCount() / ICM20602_FIFO_FRAME_LENGTH;
+    if (n > maxSamples)
+    {
+        n = maxSamples;
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+    int64_t now = esp_timer_get_time();
+    // FIFO_R_Wはアドレスが進まないので全部のフレームを1回で読める
+    readBurst(ICM20602_FIFO_R_W, rx_buf, (size_t)n * ICM20602_FIFO_FRAME_LENGTH);
+
+    // サンプルは等間隔で、一番新しいものがほぼnow
+    // 前回の続きの時刻が2周期以上ずれたらnowに合わせ直す
+    int64_t first = fifoLastTimestamp + fifoPeriodUs;
+    int64_t newest = first + (int64_t)(n - 1) * fifoPeriodUs;
+    if (fifoLastTimestamp < 0 || newest > now || now - newest > 2 * (int64_t)fifoPeriodUs)
+    {
+        first = now - (int64_t)(n - 1) * fifoPeriodUs;
+    }
+    for (uint16_t i = 0; i < n; i++)
+    {
+        uint8_t *frame = &rx_buf[i * ICM20602_FIFO_FRAME_LENGTH];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            samples[i].acc[axis] = (int16_t)(frame[2 * axis] << 8 | frame[2 * axis + 1]);
+            samples[i].gyro[axis] = (int16_t)(frame[8 + 2 * axis] << 8 | frame[9 + 2 * axis]);
+        }
+        samples[i].temp = (int16_t)(frame[6] << 8 | frame[7]);
+        samples[i].timestamp = first + (int64_t)i * fifoPeriodUs;
+    }
+    fifoLastTimestamp = samples[n - 1].timestamp;
+    return n;
+}
+
+IRAM_ATTR bool ICM20602::queueReadImpl()
+{
+    spi_transaction_t comm = {};
+    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.length = (14) * 8;
+    comm.cmd = ICM20602_Data_Adress | 0x80;
+    comm.tx_buffer = NULL;
+    comm.rx_buffer = imuRx;
+    comm.user = (void *)CS;
+
+    imuTransaction = {};
+    imuTransaction.base = comm;
+    imuTransaction.command_bits = 8;
+    return ICMSPI->queueTransmit((spi_transaction_t *)&imuTransaction, deviceHandle) == ESP_OK;
+}
+
+IRAM_ATTR bool ICM20602::collectImpl(IMUSample *sample)
+{
+    if (ICMSPI->getTransmitResult(deviceHandle) != ESP_OK)
+    {
+        return false;
+    }
+    sample->timestamp = esp_timer_get_time();
+    // accel(6) temp(2) gyro(6)
+    for (int axis = 0; axis < 3; axis++)
+    {
+        sample->acc[axis] = (int16_t)(imuRx[2 * axis] << 8 | imuRx[2 * axis + 1]);
+        sample->gyro[axis] = (int16_t)(imuRx[8 + 2 * axis] << 8 | imuRx[9 + 2 * axis]);
+        lastAcc[axis] = sample->acc[axis];
+    }
+    sample->temp = (int16_t)(imuRx[6] << 8 | imuRx[7]);
+    TemperatureRaw = sample->temp;
+    return true;
+}
+
+IRAM_ATTR void ICM20602::onDataReady(void *arg)
+{
+    ICM20602 *icm = (ICM20602 *)arg;
+    icm->dataReadyCount++;
+    BaseType_t woken = pdFALSE;
+    if (icm->dataReadyTask != NULL)
+    {
+        vTaskNotifyGiveFromISR(icm->dataReadyTask, &woken);
+    }
+    if (woken == pdTRUE)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+void ICM20602::enableDataReady(int intPin)
+{
+    dataReadyTask = xTaskGetCurrentTaskHandle();
+    // active high, push-pull, 50usのパルス
+    ICMSPI->setReg(ICM20602_INT_PIN_CFG, 0x00, deviceHandle);
+    uint8_t enable = ICMSPI->readByte(ICM20602_INT_ENABLE | 0x80, deviceHandle);
+    ICMSPI->setReg(ICM20602_INT_ENABLE, enable | 0b00000001, deviceHandle);
+    pinMode(intPin, INPUT);
+    attachInterruptArg(digitalPinToInterrupt(intPin), onDataReady, this, RISING);
+}
+
+void ICM20602::disableDataReady(int intPin)
+{
+    detachInterrupt(digitalPinToInterrupt(intPin));
+    uint8_t enable = ICMSPI->readByte(ICM20602_INT_ENABLE | 0x80, deviceHandle);
+    ICMSPI->setReg(ICM20602_INT_ENABLE, enable & ~0b00000001, deviceHandle);
+    dataReadyTask = NULL;
+}
+
+bool ICM20602::waitDataReady(TickType_t timeout)
+{
+    return ulTaskNotifyTake(pdTRUE, timeout) > 0;
+}
+
+// 従来のコードとの互換のため、最初にincludeしたICMのクラスはICMという名前でも使える
+#ifndef ICM_TYPE_DEFINED
+#define ICM_TYPE_DEFINED
+typedef ICM20602 ICM;
+// 以前のICM_で始まるマクロも、ICMにしたドライバの値で定義する
+#define ICM_GYRO_CONFIG ICM20602_GYRO_CONFIG
+#define ICM_ACC_CONFIG ICM20602_ACC_CONFIG
+#define ICM_16G ICM20602_16G
+#define ICM_8G ICM20602_8G
+#define ICM_4G ICM20602_4G
+#define ICM_2G ICM20602_2G
+#define ICM_2000dps ICM20602_2000dps
+#define ICM_1000dps ICM20602_1000dps
+#define ICM_500dps ICM20602_500dps
+#define ICM_250dps ICM20602_250dps
+#define ICM_WhoAmI_Adress ICM20602_WhoAmI_Adress
+#define ICM_Data_Adress ICM20602_Data_Adress
+#endif
 #endif
@@ -1,26 +1,29 @@
 // version: 2.0.0
 #pragma once
 
-#ifndef ICM_H
-#define ICM_H
+#ifndef ICM20948_H
+#define ICM20948_H
 #include <Arduino.h>
 #include <SPICREATE.h>  // 2.0.0
+#include <IMUBase.h>    // 1.0.0
+#include <esp_timer.h>
 
-#define ICM_Data_Adress 0x2D    // BANK0
-#define ICM_GYRO_CONFIG 0x01    // BANK2
-#define ICM_WhoAmI_Adress 0x00  // BANK0 default0xEA
-#define ICM_ACC_CONFIG 0x14     // BANK2
+#define ICM20948_Data_Adress 0x2D    // BANK0
+#define ICM20948_GYRO_CONFIG 0x01    // BANK2
+#define ICM20948_WhoAmI_Adress 0x00  // BANK0 default0xEA
+#define ICM20948_WhoAmI_Value 0xEA
+#define ICM20948_ACC_CONFIG 0x14     // BANK2
 #define ICM_REG_BANK 0x7F       // default BANK0
 #define ICM_PWR_MGMT 0x06       // BANK0
 #define ICM_USER_CTRL 0x03      // BANK0
-#define ICM_16G 0b00000110
-#define ICM_8G 0b00000100
-#define ICM_4G 0b00000010
-#define ICM_2G 0b00000000
-#define ICM_2000dps 0b00000110
-#define ICM_1000dps 0b00000010
-#define ICM_500dps 0b00000100
-#define ICM_250dps 0b00000000
+#define ICM20948_16G 0b00000110
+#define ICM20948_8G 0b00000100
+#define ICM20948_4G 0b00000010
+#define ICM20948_2G 0b00000000
+#define ICM20948_2000dps 0b00000110
+#define ICM20948_1000dps 0b00000010
+#define ICM20948_500dps 0b00000100
+#define ICM20948_250dps 0b00000000
 #define ICM_USER_BANK0 0b00000000
 #define ICM_USER_BANK1 0b00010000
 #define ICM_USER_BANK2 0b00100000
@@ -28,9 +31,25 @@
 
 // #define ICM_2500deg 0x18
 
+#define ICM_GYRO_SMPLRT_DIV 0x00    // BANK2
+#define ICM_ODR_ALIGN_EN 0x09       // BANK2
+#define ICM_ACCEL_SMPLRT_DIV_1 0x10  // BANK2 bit3:0 = divider bit11:8
+#define ICM_ACCEL_SMPLRT_DIV_2 0x11  // BANK2 divider bit7:0
+#define ICM_FS_MASK 0b00000110       // GYRO_CONFIG_1, ACCEL_CONFIG
+#define ICM_DLPF_MASK 0b00111001     // DLPFCFG[5:3] | FCHOICE[0]
+#define ICM_DLPF_BYPASS 0xFF         // dlpf argument to bypass the filter
+// output rates, 1.125kHz / (1 + div) with the DLPF
+#define ICM_INTERNAL_ODR 1125.0f
+#define ICM_GYRO_BYPASS_ODR 9000.0f
+#define ICM_ACCEL_BYPASS_ODR 4500.0f
+
 #define ICM_INT_PIN_CFG 0x0F      // BANK0
 #define ICM_LP_CONFIG 0x05        // BANK0
 #define ICM_I2C_MST_STATUS 0x17   // BANK0
+#define ICM_I2C_SLV4_DONE 0b01000000  // I2C_MST_STATUS, cleared on read
+#define ICM_I2C_SLV4_NACK 0b00010000  // I2C_MST_STATUS, cleared on read
+#define ICM_SLV4_TIMEOUT_US 2000      // one SLV4 transaction, at least
+#define ICM_MAG_TIMEOUT_US 100000     // whole magnetometer startup
 #define ICM_I2C_MST_CTRL 0x01     // BANK3
 #define ICM_MagData_Address 0x3B  // BANK0
 #define ICM_I2C_SLV0_ADDR 0x03    // BANK3
@@ -55,6 +74,23 @@
 #define ICM_I2C_SLV4_DO 0x16      // BANK3
 #define ICM_I2C_SLV4_DI 0x17      // BANK3
 
+// ACCEL_XOUT_H(0x2D) ~ EXT_SLV_SENS_DATA_08(0x43)
+// accel(6) gyro(6) temp(2) and AK09916 ST1, HXL..HZH, TMPS, ST2 read by SLV0 (9)
+#define ICM_SAMPLE_LENGTH 23
+
+#define ICM_INT_STATUS_2 0x1C  // BANK0 FIFO_OVERFLOW_INT[4:0]
+#define ICM_FIFO_EN_2 0x67     // BANK0
+#define ICM_FIFO_RST 0x68      // BANK0
+#define ICM_FIFO_MODE 0x69     // BANK0
+#define ICM_FIFO_COUNTH 0x70   // BANK0
+#define ICM_FIFO_R_W 0x72      // BANK0
+#define ICM_FIFO_ACCEL_GYRO 0b00011110  // ACCEL_FIFO_EN | GYRO_Z/Y/X_FIFO_EN
+#define ICM_FIFO_SNAPSHOT 0x01  // stop writing when full instead of overwriting
+#define ICM_FIFO_FRAME_LENGTH 12  // accel(6) gyro(6)
+
+// USER_CTRL bits that clear themselves, never kept in the shadow
+#define ICM_USER_CTRL_SELF_CLEAR 0b00001110  // DMP_RST, SRAM_RST, I2C_MST_RST
+
 #define AK09916_I2C_address 0x0C
 // ↓AK09916 registers
 
@@ -64,82 +100,210 @@
 #define AK09916_REG_CNTL2 0x31
 #define AK09916_REG_CNTL3 0x32
 
-class ICM {
+// one sample decoded from GetAll
+struct ICM_Sample {
+    int16_t acc[3];
+    int16_t gyro[3];
+    int16_t temp;
+    int16_t mag[3];
+    uint8_t magStatus;  // AK09916 ST1 (bit0: DRDY, bit1: DOR)
+};
+
+// one sample from the FIFO
+struct ICM_FifoSample {
+    int16_t acc[3];
+    int16_t gyro[3];
+    int64_t timestamp;  // esp_timer_get_time() base, reconstructed [us]
+};
+
+class ICM20948 : public IMUBase<ICM20948> {
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *ICMSPI;
 
-    uint8_t readMag(uint8_t reg);
-    void writeMag(uint8_t reg, uint8_t data);
-    void ICM_20948_i2c_controller_periph4_txn(
+    bool readMag(uint8_t reg, uint8_t *data);
+    bool writeMag(uint8_t reg, uint8_t data);
+    // returns false on NACK or timeout
+    bool ICM_20948_i2c_controller_periph4_txn(
         uint8_t addr, uint8_t reg, uint8_t *data,
         bool Rw);  // 1: Read 0: Write  len is always 1
-    void ICM_20948_i2c_master_single_w(uint8_t addr, uint8_t reg, uint8_t data);
-    uint8_t ICM_20948_i2c_master_single_r(uint8_t addr, uint8_t reg);
+    // the I2C master steps once per gyro sample, so wait for two of them
+    uint32_t slv4TimeoutUs();
+    bool ICM_20948_i2c_master_single_w(uint8_t addr, uint8_t reg, uint8_t data);
+    bool ICM_20948_i2c_master_single_r(uint8_t addr, uint8_t reg,
+                                       uint8_t *data);
     void i2c_master_reset();
-    void resetMag();
+    bool resetMag();
     void i2cControllerConfigurePeripheral(uint8_t peripheral, uint8_t addr,
                                           uint8_t reg, uint8_t len, bool Rw,
                                           bool enable, bool data_only, bool grp,
                                           bool swap, uint8_t dataOut);
 
     void i2c_master_enable();
+    // register setup shared by begin and reinit
+    bool configure();
+
+    uint32_t fifoPeriodUs{0};
+    int64_t fifoLastTimestamp{-1};
+    int64_t fifoResetTimestamp{0};
+    // INT_STATUS_2 is cleared on read, so remember the overflow until drained
+    bool fifoOverflowPending{false};
+
+    // kept until the queued read is collected
+    spi_transaction_ext_t imuTransaction = {};
+    uint8_t imuRx[16] __attribute__((aligned(4)));
+
+    // shadow of the registers written by this driver
+    // bank is ICM_USER_BANKx, reg is the address in that bank
+    // every public call leaves the chip in bank 0 (parkBank), so the data
+    // reads, including the queued one of queueReadImpl, never switch banks
+    int currentBank{-1};  // -1: unknown
+    uint8_t shadow[4][128]{};
+    uint32_t shadowValid[4][4]{};
+    void selectBank(uint8_t bank);
+    void parkBank() { selectBank(ICM_USER_BANK0); }
+    bool shadowed(uint8_t bank, uint8_t reg) {
+        return shadowValid[bank >> 4][reg >> 5] & (1UL << (reg & 31));
+    }
+    // write and remember the value (without the bits in selfClear)
+    void writeReg(uint8_t bank, uint8_t reg, uint8_t value,
+                  uint8_t selfClear = 0);
+    // read from hardware, for data and status registers
+    uint8_t readReg(uint8_t bank, uint8_t reg);
+    // the shadow if valid, otherwise read from hardware once
+    uint8_t readCached(uint8_t bank, uint8_t reg);
+    void modifyReg(uint8_t bank, uint8_t reg, uint8_t clearBits,
+                   uint8_t setBits, uint8_t selfClear = 0);
+    // compare the hardware with the shadow, the shadow follows the hardware
+    bool verifyReg(uint8_t bank, uint8_t reg);
 
    public:
     void begin(SPICREATE::SPICreate *targetSPI, int cs,
                uint32_t freq = 8000000);
     uint8_t WhoAmI();
-    uint8_t UserBank();
+    uint8_t UserBank();  // read REG_BANK_SEL from hardware
+    // forget the shadow registers and the bank, call after a bus error
+    void resyncShadow();
+    // write the configuration again after the chip lost it (power glitch etc.)
+    // no addDevice, so it can be called any number of times
+    // the ODR and filter settings in bank 2 are restored from the shadow
+    // blocks up to ICM_MAG_TIMEOUT_US while the magnetometer restarts
+    // returns false if WhoAmI is wrong or the magnetometer does not answer
+    bool reinit();
+    // SPI errors of this device
+    uint32_t spiErrorCount() { return ICMSPI->getErrorCount(deviceHandle); }
+    uint32_t bankSwitchCount{0};
+
+    // output rate and low pass filter
+    // ODR = 1.125kHz / (1 + div)  gyro div: 0-255, accel div: 0-4095
+    // dlpf: DLPFCFG 0-7 (gyro 3dB: 197, 152, 120, 51, 24, 12, 6, 361 Hz
+    //                     accel 3dB: 246, 246, 111, 50, 24, 12, 6, 473 Hz)
+    //       ICM_DLPF_BYPASS: no filter, div is ignored (gyro 9kHz, accel 4.5kHz)
+    // returns false if an argument is out of range or the readback differs
+    bool setGyroODR(uint8_t div, uint8_t dlpf);
+    bool setAccelODR(uint16_t div, uint8_t dlpf);
+    float getGyroODR();   // effective output rate [Hz]
+    float getAccelODR();  // effective output rate [Hz]
+    uint32_t getGyroPeriodUs() { return (uint32_t)(1e6f / getGyroODR() + 0.5f); }
+    uint32_t getAccelPeriodUs() {
+        return (uint32_t)(1e6f / getAccelODR() + 0.5f);
+    }
     void Get(int16_t *rx, uint8_t *rx_buf);
     void GetMag(int16_t *rx);
+    // accel, gyro, temp and magnetometer in one SPI transaction
+    // rx_buf must be ICM_SAMPLE_LENGTH bytes
+    void GetAll(ICM_Sample *sample, uint8_t *rx_buf);
+
+    // FIFO streaming of accel and gyro (12 bytes per sample)
+    // samplePeriodUs is the output period of the sensor, used for timestamps
+    void beginFifo(uint32_t samplePeriodUs);
+    void endFifo();
+    void resetFifo();
+    uint16_t fifoCount();  // bytes in the FIFO
+    // drain up to maxSamples whole frames in one SPI transaction
+    // rx_buf must be maxSamples * ICM_FIFO_FRAME_LENGTH bytes
+    // returns number of samples, 0 if empty
+    // after an overflow the frames already in the FIFO are still returned,
+    // then the FIFO is reset and fifoOverflowCount is incremented
+    uint16_t ReadFifo(ICM_FifoSample *samples, uint16_t maxSamples,
+                      uint8_t *rx_buf);
+    // incremented by the ReadFifo call that returned the last frames before
+    // a gap: samples after that batch were dropped
+    uint32_t fifoOverflowCount{0};
     void magWhoAmI(uint8_t *who1, uint8_t *who2);  // shoud be 1:0x48, 2:0x09
-    void startupMagnetometer();
+    // returns false if the magnetometer did not answer
+    bool startupMagnetometer();
+    uint32_t magStartupTime{0};  // time taken by startupMagnetometer [us]
+    uint32_t magNackCount{0};
+    uint32_t magTimeoutCount{0};
+
+    // called by IMUBase, use queueRead/collect/read instead
+    bool queueReadImpl();
+    bool collectImpl(IMUSample *sample);
+    float accelLsbPerG() { return 2048.0f; }  // ICM20948_16G
+    float gyroLsbPerDps() { return 16.4f; }   // ICM20948_2000dps
 };
 
-void ICM::ICM_20948_i2c_controller_periph4_txn(uint8_t addr, uint8_t reg,
+bool ICM20948::ICM_20948_i2c_controller_periph4_txn(uint8_t addr, uint8_t reg,
                                                uint8_t *data, bool Rw) {
     addr = (((Rw) ? 0x80 : 0x00) | addr);
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-    ICMSPI->setReg(ICM_I2C_SLV4_ADDR, addr, deviceHandle);
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-    ICMSPI->setReg(ICM_I2C_SLV4_REG, reg, deviceHandle);
-
-    uint8_t i2c_mst_status;
-    bool txn_failed = false;
-
+    // SLV4_ADDR and SLV4_REG are often the same as last time
+    if (!shadowed(ICM_USER_BANK3, ICM_I2C_SLV4_ADDR) ||
+        shadow[3][ICM_I2C_SLV4_ADDR] != addr) {
+        writeReg(ICM_USER_BANK3, ICM_I2C_SLV4_ADDR, addr);
+    }
+    if (!shadowed(ICM_USER_BANK3, ICM_I2C_SLV4_REG) ||
+        shadow[3][ICM_I2C_SLV4_REG] != reg) {
+        writeReg(ICM_USER_BANK3, ICM_I2C_SLV4_REG, reg);
+    }
     if (!Rw) {
-        ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-        ICMSPI->setReg(ICM_I2C_SLV4_DO, *data, deviceHandle);
+        writeReg(ICM_USER_BANK3, ICM_I2C_SLV4_DO, *data);
+    }
+    // SLV4_EN clears itself when the transaction is done
+    writeReg(ICM_USER_BANK3, ICM_I2C_SLV4_CTRL, 0b10000000, 0b10000000);
+
+    // wait for SLV4_DONE instead of a fixed delay
+    uint32_t timeout = slv4TimeoutUs();
+    int64_t start = esp_timer_get_time();
+    uint8_t i2c_mst_status = 0;
+    while (true) {
+        i2c_mst_status = readReg(ICM_USER_BANK0, ICM_I2C_MST_STATUS);
+        if (i2c_mst_status & (ICM_I2C_SLV4_DONE | ICM_I2C_SLV4_NACK)) {
+            break;
+        }
+        if (esp_timer_get_time() - start > timeout) {
+            magTimeoutCount++;
+            return false;
+        }
+    }
+    if (i2c_mst_status & ICM_I2C_SLV4_NACK) {
+        magNackCount++;
+        return false;
     }
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-    ICMSPI->setReg(ICM_I2C_SLV4_CTRL, 0b10000000, deviceHandle);
-    delay(5);
     if (Rw) {
-        ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-        *data = ICMSPI->readByte(ICM_I2C_SLV4_DI | 0x80, deviceHandle);
+        *data = readReg(ICM_USER_BANK3, ICM_I2C_SLV4_DI);
     }
-    delay(1);
-    return;
+    return true;
 }
-void ICM::ICM_20948_i2c_master_single_w(uint8_t addr, uint8_t reg,
+uint32_t ICM20948::slv4TimeoutUs() {
+    uint32_t timeout = 2 * getGyroPeriodUs() + 500;
+    return (timeout > ICM_SLV4_TIMEOUT_US) ? timeout : ICM_SLV4_TIMEOUT_US;
+}
+bool ICM20948::ICM_20948_i2c_master_single_w(uint8_t addr, uint8_t reg,
                                         uint8_t data) {
-    ICM_20948_i2c_controller_periph4_txn(addr, reg, &data, false);
-    return;
+    return ICM_20948_i2c_controller_periph4_txn(addr, reg, &data, false);
 }
-uint8_t ICM::ICM_20948_i2c_master_single_r(uint8_t addr, uint8_t reg) {
-    uint8_t data;
-    ICM_20948_i2c_controller_periph4_txn(addr, reg, &data, true);
-    return data;
+bool ICM20948::ICM_20948_i2c_master_single_r(uint8_t addr, uint8_t reg,
+                                        uint8_t *data) {
+    return ICM_20948_i2c_controller_periph4_txn(addr, reg, data, true);
 }
-uint8_t ICM::readMag(uint8_t reg) {
-    uint8_t data = ICM_20948_i2c_master_single_r(AK09916_I2C_address, reg);
-    return data;
+bool ICM20948::readMag(uint8_t reg, uint8_t *data) {
+    return ICM_20948_i2c_master_single_r(AK09916_I2C_address, reg, data);
 }
-void ICM::writeMag(uint8_t reg, uint8_t data) {
-    ICM_20948_i2c_master_single_w(AK09916_I2C_address, reg, data);
-    return;
+bool ICM20948::writeMag(uint8_t reg, uint8_t data) {
+    return ICM_20948_i2c_master_single_w(AK09916_I2C_address, reg, data);
 }
-void ICM::i2cControllerConfigurePeripheral(uint8_t peripheral, uint8_t addr,
+void ICM20948::i2cControllerConfigurePeripheral(uint8_t peripheral, uint8_t addr,
                                            uint8_t reg, uint8_t len, bool Rw,
                                            bool enable, bool data_only,
                                            bool grp, bool swap,
@@ -178,42 +342,91 @@ void ICM::i2cControllerConfigurePeripheral(uint8_t peripheral, uint8_t addr,
             return;
             break;
     }
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
     uint8_t address = addr;
     if (Rw) {
         address |= 0b10000000;
     }
-    ICMSPI->setReg(periph_addr_reg, address, deviceHandle);
+    writeReg(ICM_USER_BANK3, periph_addr_reg, address);
     if (!Rw) {
-        ICMSPI->setReg(periph_do_reg, dataOut, deviceHandle);
+        writeReg(ICM_USER_BANK3, periph_do_reg, dataOut);
+    }
+    writeReg(ICM_USER_BANK3, periph_reg_reg, reg);
+    writeReg(ICM_USER_BANK3, periph_ctrl_reg,
+             0x89);  //<-this value 0x89 is for only magnetrometer
+    return;
+}
+void ICM20948::i2c_master_enable() {
+    modifyReg(ICM_USER_BANK0, ICM_INT_PIN_CFG, 0b00000010,
+              0);  // disable I2C passthrough
+    writeReg(ICM_USER_BANK3, ICM_I2C_MST_CTRL, 0x17);
+    modifyReg(ICM_USER_BANK0, ICM_USER_CTRL, 0, 0b00100000,
+              ICM_USER_CTRL_SELF_CLEAR);
+    return;
+}
+void ICM20948::i2c_master_reset() {
+    modifyReg(ICM_USER_BANK0, ICM_USER_CTRL, 0, 0b00000010,
+              ICM_USER_CTRL_SELF_CLEAR);
+    return;
+}
+void ICM20948::selectBank(uint8_t bank) {
+    if (currentBank == bank) {
+        return;
     }
-    ICMSPI->setReg(periph_reg_reg, reg, deviceHandle);
-    ICMSPI->setReg(periph_ctrl_reg, 0x89,
-                   deviceHandle);  //<-this value 0x89 is for only magnetrometer
+    ICMSPI->setReg(ICM_REG_BANK, bank, deviceHandle);
+    currentBank = bank;
+    bankSwitchCount++;
     return;
 }
-void ICM::i2c_master_enable() {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    uint8_t reg = ICMSPI->readByte(ICM_INT_PIN_CFG | 0x80, deviceHandle);
-    reg &= 0b11111101;
-    ICMSPI->setReg(ICM_INT_PIN_CFG, reg,
-                   deviceHandle);  // disable I2C passthrough
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-    ICMSPI->setReg(ICM_I2C_MST_CTRL, 0x17, deviceHandle);
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    uint8_t ctrl = ICMSPI->readByte(ICM_USER_CTRL | 0x80, deviceHandle);
-    ctrl |= 0b00100000;
-    ICMSPI->setReg(ICM_USER_CTRL, ctrl, deviceHandle);
+void ICM20948::writeReg(uint8_t bank, uint8_t reg, uint8_t value,
+                   uint8_t selfClear) {
+    selectBank(bank);
+    ICMSPI->setReg(reg, value, deviceHandle);
+    shadow[bank >> 4][reg] = value & ~selfClear;
+    shadowValid[bank >> 4][reg >> 5] |= 1UL << (reg & 31);
     return;
 }
-void ICM::i2c_master_reset() {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    uint8_t ctrl = ICMSPI->readByte(ICM_USER_CTRL | 0x80, deviceHandle);
-    ctrl |= 0b00000010;
-    ICMSPI->setReg(ICM_USER_CTRL, ctrl, deviceHandle);
+uint8_t ICM20948::readReg(uint8_t bank, uint8_t reg) {
+    selectBank(bank);
+    return ICMSPI->readByte(reg | 0x80, deviceHandle);
+}
+uint8_t ICM20948::readCached(uint8_t bank, uint8_t reg) {
+    if (shadowed(bank, reg)) {
+        return shadow[bank >> 4][reg];
+    }
+    uint8_t value = readReg(bank, reg);
+    shadow[bank >> 4][reg] = value;
+    shadowValid[bank >> 4][reg >> 5] |= 1UL << (reg & 31);
+    return value;
+}
+void ICM20948::modifyReg(uint8_t bank, uint8_t reg, uint8_t clearBits,
+                    uint8_t setBits, uint8_t selfClear) {
+    uint8_t value = readCached(bank, reg) & ~selfClear;
+    uint8_t next = (value & ~clearBits) | setBits;
+    if (next == value && !(setBits & selfClear)) {
+        return;
+    }
+    writeReg(bank, reg, next, selfClear);
     return;
 }
-void ICM::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq) {
+bool ICM20948::verifyReg(uint8_t bank, uint8_t reg) {
+    uint8_t value = readReg(bank, reg);
+    bool same = shadowed(bank, reg) && shadow[bank >> 4][reg] == value;
+    shadow[bank >> 4][reg] = value;
+    shadowValid[bank >> 4][reg >> 5] |= 1UL << (reg & 31);
+    return same;
+}
+void ICM20948::resyncShadow() {
+    memset(shadowValid, 0, sizeof(shadowValid));
+    currentBank = -1;
+    parkBank();
+    return;
+}
+uint8_t ICM20948::UserBank() {
+    // REG_BANK_SEL is at 0x7F in every bank
+    currentBank = ICMSPI->readByte(ICM_REG_BANK | 0x80, deviceHandle) & 0x30;
+    return currentBank;
+}
+void ICM20948::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq) {
     CS = cs;
     ICMSPI = targetSPI;
     spi_device_interface_config_t if_cfg = {};
@@ -234,64 +447,97 @@ void ICM::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq) {
 
     deviceHandle = ICMSPI->addDevice(&if_cfg, cs);
 
-    ICMSPI->setReg(ICM_USER_CTRL, 0x10, deviceHandle);
-    ICMSPI->setReg(ICM_PWR_MGMT, 0x01, deviceHandle);  // turn off sleep mode
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK2, deviceHandle);
-    ICMSPI->setReg(ICM_ACC_CONFIG, ICM_16G, deviceHandle);
-    ICMSPI->setReg(ICM_GYRO_CONFIG, ICM_2000dps, deviceHandle);
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    startupMagnetometer();
-    delay(5);
+    // the sensor may keep its state over a reset of the MCU
+    resyncShadow();
+    configure();
     return;
 }
-uint8_t ICM::WhoAmI() {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    return ICMSPI->readByte(0x80 | ICM_WhoAmI_Adress, deviceHandle);
+bool ICM20948::configure() {
+    writeReg(ICM_USER_BANK0, ICM_USER_CTRL, 0x10);
+    writeReg(ICM_USER_BANK0, ICM_PWR_MGMT, 0x01);  // turn off sleep mode
+    writeReg(ICM_USER_BANK2, ICM20948_ACC_CONFIG, ICM20948_16G);
+    writeReg(ICM_USER_BANK2, ICM20948_GYRO_CONFIG, ICM20948_2000dps);
+    return startupMagnetometer();
+}
+bool ICM20948::reinit() {
+    // registers 0x00-0x1F of bank 2 (sample rate dividers, gyro/accel config)
+    uint8_t saved[32];
+    uint32_t valid = shadowValid[ICM_USER_BANK2 >> 4][0];
+    memcpy(saved, shadow[ICM_USER_BANK2 >> 4], sizeof(saved));
+    resyncShadow();
+    bool ok = configure();
+    for (uint8_t reg = 0; reg < 32; reg++) {
+        if (valid & (1UL << reg)) {
+            writeReg(ICM_USER_BANK2, reg, saved[reg]);
+        }
+    }
+    parkBank();
+    return WhoAmI() == ICM20948_WhoAmI_Value && ok;
 }
-void ICM::startupMagnetometer() {
+uint8_t ICM20948::WhoAmI() {
+    return readReg(ICM_USER_BANK0, ICM20948_WhoAmI_Adress);
+}
+bool ICM20948::startupMagnetometer() {
+    int64_t start = esp_timer_get_time();
+    // the I2C master steps at the gyro ODR, with a low ODR (setGyroODR) the
+    // startup would not fit in ICM_MAG_TIMEOUT_US, so run the gyro at the full
+    // 1.125kHz meanwhile and put the divider back afterwards
+    uint8_t gyroDiv = readCached(ICM_USER_BANK2, ICM_GYRO_SMPLRT_DIV);
+    if (gyroDiv != 0) {
+        writeReg(ICM_USER_BANK2, ICM_GYRO_SMPLRT_DIV, 0);
+    }
     i2c_master_enable();
     resetMag();
-    delay(10);
-    uint8_t tries = 0;
-    while (tries < 10) {
-        tries++;
-        uint8_t who1, who2;
-        magWhoAmI(&who1, &who2);
-        if (who1 == 0x48) {
-            break;
+    // poll WhoAmI until the AK09916 comes back from the soft reset
+    bool found = false;
+    while (esp_timer_get_time() - start < ICM_MAG_TIMEOUT_US) {
+        uint8_t who1 = 0;
+        if (readMag(AK09916_REG_WIA1, &who1)) {
+            if (who1 == 0x48) {
+                found = true;
+                break;
+            }
+        } else {
+            i2c_master_reset();
+            delayMicroseconds(100);
         }
-        i2c_master_reset();
-        delay(10);
     }
-
-    writeMag(AK09916_REG_CNTL2, 0x00);
-    delay(1);
-    i2cControllerConfigurePeripheral(0, AK09916_I2C_address, AK09916_REG_ST1, 9,
-                                     true, true, false, false, false,
-                                     (uint8_t)0U);
-    writeMag(AK09916_REG_CNTL2, 0x08);
-    delay(1);
-    return;
+    if (found) {
+        writeMag(AK09916_REG_CNTL2, 0x00);
+        delayMicroseconds(100);  // mode transition time
+        i2cControllerConfigurePeripheral(0, AK09916_I2C_address,
+                                         AK09916_REG_ST1, 9, true, true, false,
+                                         false, false, (uint8_t)0U);
+        found = writeMag(AK09916_REG_CNTL2, 0x08);
+    }
+    if (gyroDiv != 0) {
+        writeReg(ICM_USER_BANK2, ICM_GYRO_SMPLRT_DIV, gyroDiv);
+    }
+    parkBank();
+    magStartupTime = (uint32_t)(esp_timer_get_time() - start);
+    return found;
 }
 
-void ICM::magWhoAmI(uint8_t *who1, uint8_t *who2) {
-    *who1 = readMag(AK09916_REG_WIA1);
-    delay(1);
-    *who2 = readMag(AK09916_REG_WIA2);
+void ICM20948::magWhoAmI(uint8_t *who1, uint8_t *who2) {
+    *who1 = 0;
+    *who2 = 0;
+    readMag(AK09916_REG_WIA1, who1);
+    readMag(AK09916_REG_WIA2, who2);
+    parkBank();
     return;
 }
-void ICM::resetMag() {
+bool ICM20948::resetMag() {
     uint8_t SRST = 1;
-    ICM_20948_i2c_master_single_w(AK09916_I2C_address, AK09916_REG_CNTL3, SRST);
-    return;
+    return ICM_20948_i2c_master_single_w(AK09916_I2C_address,
+                                         AK09916_REG_CNTL3, SRST);
 }
-void ICM::Get(int16_t *rx, uint8_t *rx_buf) {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
+void ICM20948::Get(int16_t *rx, uint8_t *rx_buf) {
+    selectBank(ICM_USER_BANK0);
     // uint8_t rx_buf[12];
     spi_transaction_t comm = {};
     comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
     comm.length = (12) * 8;
-    comm.cmd = ICM_Data_Adress | 0x80;
+    comm.cmd = ICM20948_Data_Adress | 0x80;
 
     comm.tx_buffer = NULL;
     comm.rx_buffer = rx_buf;
@@ -310,8 +556,8 @@ void ICM::Get(int16_t *rx, uint8_t *rx_buf) {
     rx[5] = (rx_buf[10] << 8 | rx_buf[11]);
     return;
 }
-void ICM::GetMag(int16_t *rx) {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
+void ICM20948::GetMag(int16_t *rx) {
+    selectBank(ICM_USER_BANK0);
     uint8_t rx_buf[9];
     spi_transaction_t comm = {};
     comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
@@ -331,4 +577,249 @@ void ICM::GetMag(int16_t *rx) {
     rx[2] = ((rx_buf[6] << 8) | rx_buf[5] & 0xFF);
     return;
 }
+void ICM20948::GetAll(ICM_Sample *sample, uint8_t *rx_buf) {
+    selectBank(ICM_USER_BANK0);
+    spi_transaction_t comm = {};
+    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.length = (ICM_SAMPLE_LENGTH) * 8;
+    comm.cmd = ICM20948_Data_Adress | 0x80;
+    comm.tx_buffer = NULL;
+    comm.rx_buffer = rx_buf;
+    comm.user = (void *)CS;
+
+    spi_transaction_ext_t spi_transaction = {};
+    spi_transaction.base = comm;
+    spi_transaction.command_bits = 8;
+    ICMSPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+
+    // accel, gyro, temp are big endian
+    for (int i = 0; i < 3; i++) {
+        sample->acc[i] = (int16_t)(rx_buf[2 * i] << 8 | rx_buf[2 * i + 1]);
+        sample->gyro[i] = (int16_t)(rx_buf[6 + 2 * i] << 8 | rx_buf[7 + 2 * i]);
+    }
+    sample->temp = (int16_t)(rx_buf[12] << 8 | rx_buf[13]);
+    // magnetometer is little endian
+    sample->magStatus = rx_buf[14];
+    for (int i = 0; i < 3; i++) {
+        sample->mag[i] = (int16_t)(rx_buf[16 + 2 * i] << 8 | rx_buf[15 + 2 * i]);
+    }
+    return;
+}
+void ICM20948::beginFifo(uint32_t samplePeriodUs) {
+    fifoPeriodUs = samplePeriodUs;
+    writeReg(ICM_USER_BANK0, ICM_FIFO_MODE, ICM_FIFO_SNAPSHOT);
+    writeReg(ICM_USER_BANK0, ICM_FIFO_EN_2, ICM_FIFO_ACCEL_GYRO);
+    modifyReg(ICM_USER_BANK0, ICM_USER_CTRL, 0, 0b01000000,
+              ICM_USER_CTRL_SELF_CLEAR);  // FIFO_EN
+    resetFifo();
+    return;
+}
+void ICM20948::endFifo() {
+    writeReg(ICM_USER_BANK0, ICM_FIFO_EN_2, 0x00);
+    modifyReg(ICM_USER_BANK0, ICM_USER_CTRL, 0b01000000, 0,
+              ICM_USER_CTRL_SELF_CLEAR);
+    return;
+}
+void ICM20948::resetFifo() {
+    writeReg(ICM_USER_BANK0, ICM_FIFO_RST, 0x1F);
+    writeReg(ICM_USER_BANK0, ICM_FIFO_RST, 0x00);
+    fifoLastTimestamp = -1;
+    fifoResetTimestamp = esp_timer_get_time();
+    fifoOverflowPending = false;
+    return;
+}
+uint16_t ICM20948::fifoCount() {
+    selectBank(ICM_USER_BANK0);
+    uint8_t rx_buf[2];
+    spi_transaction_t comm = {};
+    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.length = (2) * 8;
+    comm.cmd = ICM_FIFO_COUNTH | 0x80;
+    comm.tx_buffer = NULL;
+    comm.rx_buffer = rx_buf;
+    comm.user = (void *)CS;
+
+    spi_transaction_ext_t spi_transaction = {};
+    spi_transaction.base = comm;
+    spi_transaction.command_bits = 8;
+    ICMSPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+    return ((rx_buf[0] & 0x1F) << 8) | rx_buf[1];
+}
+uint16_t ICM20948::ReadFifo(ICM_FifoSample *samples, uint16_t maxSamples,
+                       uint8_t *rx_buf) {
+    // snapshot mode: on overflow the FIFO stops, so the frames in it are
+    // still contiguous and only the ones after them were dropped
+    if (!fifoOverflowPending &&
+        (readReg(ICM_USER_BANK0, ICM_INT_STATUS_2) & 0x1F)) {
+        fifoOverflowPending = true;
+    }
+    uint16_t total = fifoCount() / ICM_FIFO_FRAME_LENGTH;
+    uint16_t n = total;
+    if (n > maxSamples) {
+        n = maxSamples;
+    }
+    if (n == 0) {
+        if (fifoOverflowPending) {
+            fifoOverflowCount++;
+            resetFifo();
+        }
+        return 0;
+    }
+    int64_t now = esp_timer_get_time();
+
+    // FIFO_R_W does not auto increment, so all frames come in one burst
+    spi_transaction_t comm = {};
+    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.length = (n * ICM_FIFO_FRAME_LENGTH) * 8;
+    comm.cmd = ICM_FIFO_R_W | 0x80;
+    comm.tx_buffer = NULL;
+    comm.rx_buffer = rx_buf;
+    comm.user = (void *)CS;
+
+    spi_transaction_ext_t spi_transaction = {};
+    spi_transaction.base = comm;
+    spi_transaction.command_bits = 8;
+    ICMSPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+
+    // samples are evenly spaced by fifoPeriodUs
+    int64_t first = fifoLastTimestamp + fifoPeriodUs;
+    if (fifoOverflowPending) {
+        // the FIFO stopped filling at some unknown time, so now says nothing
+        // about these frames: continue forward from the last batch
+        if (fifoLastTimestamp < 0) {
+            first = fifoResetTimestamp + fifoPeriodUs;
+        }
+    } else {
+        // the newest frame still in the FIFO (not the newest one read when
+        // total > n) is about now; continue from the last batch unless it
+        // drifted more than 2 periods away
+        int64_t newest = first + (int64_t)(total - 1) * fifoPeriodUs;
+        if (fifoLastTimestamp < 0 || newest > now ||
+            now - newest > 2 * (int64_t)fifoPeriodUs) {
+            first = now - (int64_t)(total - 1) * fifoPeriodUs;
+        }
+    }
+    for (uint16_t i = 0; i < n; i++) {
+        uint8_t *frame = &rx_buf[i * ICM_FIFO_FRAME_LENGTH];
+        for (int axis = 0; axis < 3; axis++) {
+            samples[i].acc[axis] =
+                (int16_t)(frame[2 * axis] << 8 | frame[2 * axis + 1]);
+            samples[i].gyro[axis] =
+                (int16_t)(frame[6 + 2 * axis] << 8 | frame[7 + 2 * axis]);
+        }
+        samples[i].timestamp = first + (int64_t)i * fifoPeriodUs;
+    }
+    fifoLastTimestamp = samples[n - 1].timestamp;
+    // everything from before the overflow has been read: report the gap
+    if (fifoOverflowPending && n == total) {
+        fifoOverflowCount++;
+        resetFifo();
+    }
+    return n;
+}
+bool ICM20948::setGyroODR(uint8_t div, uint8_t dlpf) {
+    if (dlpf > 7 && dlpf != ICM_DLPF_BYPASS) {
+        return false;
+    }
+    // FCHOICE = 0 bypasses the DLPF
+    uint8_t cfg = (dlpf == ICM_DLPF_BYPASS) ? 0 : ((dlpf << 3) | 0b00000001);
+    writeReg(ICM_USER_BANK2, ICM_ODR_ALIGN_EN, 0x01);
+    writeReg(ICM_USER_BANK2, ICM_GYRO_SMPLRT_DIV, div);
+    modifyReg(ICM_USER_BANK2, ICM20948_GYRO_CONFIG, ICM_DLPF_MASK, cfg);
+    bool ok = verifyReg(ICM_USER_BANK2, ICM_GYRO_SMPLRT_DIV);
+    ok &= verifyReg(ICM_USER_BANK2, ICM20948_GYRO_CONFIG);
+    parkBank();
+    return ok;
+}
+bool ICM20948::setAccelODR(uint16_t div, uint8_t dlpf) {
+    if (div > 0x0FFF || (dlpf > 7 && dlpf != ICM_DLPF_BYPASS)) {
+        return false;
+    }
+    uint8_t cfg = (dlpf == ICM_DLPF_BYPASS) ? 0 : ((dlpf << 3) | 0b00000001);
+    writeReg(ICM_USER_BANK2, ICM_ODR_ALIGN_EN, 0x01);
+    writeReg(ICM_USER_BANK2, ICM_ACCEL_SMPLRT_DIV_1, div >> 8);
+    writeReg(ICM_USER_BANK2, ICM_ACCEL_SMPLRT_DIV_2, div & 0xFF);
+    modifyReg(ICM_USER_BANK2, ICM20948_ACC_CONFIG, ICM_DLPF_MASK, cfg);
+    bool ok = verifyReg(ICM_USER_BANK2, ICM_ACCEL_SMPLRT_DIV_1);
+    ok &= verifyReg(ICM_USER_BANK2, ICM_ACCEL_SMPLRT_DIV_2);
+    ok &= verifyReg(ICM_USER_BANK2, ICM20948_ACC_CONFIG);
+    parkBank();
+    return ok;
+}
+float ICM20948::getGyroODR() {
+    // read from hardware only while the shadow is not valid yet
+    uint8_t cfg = readCached(ICM_USER_BANK2, ICM20948_GYRO_CONFIG);
+    uint8_t div = readCached(ICM_USER_BANK2, ICM_GYRO_SMPLRT_DIV);
+    parkBank();
+    if (!(cfg & 0b00000001)) {
+        return ICM_GYRO_BYPASS_ODR;
+    }
+    return ICM_INTERNAL_ODR / (1 + div);
+}
+float ICM20948::getAccelODR() {
+    uint8_t cfg = readCached(ICM_USER_BANK2, ICM20948_ACC_CONFIG);
+    uint16_t div =
+        ((readCached(ICM_USER_BANK2, ICM_ACCEL_SMPLRT_DIV_1) & 0x0F) << 8) |
+        readCached(ICM_USER_BANK2, ICM_ACCEL_SMPLRT_DIV_2);
+    parkBank();
+    if (!(cfg & 0b00000001)) {
+        return ICM_ACCEL_BYPASS_ODR;
+    }
+    return ICM_INTERNAL_ODR / (1 + div);
+}
+
+bool ICM20948::queueReadImpl() {
+    // no selectBank here: a polled bank switch would wait behind the other
+    // devices' queued reads, the chip is always parked in bank 0
+    if (currentBank != ICM_USER_BANK0) {
+        return false;
+    }
+    spi_transaction_t comm = {};
+    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.length = (14) * 8;
+    comm.cmd = ICM20948_Data_Adress | 0x80;
+    comm.tx_buffer = NULL;
+    comm.rx_buffer = imuRx;
+    comm.user = (void *)CS;
+
+    imuTransaction = {};
+    imuTransaction.base = comm;
+    imuTransaction.command_bits = 8;
+    return ICMSPI->queueTransmit((spi_transaction_t *)&imuTransaction,
+                                 deviceHandle) == ESP_OK;
+}
+bool ICM20948::collectImpl(IMUSample *sample) {
+    if (ICMSPI->getTransmitResult(deviceHandle) != ESP_OK) {
+        return false;
+    }
+    sample->timestamp = esp_timer_get_time();
+    // accel(6) gyro(6) temp(2)
+    for (int axis = 0; axis < 3; axis++) {
+        sample->acc[axis] =
+            (int16_t)(imuRx[2 * axis] << 8 | imuRx[2 * axis + 1]);
+        sample->gyro[axis] =
+            (int16_t)(imuRx[6 + 2 * axis] << 8 | imuRx[7 + 2 * axis]);
+    }
+    sample->temp = (int16_t)(imuRx[12] << 8 | imuRx[13]);
+    return true;
+}
+
+// for existing code, the first included ICM driver is also available as ICM
+#ifndef ICM_TYPE_DEFINED
+#define ICM_TYPE_DEFINED
+typedef ICM20948 ICM;
+// and so are the old ICM_ register names, with the values of that driver
+#define ICM_Data_Adress ICM20948_Data_Adress
+#define ICM_GYRO_CONFIG ICM20948_GYRO_CONFIG
+#define ICM_WhoAmI_Adress ICM20948_WhoAmI_Adress
+#define ICM_ACC_CONFIG ICM20948_ACC_CONFIG
+#define ICM_16G ICM20948_16G
+#define ICM_8G ICM20948_8G
+#define ICM_4G ICM20948_4G
+#define ICM_2G ICM20948_2G
+#define ICM_2000dps ICM20948_2000dps
+#define ICM_1000dps ICM20948_1000dps
+#define ICM_500dps ICM20948_500dps
+#define ICM_250dps ICM20948_250dps
+#endif
 #endif
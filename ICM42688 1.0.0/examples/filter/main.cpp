@@ -0,0 +1,44 @@
+#include <Arduino.h>
+#include "ICM42688.h"
+
+namespace ICMPIN
+{
+    const int SCK = 14;
+    const int MISO = 12;
+    const int MOSI = 13;
+    const int CS = 15;
+}
+
+ICM42688 icm42688;
+
+SPICREATE::SPICreate SPIC;
+
+// 記録するODRとフィルタを設定し、モデルで計算した周波数特性を表示する
+void setup()
+{
+    Serial.begin(115200);
+    SPIC.begin(VSPI, ICMPIN::SCK, ICMPIN::MISO, ICMPIN::MOSI);
+    icm42688.begin(&SPIC, ICMPIN::CS, 1000000);
+    while (icm42688.WhoAmI() != 0x47)
+    {
+        delay(100);
+    }
+
+    const float odrHz = 1000;
+    bool ok = icm42688.setGyroConfig(ICM42688_2000dps, ICM42688_ODR_1K);
+    ok &= icm42688.setAccelConfig(ICM42688_16G, ICM42688_ODR_1K);
+    ok &= icm42688.setFilterPreset(ICM42688_ODR_1K);
+    Serial.println(ok ? "filter configured" : "filter configuration failed");
+
+    Serial.println("freq[Hz],gain[dB]");
+    for (float f = 25; f <= 2 * odrHz; f += 25)
+    {
+        Serial.printf("%.0f,%.2f\n", f, ICM42688FilterModel::responseDb(ICM42688_FILTER_1K, odrHz, f));
+    }
+    Serial.printf("alias rejection below 100Hz: %.1f dB\n",
+                  ICM42688FilterModel::aliasRejectionDb(ICM42688_FILTER_1K, odrHz, 100));
+}
+
+void loop()
+{
+}
@@ -1,29 +1,184 @@
 // version: 1.0.0
 #pragma once
 
-#ifndef ICM_H
-#define ICM_H
+#ifndef ICM42688_H
+#define ICM42688_H
 #include <SPICREATE.h> // 2.0.0
+#include <IMUBase.h>   // 1.0.0
 #include <Arduino.h>
+#include <esp_timer.h>
+#include "ICM42688Filter.h"
 
 #define POWER_MANAGEMENT 0x4E
 #define WHO_AM_I_Address 0x75
-#define ICM_Data_Adress 0x1F
+#define ICM42688_Data_Adress 0x1F
 
-class ICM
+// BANK0
+#define ICM42688_TEMP_DATA1 0x1D       // temp(2), accel(6), gyro(6)
+#define ICM42688_INT_STATUS 0x2D        // bit1: FIFO_FULL_INT (読むとクリア)
+#define ICM42688_FIFO_CONFIG 0x16       // bit7:6 FIFO_MODE
+#define ICM42688_FIFO_COUNTH 0x2E       // FIFO_COUNTL 0x2F (big endian, byte数)
+#define ICM42688_FIFO_DATA 0x30
+#define ICM42688_SIGNAL_PATH_RESET 0x4B // bit1: FIFO_FLUSH
+#define ICM42688_GYRO_CONFIG0 0x4F      // bit7:5 FS_SEL, bit3:0 ODR
+#define ICM42688_ACCEL_CONFIG0 0x50     // bit7:5 FS_SEL, bit3:0 ODR
+#define ICM42688_TMST_CONFIG 0x54       // bit3: TMST_RES, bit0: TMST_EN (リセット値0x23 他のbitは変えない)
+#define ICM42688_FIFO_CONFIG1 0x5F      // bit4: HIRES, bit3: TMST_FSYNC, bit2: TEMP, bit1: GYRO, bit0: ACCEL
+#define ICM42688_GYRO_CONFIG1 0x51       // bit3:2 GYRO_UI_FILT_ORD
+#define ICM42688_GYRO_ACCEL_CONFIG0 0x52 // bit7:4 ACCEL_UI_FILT_BW, bit3:0 GYRO_UI_FILT_BW
+#define ICM42688_ACCEL_CONFIG1 0x53      // bit4:3 ACCEL_UI_FILT_ORD
+#define ICM42688_REG_BANK_SEL 0x76
+
+// BANK1
+#define ICM42688_GYRO_CONFIG_STATIC2 0x0B // bit1: GYRO_AAF_DIS, bit0: GYRO_NF_DIS
+#define ICM42688_GYRO_CONFIG_STATIC3 0x0C // bit5:0 GYRO_AAF_DELT
+#define ICM42688_GYRO_CONFIG_STATIC4 0x0D // GYRO_AAF_DELTSQR[7:0]
+#define ICM42688_GYRO_CONFIG_STATIC5 0x0E // bit7:4 GYRO_AAF_BITSHIFT, bit3:0 GYRO_AAF_DELTSQR[11:8]
+// BANK2
+#define ICM42688_ACCEL_CONFIG_STATIC2 0x03 // bit6:1 ACCEL_AAF_DELT, bit0: ACCEL_AAF_DIS
+#define ICM42688_ACCEL_CONFIG_STATIC3 0x04 // ACCEL_AAF_DELTSQR[7:0]
+#define ICM42688_ACCEL_CONFIG_STATIC4 0x05 // bit7:4 ACCEL_AAF_BITSHIFT, bit3:0 ACCEL_AAF_DELTSQR[11:8]
+
+#define ICM42688_FIFO_STOP_ON_FULL 0b10000000
+#define ICM42688_FIFO_SIZE 2048
+
+// ODR (GYRO_CONFIG0, ACCEL_CONFIG0のbit3:0)
+#define ICM42688_ODR_32K 0x01
+#define ICM42688_ODR_16K 0x02
+#define ICM42688_ODR_8K 0x03
+#define ICM42688_ODR_4K 0x04
+#define ICM42688_ODR_2K 0x05
+#define ICM42688_ODR_1K 0x06
+#define ICM42688_ODR_500 0x0F
+#define ICM42688_ODR_200 0x07
+#define ICM42688_ODR_100 0x08
+#define ICM42688_ODR_50 0x09
+#define ICM42688_ODR_25 0x0A
+#define ICM42688_ODR_12_5 0x0B
+// 0x0C ~ 0x0E (6.25Hz ~ 1.5625Hz) は加速度のみ
+
+// フルスケール (GYRO_CONFIG0, ACCEL_CONFIG0のbit7:5)
+#define ICM42688_2000dps 0x00
+#define ICM42688_1000dps 0x01
+#define ICM42688_500dps 0x02
+#define ICM42688_250dps 0x03
+#define ICM42688_125dps 0x04
+#define ICM42688_62_5dps 0x05
+#define ICM42688_31_25dps 0x06
+#define ICM42688_15_625dps 0x07
+#define ICM42688_16G 0x00
+#define ICM42688_8G 0x01
+#define ICM42688_4G 0x02
+#define ICM42688_2G 0x03
+
+// FIFOのパケット
+// 16byte: header, accel(6), gyro(6), temp(1), timestamp(2)
+// 20byte (高分解能): header, accel(6), gyro(6), temp(2), timestamp(2), x, y, zの下位4bit(3)
+#define ICM42688_PACKET_LENGTH 16
+#define ICM42688_PACKET_LENGTH_HIRES 20
+#define ICM42688_HEADER_EMPTY 0x80 // HEADER_MSG FIFOが空
+#define ICM42688_HEADER_20 0x10    // 20byteパケット
+#define ICM42688_HEADER_SENSORS 0x60
+
+/**
+ * FIFOから読んだ1サンプル
+ * 16byteパケットでは16bitの値、高分解能では20bitの値 (フルスケールは±16G, ±2000dps固定)
+ * 20bitの値は16bitの値の16倍のスケール (32768LSB/G, 262.4LSB/dps)
+ * temp: 16byteパケットでは raw / 2.07 + 25 [℃]、高分解能では raw / 132.48 + 25 [℃]
+ */
+struct ICM42688_FifoSample
+{
+    int32_t acc[3];
+    int32_t gyro[3];
+    int16_t temp;
+    int64_t timestamp; // センサのタイムスタンプを64bitに伸ばしたもの [us] 最初のパケットが0
+                       // FIFOがあふれて空にした後は、空にしてからの時間をesp_timerで補う (その間だけ誤差がある)
+};
+
+class ICM42688 : public IMUBase<ICM42688>
 {
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *ICMSPI;
 
+    void readBurst(uint8_t reg, uint8_t *rx_buf, size_t len);
+    // 書き込んで読み返す maskのbitだけ書き換える
+    bool writeVerify(uint8_t reg, uint8_t value, uint8_t mask = 0xFF);
+
+    bool fifoHires = false;
+    uint8_t timestampScale = 1; // タイムスタンプ1あたりの時間[us]
+    bool timestampValid = false;
+    uint16_t lastTimestamp = 0;
+    int64_t timestamp64 = 0;
+    int64_t resetUs = -1; // FIFOを空にした時刻 (esp_timer) 空にした間の時間を補うのに使う
+
+    uint8_t accelFs = ICM42688_16G;
+    uint8_t gyroFs = ICM42688_2000dps;
+
+    // queueRead用 結果を受け取るまで残しておく
+    spi_transaction_ext_t imuTransaction = {};
+    uint8_t imuRx[16] __attribute__((aligned(4)));
+
 public:
     void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000);
     uint8_t WhoAmI();
     uint8_t UserBank();
     void Get(int16_t *rx);
+
+    /**
+     * @brief フルスケールとODRを設定する 書き込んだ後に読み返して確認する
+     * @param[in] fs ICM42688_2000dps等 / ICM42688_16G等
+     * @param[in] odr ICM42688_ODR_32K等
+     * @retval true: success
+     * @retval false: 引数が範囲外、または読み返した値が違う
+     */
+    bool setGyroConfig(uint8_t fs, uint8_t odr);
+    bool setAccelConfig(uint8_t fs, uint8_t odr);
+
+    /**
+     * @brief アンチエイリアスフィルタとUIフィルタを設定する (角速度、加速度とも)
+     * BANK1, 2を書いた後はBANK0に戻す
+     * @param[in] cfg ICM42688_FILTER_1K等のプリセット、または自分で作った設定
+     * @retval true: success
+     * @retval false: 引数が範囲外、または読み返した値が違う
+     */
+    bool setFilter(const ICM42688_FilterConfig &cfg);
+    // ODRに合ったプリセットを使う
+    bool setFilterPreset(uint8_t odr);
+
+    /**
+     * @brief 加速度、角速度、温度、タイムスタンプをFIFOに溜め始める
+     * @param[in] hires trueなら20byteの高分解能パケット
+     * @param[in] coarseTimestamp trueならタイムスタンプの分解能を16usにする (1usだと65msで一周するので、読む間隔が長いとき用)
+     */
+    void beginFifo(bool hires, bool coarseTimestamp = false);
+    void endFifo();
+    void resetFifo();
+    // FIFOに溜まっているbyte数
+    uint16_t fifoCount();
+    // 1パケットのbyte数
+    uint8_t fifoPacketLength() { return fifoHires ? ICM42688_PACKET_LENGTH_HIRES : ICM42688_PACKET_LENGTH; }
+    /**
+     * @brief FIFOに溜まっているパケットを1回のSPI通信でまとめて読む
+     * @param[out] samples maxSamples個以上の配列
+     * @param[in] maxSamples 読む最大のサンプル数
+     * @param[in] rx_buf maxSamples * fifoPacketLength() byte以上のDMAで使えるバッファ
+     * @return 読んだサンプル数 FIFOがあふれていたら0 (FIFOは空にする)
+     */
+    uint16_t ReadFifo(ICM42688_FifoSample *samples, uint16_t maxSamples, uint8_t *rx_buf);
+    // FIFOがあふれた回数
+    uint32_t fifoOverflowCount = 0;
+    // ヘッダがおかしかったパケットの数 (この時もFIFOは空にする)
+    uint32_t fifoInvalidCount = 0;
+
+    // IMUBaseから呼ばれる (直接呼ばずにqueueRead, collect, readを使う)
+    bool queueReadImpl();
+    bool collectImpl(IMUSample *sample);
+    float accelLsbPerG() { return (float)(2048 << accelFs); }
+    float gyroLsbPerDps() { return 16.4f * (1 << gyroFs); }
 };
 
-void ICM::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
+void ICM42688::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
 {
     CS = cs;
     ICMSPI = targetSPI;
@@ -46,9 +201,11 @@ void ICM::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
     deviceHandle = ICMSPI->addDevice(&if_cfg, cs);
 
     ICMSPI->setReg(POWER_MANAGEMENT, 0x0F, deviceHandle);
+    // PWR_MGMT0を書いた後200usは他のレジスタを書かない
+    delayMicroseconds(200);
     return;
 }
-uint8_t ICM::WhoAmI()
+uint8_t ICM42688::WhoAmI()
 {
     return ICMSPI->readByte(0x80 | WHO_AM_I_Address, deviceHandle);
 }
@@ -57,13 +214,13 @@ uint8_t ICM::WhoAmI()
  * @fn
  * ICMから加速度、角速度を取得
  */
-void ICM::Get(int16_t *rx)
+void ICM42688::Get(int16_t *rx)
 {
     uint8_t rx_buf[12];
     spi_transaction_t comm = {};
     comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
     comm.length = (12) * 8;
-    comm.cmd = ICM_Data_Adress | 0x80;
+    comm.cmd = ICM42688_Data_Adress | 0x80;
 
     comm.tx_buffer = NULL;
     comm.rx_buffer = rx_buf;
@@ -82,4 +239,260 @@ void ICM::Get(int16_t *rx)
     rx[5] = (rx_buf[10] << 8 | rx_buf[11]);
     return;
 }
+
+void ICM42688::readBurst(uint8_t reg, uint8_t *rx_buf, size_t len)
+{
+    spi_transaction_t comm = {};
+    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.length = len * 8;
+    comm.cmd = reg | 0x80;
+
+    comm.tx_buffer = NULL;
+    comm.rx_buffer = rx_buf;
+    comm.user = (void *)CS;
+
+    spi_transaction_ext_t spi_transaction = {};
+    spi_transaction.base = comm;
+    spi_transaction.command_bits = 8;
+    ICMSPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+}
+
+bool ICM42688::setGyroConfig(uint8_t fs, uint8_t odr)
+{
+    // 0x0C ~ 0x0Eは角速度では使えない
+    if (fs > 0x07 || odr == 0x00 || odr > 0x0F || (odr >= 0x0C && odr <= 0x0E))
+    {
+        return false;
+    }
+    uint8_t value = (fs << 5) | odr;
+    ICMSPI->setReg(ICM42688_GYRO_CONFIG0, value, deviceHandle);
+    gyroFs = fs;
+    return ICMSPI->readByte(ICM42688_GYRO_CONFIG0 | 0x80, deviceHandle) == value;
+}
+
+bool ICM42688::setAccelConfig(uint8_t fs, uint8_t odr)
+{
+    if (fs > 0x03 || odr == 0x00 || odr > 0x0F)
+    {
+        return false;
+    }
+    uint8_t value = (fs << 5) | odr;
+    ICMSPI->setReg(ICM42688_ACCEL_CONFIG0, value, deviceHandle);
+    accelFs = fs;
+    return ICMSPI->readByte(ICM42688_ACCEL_CONFIG0 | 0x80, deviceHandle) == value;
+}
+
+/**
+ * @fn
+ * FIFOを有効にする
+ * FIFOが満杯になったら古いデータは上書きせずに止める (パケットの区切りがずれないように)
+ */
+void ICM42688::beginFifo(bool hires, bool coarseTimestamp)
+{
+    fifoHires = hires;
+    timestampScale = coarseTimestamp ? 16 : 1;
+    // TMST_EN, TMST_RES だけ書き換える (TMST_FSYNC_EN等はそのまま)
+    writeVerify(ICM42688_TMST_CONFIG, 0x01 | (coarseTimestamp ? 0x08 : 0x00), 0x09);
+    // TMST_FSYNC, TEMP, GYRO, ACCEL (+ HIRES)
+    ICMSPI->setReg(ICM42688_FIFO_CONFIG1, 0x0F | (hires ? 0x10 : 0x00), deviceHandle);
+    ICMSPI->setReg(ICM42688_FIFO_CONFIG, ICM42688_FIFO_STOP_ON_FULL, deviceHandle);
+    resetFifo();
+    return;
+}
+
+void ICM42688::endFifo()
+{
+    ICMSPI->setReg(ICM42688_FIFO_CONFIG, 0x00, deviceHandle); // bypass
+    ICMSPI->setReg(ICM42688_FIFO_CONFIG1, 0x00, deviceHandle);
+    return;
+}
+
+void ICM42688::resetFifo()
+{
+    ICMSPI->setReg(ICM42688_SIGNAL_PATH_RESET, 0x02, deviceHandle);
+    // FIFO_FULL_INTを読んで消しておく
+    ICMSPI->readByte(ICM42688_INT_STATUS | 0x80, deviceHandle);
+    if (timestampValid)
+    {
+        resetUs = esp_timer_get_time();
+    }
+    timestampValid = false;
+    return;
+}
+
+uint16_t ICM42688::fifoCount()
+{
+    // FIFO_COUNTH, Lは1回で読むこと
+    uint8_t rx_buf[2];
+    readBurst(ICM42688_FIFO_COUNTH, rx_buf, 2);
+    return (rx_buf[0] << 8) | rx_buf[1];
+}
+
+uint16_t ICM42688::ReadFifo(ICM42688_FifoSample *samples, uint16_t maxSamples, uint8_t *rx_buf)
+{
+    if (ICMSPI->readByte(ICM42688_INT_STATUS | 0x80, deviceHandle) & 0x02)
+    {
+        fifoOverflowCount++;
+        resetFifo();
+        return 0;
+    }
+    uint8_t length = fifoPacketLength();
+    uint16_t n = fifoCount() / length;
+    if (n > maxSamples)
+    {
+        n = maxSamples;
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+    readBurst(ICM42688_FIFO_DATA, rx_buf, (size_t)n * length);
+
+    uint8_t expected = ICM42688_HEADER_SENSORS | (fifoHires ? ICM42688_HEADER_20 : 0x00);
+    for (uint16_t i = 0; i < n; i++)
+    {
+        uint8_t *packet = &rx_buf[i * length];
+        if ((packet[0] & (ICM42688_HEADER_EMPTY | ICM42688_HEADER_SENSORS | ICM42688_HEADER_20)) != expected)
+        {
+            // 区切りがずれたので捨ててやり直す
+            fifoInvalidCount++;
+            resetFifo();
+            return i;
+        }
+        for (int axis = 0; axis < 3; axis++)
+        {
+            samples[i].acc[axis] = (int16_t)(packet[1 + 2 * axis] << 8 | packet[2 + 2 * axis]);
+            samples[i].gyro[axis] = (int16_t)(packet[7 + 2 * axis] << 8 | packet[8 + 2 * axis]);
+        }
+        uint16_t ts;
+        if (fifoHires)
+        {
+            samples[i].temp = (int16_t)(packet[13] << 8 | packet[14]);
+            ts = packet[15] << 8 | packet[16];
+            // 下位4bitを足して20bitにする accelはbit7:4, gyroはbit3:0
+            for (int axis = 0; axis < 3; axis++)
+            {
+                samples[i].acc[axis] = samples[i].acc[axis] * 16 + (packet[17 + axis] >> 4);
+                samples[i].gyro[axis] = samples[i].gyro[axis] * 16 + (packet[17 + axis] & 0x0F);
+            }
+        }
+        else
+        {
+            samples[i].temp = (int8_t)packet[13];
+            ts = packet[14] << 8 | packet[15];
+        }
+        // 16bitのタイムスタンプの一周を補って64bitにする
+        if (timestampValid)
+        {
+            timestamp64 += (uint16_t)(ts - lastTimestamp) * timestampScale;
+        }
+        else
+        {
+            timestamp64 = (resetUs < 0) ? 0 : timestamp64 + (esp_timer_get_time() - resetUs);
+            timestampValid = true;
+        }
+        lastTimestamp = ts;
+        samples[i].timestamp = timestamp64;
+    }
+    return n;
+}
+
+bool ICM42688::writeVerify(uint8_t reg, uint8_t value, uint8_t mask)
+{
+    if (mask != 0xFF)
+    {
+        uint8_t current = ICMSPI->readByte(reg | 0x80, deviceHandle);
+        value = (current & ~mask) | (value & mask);
+    }
+    ICMSPI->setReg(reg, value, deviceHandle);
+    return ICMSPI->readByte(reg | 0x80, deviceHandle) == value;
+}
+
+bool ICM42688::setFilter(const ICM42688_FilterConfig &cfg)
+{
+    if (cfg.aafDelt == 0 || cfg.aafDelt > 63 || cfg.aafDeltSqr > 0x0FFF || cfg.aafBitshift > 0x0F ||
+        cfg.uiBandwidth > 0x0F || cfg.uiOrder > ICM42688_UI_ORDER_3)
+    {
+        return false;
+    }
+    bool ok = true;
+    uint8_t deltSqrHigh = (cfg.aafBitshift << 4) | (cfg.aafDeltSqr >> 8);
+
+    ICMSPI->setReg(ICM42688_REG_BANK_SEL, 1, deviceHandle);
+    ok &= writeVerify(ICM42688_GYRO_CONFIG_STATIC2, cfg.aafEnable ? 0x00 : 0x02, 0x02);
+    ok &= writeVerify(ICM42688_GYRO_CONFIG_STATIC3, cfg.aafDelt, 0x3F);
+    ok &= writeVerify(ICM42688_GYRO_CONFIG_STATIC4, cfg.aafDeltSqr & 0xFF);
+    ok &= writeVerify(ICM42688_GYRO_CONFIG_STATIC5, deltSqrHigh);
+
+    ICMSPI->setReg(ICM42688_REG_BANK_SEL, 2, deviceHandle);
+    ok &= writeVerify(ICM42688_ACCEL_CONFIG_STATIC2, (cfg.aafDelt << 1) | (cfg.aafEnable ? 0x00 : 0x01), 0x7F);
+    ok &= writeVerify(ICM42688_ACCEL_CONFIG_STATIC3, cfg.aafDeltSqr & 0xFF);
+    ok &= writeVerify(ICM42688_ACCEL_CONFIG_STATIC4, deltSqrHigh);
+
+    ICMSPI->setReg(ICM42688_REG_BANK_SEL, 0, deviceHandle);
+    ok &= writeVerify(ICM42688_GYRO_CONFIG1, cfg.uiOrder << 2, 0x0C);
+    ok &= writeVerify(ICM42688_GYRO_ACCEL_CONFIG0, (cfg.uiBandwidth << 4) | cfg.uiBandwidth);
+    ok &= writeVerify(ICM42688_ACCEL_CONFIG1, cfg.uiOrder << 3, 0x18);
+    return ok;
+}
+
+bool ICM42688::setFilterPreset(uint8_t odr)
+{
+    switch (odr)
+    {
+    case ICM42688_ODR_32K:
+    case ICM42688_ODR_16K:
+        return setFilter(ICM42688_FILTER_32K);
+    case ICM42688_ODR_8K:
+        return setFilter(ICM42688_FILTER_8K);
+    case ICM42688_ODR_4K:
+        return setFilter(ICM42688_FILTER_4K);
+    case ICM42688_ODR_2K:
+        return setFilter(ICM42688_FILTER_2K);
+    default:
+        // 1kHz以下
+        return setFilter(ICM42688_FILTER_1K);
+    }
+}
+
+bool ICM42688::queueReadImpl()
+{
+    spi_transaction_t comm = {};
+    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.length = (14) * 8;
+    comm.cmd = ICM42688_TEMP_DATA1 | 0x80;
+    comm.tx_buffer = NULL;
+    comm.rx_buffer = imuRx;
+    comm.user = (void *)CS;
+
+    imuTransaction = {};
+    imuTransaction.base = comm;
+    imuTransaction.command_bits = 8;
+    return ICMSPI->queueTransmit((spi_transaction_t *)&imuTransaction, deviceHandle) == ESP_OK;
+}
+
+bool ICM42688::collectImpl(IMUSample *sample)
+{
+    if (ICMSPI->getTransmitResult(deviceHandle) != ESP_OK)
+    {
+        return false;
+    }
+    sample->timestamp = esp_timer_get_time();
+    // temp(2) accel(6) gyro(6)
+    sample->temp = (int16_t)(imuRx[0] << 8 | imuRx[1]);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        sample->acc[axis] = (int16_t)(imuRx[2 + 2 * axis] << 8 | imuRx[3 + 2 * axis]);
+        sample->gyro[axis] = (int16_t)(imuRx[8 + 2 * axis] << 8 | imuRx[9 + 2 * axis]);
+    }
+    return true;
+}
+
+// 従来のコードとの互換のため、最初にincludeしたICMのクラスはICMという名前でも使える
+#ifndef ICM_TYPE_DEFINED
+#define ICM_TYPE_DEFINED
+typedef ICM42688 ICM;
+// 以前のICM_で始まるマクロも、ICMにしたドライバの値で定義する
+#define ICM_Data_Adress ICM42688_Data_Adress
+#endif
 #endif
@@ -0,0 +1,133 @@
+// version: 1.0.0
+#pragma once
+
+#ifndef ICM42688Filter_H
+#define ICM42688Filter_H
+#include <stdint.h>
+#include <math.h>
+
+// UIフィルタの帯域 (GYRO_ACCEL_CONFIG0の値)
+// 0: ODR/2, 1~7: max(400Hz, ODR)/4, /5, /8, /10, /16, /20, /40
+#define ICM42688_UI_BW_ODR_2 0
+#define ICM42688_UI_BW_ODR_4 1
+#define ICM42688_UI_BW_ODR_5 2
+#define ICM42688_UI_BW_ODR_8 3
+#define ICM42688_UI_BW_ODR_10 4
+#define ICM42688_UI_BW_ODR_16 5
+#define ICM42688_UI_BW_ODR_20 6
+#define ICM42688_UI_BW_ODR_40 7
+
+// UIフィルタの次数
+#define ICM42688_UI_ORDER_1 0
+#define ICM42688_UI_ORDER_2 1
+#define ICM42688_UI_ORDER_3 2
+
+/**
+ * アンチエイリアスフィルタ(AAF)とUIフィルタの設定
+ * AAFはデータシートの表のdelt, deltsqr, bitshiftの組をそのまま使う (deltが1~63で帯域42Hz~3979Hz)
+ * 角速度と加速度で同じ設定を使う
+ */
+struct ICM42688_FilterConfig
+{
+    bool aafEnable;
+    uint8_t aafDelt;      // 1~63
+    uint16_t aafDeltSqr;  // 12bit
+    uint8_t aafBitshift;  // 4bit
+    uint8_t uiBandwidth;  // ICM42688_UI_BW_*
+    uint8_t uiOrder;      // ICM42688_UI_ORDER_*
+};
+
+// 記録するODRごとのプリセット AAFの帯域をODRの1/4程度にして、ナイキスト周波数より上を十分に落とす
+// ODR 1kHz: AAF 258Hz, 2kHz: 536Hz, 4kHz: 997Hz, 8kHz: 1962Hz, 16kHz以上: 3979Hz
+static const ICM42688_FilterConfig ICM42688_FILTER_1K = {true, 6, 36, 10, ICM42688_UI_BW_ODR_4, ICM42688_UI_ORDER_3};
+static const ICM42688_FilterConfig ICM42688_FILTER_2K = {true, 12, 144, 8, ICM42688_UI_BW_ODR_4, ICM42688_UI_ORDER_3};
+static const ICM42688_FilterConfig ICM42688_FILTER_4K = {true, 21, 440, 6, ICM42688_UI_BW_ODR_4, ICM42688_UI_ORDER_3};
+static const ICM42688_FilterConfig ICM42688_FILTER_8K = {true, 37, 1376, 4, ICM42688_UI_BW_ODR_4, ICM42688_UI_ORDER_3};
+static const ICM42688_FilterConfig ICM42688_FILTER_32K = {true, 63, 3968, 3, ICM42688_UI_BW_ODR_4, ICM42688_UI_ORDER_3};
+
+/**
+ * @brief 周波数特性のモデル Arduinoに依存しないのでPC上でも使える
+ * AAFは2次、UIフィルタは設定した次数のバターワース特性で近似する (実際の内部構成は公開されていないので目安)
+ * 帯域はデータシートの表の値を使う
+ *
+ * ```cpp
+ * // example (PC)
+ * // g++ -I"ICM42688 1.0.0/src" model.cpp
+ * float db = ICM42688FilterModel::responseDb(ICM42688_FILTER_1K, 1000, 600); // 1kHzで記録したとき600Hzの振動がどれだけ残るか
+ * ```
+ */
+class ICM42688FilterModel
+{
+public:
+    // AAFの-3dB帯域[Hz] delt=0なら0
+    static float aafBandwidth(uint8_t delt);
+    // UIフィルタの-3dB帯域[Hz]
+    static float uiBandwidth(uint8_t bw, float odrHz);
+    // 入力周波数freqHzに対するゲイン (0~1)
+    static float response(const ICM42688_FilterConfig &cfg, float odrHz, float freqHz);
+    static float responseDb(const ICM42688_FilterConfig &cfg, float odrHz, float freqHz)
+    {
+        return 20.0f * log10f(response(cfg, odrHz, freqHz));
+    }
+    // 帯域bandHzまでに折り返してくる成分(ODR - bandHz以上の周波数)の減衰量[dB] 大きいほどよい
+    static float aliasRejectionDb(const ICM42688_FilterConfig &cfg, float odrHz, float bandHz)
+    {
+        return -responseDb(cfg, odrHz, odrHz - bandHz);
+    }
+};
+
+float ICM42688FilterModel::aafBandwidth(uint8_t delt)
+{
+    // データシートのAAFの表 (delt = 1~63)
+    static const uint16_t table[63] = {
+        42, 84, 126, 170, 213, 258, 303, 348, 394, 441, 488, 536, 585, 634, 684, 734,
+        785, 837, 890, 943, 997, 1051, 1107, 1163, 1220, 1277, 1336, 1395, 1454, 1515, 1577, 1639,
+        1702, 1766, 1830, 1896, 1962, 2029, 2097, 2166, 2235, 2306, 2377, 2449, 2522, 2596, 2671, 2746,
+        2823, 2900, 2978, 3057, 3137, 3217, 3299, 3381, 3464, 3548, 3633, 3718, 3805, 3892, 3979};
+    if (delt == 0)
+    {
+        return 0;
+    }
+    if (delt > 63)
+    {
+        delt = 63;
+    }
+    return table[delt - 1];
+}
+
+float ICM42688FilterModel::uiBandwidth(uint8_t bw, float odrHz)
+{
+    static const float divider[8] = {2, 4, 5, 8, 10, 16, 20, 40};
+    if (bw == ICM42688_UI_BW_ODR_2)
+    {
+        return odrHz / 2;
+    }
+    if (bw > ICM42688_UI_BW_ODR_40)
+    {
+        // 低遅延モードはフィルタがほぼないものとして扱う
+        return odrHz / 2;
+    }
+    float base = (odrHz > 400.0f) ? odrHz : 400.0f;
+    return base / divider[bw];
+}
+
+float ICM42688FilterModel::response(const ICM42688_FilterConfig &cfg, float odrHz, float freqHz)
+{
+    float gain = 1.0f;
+    if (cfg.aafEnable && cfg.aafDelt > 0)
+    {
+        float r = freqHz / aafBandwidth(cfg.aafDelt);
+        gain /= sqrtf(1.0f + r * r * r * r);
+    }
+    // UIフィルタは間引いた後なので、ODRより上の成分は折り返した周波数で効く
+    float folded = fmodf(freqHz, odrHz);
+    if (folded > odrHz / 2)
+    {
+        folded = odrHz - folded;
+    }
+    float r = folded / uiBandwidth(cfg.uiBandwidth, odrHz);
+    gain /= sqrtf(1.0f + powf(r * r, cfg.uiOrder + 1));
+    return gain;
+}
+
+#endif
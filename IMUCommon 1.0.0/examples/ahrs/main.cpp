@@ -0,0 +1,192 @@
+// IMUAhrs(float)とIMUAhrsFixed(固定小数点)の1回の更新時間と精度を比べる
+// 決まった回転をする剛体の角速度、加速度、地磁気の生の値(ノイズとジャイロのバイアス入り)を作り、
+// 両方のフィルタに1kHzで20秒間入れて、真の姿勢との角度の差と、1回あたりの時間を出力する
+// ESP32: そのままビルドしてシリアルに出力 (単位はCPUサイクル、budgetは1kHzの1周期)
+// PC: g++ -O2 -I"IMUCommon 1.0.0/src" main.cpp (単位はns)
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdio.h>
+#include <chrono>
+#endif
+#include "IMUAhrs.h"
+
+#define AHRS_HZ 1000
+#define AHRS_SECONDS 20
+#define AHRS_SETTLE 2000 // 最初の2秒は誤差の最大に入れない
+#define ACC_LSB_PER_G 2048.0f
+#define GYRO_LSB_PER_DPS 16.4f
+#define MAG_LSB 300.0f
+
+IMUAhrs ahrsFloat;
+IMUAhrsFixed ahrsFixed;
+
+static uint32_t now()
+{
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+static uint32_t lcg = 1;
+static int noise(int amplitude)
+{
+    lcg = lcg * 1103515245 + 12345;
+    return (int)((lcg >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static int16_t clip(float v)
+{
+    return (int16_t)((v > 32767) ? 32767 : (v < -32768) ? -32768 : v);
+}
+
+// 地上の座標(z上向き)のベクトルvを機体の座標にする q: 機体→地上
+static void toBody(const double *q, const double *v, double *out)
+{
+    double w = q[0], x = -q[1], y = -q[2], z = -q[3];
+    // t = 2 * (qv × v), out = v + w * t + qv × t (qv = 共役のベクトル部)
+    double tx = 2 * (y * v[2] - z * v[1]);
+    double ty = 2 * (z * v[0] - x * v[2]);
+    double tz = 2 * (x * v[1] - y * v[0]);
+    out[0] = v[0] + w * tx + (y * tz - z * ty);
+    out[1] = v[1] + w * ty + (z * tx - x * tz);
+    out[2] = v[2] + w * tz + (x * ty - y * tx);
+}
+
+// 2つのクォータニオンの間の角度[deg]
+static float angleDeg(const double *a, const float *b)
+{
+    double d = fabs(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]);
+    d = (d > 1) ? 1 : d;
+    return (float)(2 * acos(d) * 57.29577951308232);
+}
+
+static void runBench()
+{
+    const double gravity[3] = {0, 0, 1};
+    const double field[3] = {0.5, 0, -0.866}; // 北向きで下に傾いた地磁気
+    const int16_t gyroBias[3] = {5, -3, 2};   // [LSB] 0.3dps程度
+
+    ahrsFloat.begin(AHRS_HZ, GYRO_LSB_PER_DPS);
+    ahrsFloat.setGains(0.5f, 0.05f);
+    ahrsFixed.begin(AHRS_HZ, GYRO_LSB_PER_DPS);
+    ahrsFixed.setGains(0.5f, 0.05f);
+
+    double q[4] = {1, 0, 0, 0};
+    const double dt = 1.0 / AHRS_HZ;
+    uint32_t tFloat = 0, tFixed = 0, tFloatMag = 0, tFixedMag = 0;
+    uint32_t nMag = 0, nNoMag = 0;
+    float errFloat = 0, errFixed = 0, diff = 0;
+    for (uint32_t n = 0; n < AHRS_HZ * AHRS_SECONDS; n++)
+    {
+        double t = n * dt;
+        double w[3] = {0.5 * sin(2 * M_PI * 0.5 * t), 0.35 * cos(2 * M_PI * 0.3 * t), 0.8}; // [rad/s]
+
+        double a[3], m[3];
+        toBody(q, gravity, a);
+        toBody(q, field, m);
+        int16_t acc[3], gyro[3], mag[3];
+        for (int i = 0; i < 3; i++)
+        {
+            acc[i] = clip(a[i] * ACC_LSB_PER_G + noise(10));
+            gyro[i] = clip(w[i] * 57.29577951308232 * GYRO_LSB_PER_DPS + noise(3) + gyroBias[i]);
+            mag[i] = clip(m[i] * MAG_LSB + noise(3));
+        }
+        if (n == 0)
+        {
+            float af[3] = {(float)acc[0], (float)acc[1], (float)acc[2]};
+            float mf[3] = {(float)mag[0], (float)mag[1], (float)mag[2]};
+            ahrsFloat.initialize(af, mf);
+            ahrsFixed.initialize(acc, mag);
+        }
+
+        // 地磁気は10回に1回 (ICM20948の地磁気は100Hz)
+        bool useMag = (n % 10) == 0;
+        const int16_t *magArg = useMag ? mag : NULL;
+        uint32_t start = now();
+        ahrsFloat.updateRaw(acc, gyro, magArg);
+        uint32_t mid = now();
+        ahrsFixed.update(acc, gyro, magArg);
+        uint32_t end = now();
+        if (useMag)
+        {
+            tFloatMag += mid - start;
+            tFixedMag += end - mid;
+            nMag++;
+        }
+        else
+        {
+            tFloat += mid - start;
+            tFixed += end - mid;
+            nNoMag++;
+        }
+
+        // 真の姿勢を進める q += 0.5 * q ⊗ (0, ω) * dt
+        double h[3] = {w[0] * dt * 0.5, w[1] * dt * 0.5, w[2] * dt * 0.5};
+        double q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+        q[0] = q0 - q1 * h[0] - q2 * h[1] - q3 * h[2];
+        q[1] = q1 + q0 * h[0] + q2 * h[2] - q3 * h[1];
+        q[2] = q2 + q0 * h[1] - q1 * h[2] + q3 * h[0];
+        q[3] = q3 + q0 * h[2] + q1 * h[1] - q2 * h[0];
+        double r = 1 / sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        for (int i = 0; i < 4; i++)
+        {
+            q[i] *= r;
+        }
+
+        if (n >= AHRS_SETTLE)
+        {
+            // フィルタはn番目のサンプルまで使っているので、n+1の真値と比べる
+            float qf[4], qx[4];
+            ahrsFloat.getQuaternion(qf);
+            ahrsFixed.getQuaternion(qx);
+            double qxd[4] = {qx[0], qx[1], qx[2], qx[3]};
+            float e1 = angleDeg(q, qf), e2 = angleDeg(q, qx), e3 = angleDeg(qxd, qf);
+            errFloat = (e1 > errFloat) ? e1 : errFloat;
+            errFixed = (e2 > errFixed) ? e2 : errFixed;
+            diff = (e3 > diff) ? e3 : diff;
+        }
+    }
+
+#ifdef ARDUINO
+    uint32_t budget = getCpuFrequencyMhz() * (1000000 / AHRS_HZ);
+#else
+    uint32_t budget = 1000000000 / AHRS_HZ;
+#endif
+    char buf[384];
+    snprintf(buf, sizeof(buf),
+             "{\"bench\":\"ahrs\",\"updates\":%u,\"budget\":%u,"
+             "\"float\":{\"time\":%u,\"time_mag\":%u,\"max_err_deg\":%.3f},"
+             "\"fixed\":{\"time\":%u,\"time_mag\":%u,\"max_err_deg\":%.3f},\"max_diff_deg\":%.4f}",
+             (unsigned)(AHRS_HZ * AHRS_SECONDS), (unsigned)budget,
+             (unsigned)(tFloat / nNoMag), (unsigned)(tFloatMag / nMag), errFloat,
+             (unsigned)(tFixed / nNoMag), (unsigned)(tFixedMag / nMag), errFixed, diff);
+#ifdef ARDUINO
+    Serial.println(buf);
+#else
+    puts(buf);
+#endif
+}
+
+#ifdef ARDUINO
+void setup()
+{
+    Serial.begin(115200);
+    delay(1000);
+    runBench();
+}
+
+void loop()
+{
+}
+#else
+int main()
+{
+    runBench();
+    return 0;
+}
+#endif
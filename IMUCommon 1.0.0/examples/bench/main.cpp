@@ -0,0 +1,160 @@
+// IMUConvertとIMUCalibのスカラー版とベクトル版の速度と結果を比べる
+// ESP32: そのままビルドしてシリアルに出力 (単位はCPUサイクル) pie, vector_extは使った実装
+// ESP32-S3のPIEを確かめるときは-DIMU_CONVERT_PIE=1でビルドしてmismatch:0を見る
+// PC: g++ -O2 -I"IMUCommon 1.0.0/src" main.cpp (単位はns)
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdio.h>
+#include <chrono>
+#endif
+#include "IMUConvert.h"
+#include "IMUCalib.h"
+
+// ICM20602のFIFOフレーム (accel, temp, gyro) 64個分
+#define BENCH_FRAMES 64
+#define BENCH_CHANNELS 7
+#define BENCH_REPEAT 1000
+
+// ESP32-S3で-DIMU_CONVERT_PIE=1のとき、decodeBE16がPIEを使うように16byte境界に置く
+static uint8_t rawBytes[BENCH_FRAMES * BENCH_CHANNELS * 2] __attribute__((aligned(16)));
+static int16_t raw[BENCH_FRAMES * BENCH_CHANNELS] __attribute__((aligned(16)));
+static int16_t rawRef[BENCH_FRAMES * BENCH_CHANNELS];
+static float si[BENCH_FRAMES * BENCH_CHANNELS];
+static float siRef[BENCH_FRAMES * BENCH_CHANNELS];
+static int32_t fixed[BENCH_FRAMES * BENCH_CHANNELS];
+static int32_t fixedRef[BENCH_FRAMES * BENCH_CHANNELS];
+static float calibAcc[BENCH_FRAMES * 3];
+static float calibAccRef[BENCH_FRAMES * 3];
+static float calibGyro[BENCH_FRAMES * 3];
+static float calibGyroRef[BENCH_FRAMES * 3];
+
+IMUConvert conv;
+IMUCalib accCal;
+IMUCalib gyroCal;
+
+static uint32_t now()
+{
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+#define BENCH(result, expr)                    \
+    do                                         \
+    {                                          \
+        uint32_t start = now();                \
+        for (int r = 0; r < BENCH_REPEAT; r++) \
+        {                                      \
+            expr;                              \
+            asm volatile("" ::: "memory");     \
+        }                                      \
+        result = (now() - start) / BENCH_REPEAT; \
+    } while (0)
+
+static void runBench()
+{
+    uint32_t seed = 1;
+    for (size_t i = 0; i < sizeof(rawBytes); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        rawBytes[i] = seed >> 16;
+    }
+    const float g = 9.80665f / 2048;
+    const float rad = 3.14159265f / 180 / 16.4f;
+    const float scale[BENCH_CHANNELS] = {g, g, g, 1 / 326.8f, rad, rad, rad};
+    const float offset[BENCH_CHANNELS] = {0, 0, 0, 25, 0, 0, 0};
+    conv.setScale(scale, offset, BENCH_CHANNELS);
+
+    const size_t count = BENCH_FRAMES * BENCH_CHANNELS;
+    uint32_t tDecodeRef, tDecode, tFloatRef, tFloat, tFixedRef, tFixed;
+    BENCH(tDecodeRef, IMUConvert::decodeBE16Scalar(rawBytes, rawRef, count));
+    BENCH(tDecode, IMUConvert::decodeBE16(rawBytes, raw, count));
+    BENCH(tFloatRef, conv.toFloatScalar(rawRef, siRef, BENCH_FRAMES));
+    BENCH(tFloat, conv.toFloat(raw, si, BENCH_FRAMES));
+    BENCH(tFixedRef, conv.toFixedScalar(rawRef, fixedRef, BENCH_FRAMES));
+    BENCH(tFixed, conv.toFixed(raw, fixed, BENCH_FRAMES));
+
+    // imu_calib_fit.pyが出すくらいの補正 (軸のずれ0.5%程度、温度係数あり)
+    const IMUCalibParams accParams = {{{12, -30, 41}, {0.8f, -0.3f, 1.1f}, {0.01f, 0, -0.02f}},
+                                      {{g * 1.003f, g * 0.004f, -g * 0.002f},
+                                       {0, g * 0.998f, g * 0.005f},
+                                       {0, 0, g * 1.001f}},
+                                      25};
+    const IMUCalibParams gyroParams = {{{-5, 7, 3}, {0.2f, 0.1f, -0.4f}, {0, 0.003f, 0}},
+                                       {{rad * 1.002f, rad * 0.003f, -rad * 0.001f},
+                                        {-rad * 0.002f, rad * 0.997f, rad * 0.004f},
+                                        {rad * 0.001f, -rad * 0.005f, rad * 1.004f}},
+                                       25};
+    accCal.setParams(accParams);
+    gyroCal.setParams(gyroParams);
+    accCal.setTemperature(31.5f);
+    gyroCal.setTemperature(31.5f);
+    uint32_t tCalibRef, tCalib;
+    BENCH(tCalibRef, (accCal.applyBatchScalar(rawRef, BENCH_CHANNELS, calibAccRef, 3, BENCH_FRAMES),
+                      gyroCal.applyBatchScalar(rawRef + 4, BENCH_CHANNELS, calibGyroRef, 3, BENCH_FRAMES)));
+    BENCH(tCalib, (accCal.applyBatch(raw, BENCH_CHANNELS, calibAcc, 3, BENCH_FRAMES),
+                   gyroCal.applyBatch(raw + 4, BENCH_CHANNELS, calibGyro, 3, BENCH_FRAMES)));
+
+    // ベクトル版がスカラー版と同じ結果になるか
+    int mismatch = 0;
+    float maxFixedErr = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (raw[i] != rawRef[i] || si[i] != siRef[i] || fixed[i] != fixedRef[i])
+        {
+            mismatch++;
+        }
+        float err = fabsf(fixed[i] / 65536.0f - siRef[i]);
+        if (err > maxFixedErr)
+        {
+            maxFixedErr = err;
+        }
+    }
+    // 積和の順番はスカラー版と同じだが、FMAにまとめられると最後のbitが変わることがある
+    float maxCalibDiff = 0;
+    for (size_t i = 0; i < BENCH_FRAMES * 3; i++)
+    {
+        float diff = fmaxf(fabsf(calibAcc[i] - calibAccRef[i]), fabsf(calibGyro[i] - calibGyroRef[i]));
+        if (diff > maxCalibDiff)
+        {
+            maxCalibDiff = diff;
+        }
+    }
+
+    char buf[320];
+    snprintf(buf, sizeof(buf),
+             "{\"bench\":\"imuconvert\",\"pie\":%d,\"vector_ext\":%d,\"frames\":%d,\"decode\":[%u,%u],\"float\":[%u,%u],\"fixed\":[%u,%u],\"calib\":[%u,%u],"
+             "\"mismatch\":%d,\"fixed_max_err\":%g,\"calib_max_diff\":%g}",
+             IMU_CONVERT_PIE, IMU_VECTOR_EXT, BENCH_FRAMES, (unsigned)tDecodeRef, (unsigned)tDecode, (unsigned)tFloatRef, (unsigned)tFloat,
+             (unsigned)tFixedRef, (unsigned)tFixed, (unsigned)tCalibRef, (unsigned)tCalib, mismatch, maxFixedErr,
+             maxCalibDiff);
+#ifdef ARDUINO
+    Serial.println(buf);
+#else
+    puts(buf);
+#endif
+}
+
+#ifdef ARDUINO
+void setup()
+{
+    Serial.begin(115200);
+    delay(1000);
+    runBench();
+}
+
+void loop()
+{
+}
+#else
+int main()
+{
+    runBench();
+    return 0;
+}
+#endif
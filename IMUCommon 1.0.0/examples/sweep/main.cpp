@@ -0,0 +1,45 @@
+// 同じSPIバスにつないだ3つのIMUをIMUSweepでまとめて読む
+#include <Arduino.h>
+#include <ICM20602.h>
+#include <ICM20948.h>
+#include <ICM42688.h>
+
+// ピン番号はボードに合わせて変える
+namespace IMUPIN
+{
+    const int SCK = 14;
+    const int MISO = 12;
+    const int MOSI = 13;
+    const int CS_ICM20602 = 15;
+    const int CS_ICM20948 = 25;
+    const int CS_ICM42688 = 26;
+}
+
+SPICREATE::SPICreate SPIC;
+ICM20602 icm20602;
+ICM20948 icm20948;
+ICM42688 icm42688;
+
+void setup()
+{
+    Serial.begin(115200);
+    SPIC.begin(VSPI, IMUPIN::SCK, IMUPIN::MISO, IMUPIN::MOSI);
+    icm20602.begin(&SPIC, IMUPIN::CS_ICM20602, 8000000);
+    icm20948.begin(&SPIC, IMUPIN::CS_ICM20948, 7000000);
+    icm42688.begin(&SPIC, IMUPIN::CS_ICM42688, 8000000);
+}
+
+void loop()
+{
+    IMUSample samples[3];
+    uint32_t start = ESP.getCycleCount();
+    bool ok = IMUSweep(samples, icm20602, icm20948, icm42688);
+    uint32_t cycles = ESP.getCycleCount() - start;
+
+    // 加速度のz軸をGで比べる
+    Serial.printf("%s %u cycles, az: %.3f %.3f %.3f\n", ok ? "ok" : "NG", cycles,
+                  samples[0].acc[2] / icm20602.accelLsbPerG(),
+                  samples[1].acc[2] / icm20948.accelLsbPerG(),
+                  samples[2].acc[2] / icm42688.accelLsbPerG());
+    delay(100);
+}
@@ -0,0 +1,295 @@
+// IMUVoteのリプレイベンチマーク
+// LogBoard67で記録したレコード(ICM20948とH3LIS331)を読み、ICMの値を3つのIMUに複製して故障を入れ、
+// 1サンプルごとのIMUVote::update()の時間と、故障を見つけた回数をJSONで1行出力する
+// 入れる故障: IMU1の固着 (2000~4000サンプル), IMU2の加速度X軸のずれ +2G (6000~8000サンプル), IMU0の読み出し失敗 (97サンプルに1回)
+// 記録がなければ、ICMが振り切れる25Gの燃焼を含む飛行を作って使う
+// ESP32: SPI Flashの0x100から読む (単位はCPUサイクル、予算は1kHzの1周期)
+// PC: g++ -O2 -I"IMUCommon 1.0.0/src" main.cpp && ./a.out [SPI Flashのダンプ] (単位はns)
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <S25FL512S.h>
+#else
+#include <stdio.h>
+#include <chrono>
+#endif
+#include "IMUVote.h"
+
+// LogBoard67のレコード
+#define REPLAY_RECORD_SIZE 32
+#define REPLAY_FIRST_ADDRESS 0x100
+#define REPLAY_EPOCH_FLAG 0x80
+#define REPLAY_FRESH_ICM 0x02 // LOG67_CH_ICMのビット
+#define REPLAY_H3LIS_LSB_PER_G (16.0f / 0.195f)
+#define REPLAY_ICM_LSB_PER_G 2048.0f
+#define REPLAY_ICM_LSB_PER_DPS 16.4f
+#define REPLAY_SYNTHETIC_SAMPLES 10000
+#define REPLAY_PERIOD_US 1000
+
+#ifdef ARDUINO
+namespace LOGPIN
+{
+    const int SCK = 33;
+    const int MISO = 25;
+    const int MOSI = 26;
+    const int CS_FLASH = 27;
+}
+SPICREATE::SPICreate SPIC;
+Flash flash;
+#else
+static FILE *dump = NULL;
+#endif
+
+IMUVote vote;
+
+static uint32_t now()
+{
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+// 記録の256byteのページを読む なければfalse
+static bool readPage(uint32_t page, uint8_t *buf)
+{
+#ifdef ARDUINO
+    uint32_t addr = REPLAY_FIRST_ADDRESS + page * 256;
+    if (addr >= SPI_FLASH_MAX_ADDRESS)
+    {
+        return false;
+    }
+    flash.read(addr, buf);
+    return true;
+#else
+    // ダンプは0x100からのページを順に並べたもの
+    (void)page;
+    return dump != NULL && fread(buf, 1, 256, dump) == 256;
+#endif
+}
+
+static uint32_t lcg = 1;
+static int16_t noise(int amplitude)
+{
+    lcg = lcg * 1103515245 + 12345;
+    return (int16_t)((int)((lcg >> 16) % (2 * amplitude + 1)) - amplitude);
+}
+
+static int16_t clip(float v)
+{
+    if (v > 32767)
+    {
+        return 32767;
+    }
+    if (v < -32768)
+    {
+        return -32768;
+    }
+    return (int16_t)v;
+}
+
+// 作る飛行: 2秒静止、1.5秒燃焼(25G)、その後慣性飛行
+static void syntheticRecord(uint32_t n, IMUSample *icm, int16_t *highG)
+{
+    float g[3] = {0, 0, 1};
+    float dps[3] = {0, 0, 0};
+    if (n >= 2000 && n < 3500)
+    {
+        g[2] = 25;
+        dps[2] = 300;
+    }
+    else if (n >= 3500)
+    {
+        g[0] = 0.3f;
+        g[2] = -0.2f;
+        dps[2] = 300 - (n - 3500) * 0.05f;
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        icm->acc[c] = clip(g[c] * REPLAY_ICM_LSB_PER_G + noise(8));
+        icm->gyro[c] = clip(dps[c] * REPLAY_ICM_LSB_PER_DPS + noise(4));
+        // 12bit左詰め
+        highG[c] = (int16_t)(clip(g[c] * REPLAY_H3LIS_LSB_PER_G + noise(24)) & 0xFFF0);
+    }
+    icm->timestamp = (int64_t)n * REPLAY_PERIOD_US;
+}
+
+// LogBoard67のレコードをほどく エポックのレコードと、ICMを新しく読んでいないレコードはfalse
+// (読まなかったセンサは前の値のままなので、そのまま流すと固着に見える)
+static bool decodeRecord(const uint8_t *rec, IMUSample *icm, int16_t *highG)
+{
+    uint8_t fresh = rec[REPLAY_RECORD_SIZE - 1];
+    if ((fresh & REPLAY_EPOCH_FLAG) || !(fresh & REPLAY_FRESH_ICM))
+    {
+        return false;
+    }
+    icm->timestamp = rec[0] | rec[1] << 8 | rec[2] << 16 | (uint32_t)rec[3] << 24;
+    for (int c = 0; c < 3; c++)
+    {
+        highG[c] = (int16_t)(rec[4 + 2 * c] | rec[5 + 2 * c] << 8);
+        icm->acc[c] = (int16_t)(rec[10 + 2 * c] << 8 | rec[11 + 2 * c]);
+        icm->gyro[c] = (int16_t)(rec[16 + 2 * c] << 8 | rec[17 + 2 * c]);
+    }
+    return true;
+}
+
+struct ReplayStat
+{
+    uint32_t samples;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t over;
+    uint32_t disagree;
+};
+
+static void replayOne(uint32_t n, const IMUSample &icm, const int16_t *highG, uint32_t budget, ReplayStat *st)
+{
+    static IMUSample stuck;
+    IMUSample samples[3] = {icm, icm, icm};
+    for (int c = 0; c < 3; c++)
+    {
+        samples[1].acc[c] = clip(icm.acc[c] + (float)noise(3));
+        samples[1].gyro[c] = clip(icm.gyro[c] + (float)noise(3));
+        samples[2].acc[c] = clip(icm.acc[c] + (float)noise(3));
+        samples[2].gyro[c] = clip(icm.gyro[c] + (float)noise(3));
+    }
+    if (n == 2000)
+    {
+        stuck = samples[1];
+    }
+    if (n >= 2000 && n < 4000)
+    {
+        samples[1] = stuck;
+    }
+    if (n >= 6000 && n < 8000)
+    {
+        samples[2].acc[0] = clip(samples[2].acc[0] + 2 * REPLAY_ICM_LSB_PER_G);
+    }
+    uint8_t validMask = (n % 97 == 0) ? 0x06 : 0x07;
+
+    IMUVoteResult result;
+    uint32_t start = now();
+    vote.update(samples, validMask, highG, &result);
+    asm volatile("" ::: "memory");
+    uint32_t t = now() - start;
+
+    st->samples++;
+    st->sum += t;
+    st->min = (t < st->min) ? t : st->min;
+    st->max = (t > st->max) ? t : st->max;
+    if (t > budget)
+    {
+        st->over++;
+    }
+    if (result.flags & IMU_VOTE_DISAGREE)
+    {
+        st->disagree++;
+    }
+}
+
+static void runReplay()
+{
+    vote.setIMU(0, REPLAY_ICM_LSB_PER_G, REPLAY_ICM_LSB_PER_DPS);
+    vote.setIMU(1, REPLAY_ICM_LSB_PER_G, REPLAY_ICM_LSB_PER_DPS);
+    vote.setIMU(2, REPLAY_ICM_LSB_PER_G, REPLAY_ICM_LSB_PER_DPS);
+    vote.setHighG(REPLAY_H3LIS_LSB_PER_G);
+
+#ifdef ARDUINO
+    uint32_t budget = getCpuFrequencyMhz() * REPLAY_PERIOD_US;
+#else
+    uint32_t budget = REPLAY_PERIOD_US * 1000;
+#endif
+    ReplayStat st = {0, 0xFFFFFFFF, 0, 0, 0, 0};
+    IMUSample icm = {};
+    int16_t highG[3];
+
+    // 記録を最後(消去したままの0xFF)まで読む
+    static uint8_t page[256];
+    bool end = false;
+    for (uint32_t p = 0; !end && readPage(p, page); p++)
+    {
+        for (int r = 0; r < 256 / REPLAY_RECORD_SIZE; r++)
+        {
+            const uint8_t *rec = page + r * REPLAY_RECORD_SIZE;
+            bool blank = true;
+            for (int k = 0; k < REPLAY_RECORD_SIZE && blank; k++)
+            {
+                blank = rec[k] == 0xFF;
+            }
+            if (blank)
+            {
+                end = true;
+                break;
+            }
+            if (decodeRecord(rec, &icm, highG))
+            {
+                replayOne(st.samples, icm, highG, budget, &st);
+            }
+        }
+    }
+    const char *source = "flash";
+    if (st.samples == 0)
+    {
+        source = "synthetic";
+        for (uint32_t n = 0; n < REPLAY_SYNTHETIC_SAMPLES; n++)
+        {
+            syntheticRecord(n, &icm, highG);
+            replayOne(n, icm, highG, budget, &st);
+        }
+    }
+
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"bench\":\"imuvote\",\"source\":\"%s\",\"samples\":%u,\"time\":{\"min\":%u,\"mean\":%u,\"max\":%u},"
+             "\"budget\":%u,\"over\":%u,\"stuck\":[%u,%u,%u],\"outlier\":[%u,%u,%u],\"read_fail\":[%u,%u,%u],"
+             "\"saturated\":%u,\"highg\":%u,\"disagree\":%u,\"invalid\":%u}",
+             source, (unsigned)st.samples, (unsigned)(st.samples ? st.min : 0),
+             (unsigned)(st.samples ? st.sum / st.samples : 0), (unsigned)st.max, (unsigned)budget, (unsigned)st.over,
+             (unsigned)vote.stuckCount[0], (unsigned)vote.stuckCount[1], (unsigned)vote.stuckCount[2],
+             (unsigned)vote.outlierCount[0], (unsigned)vote.outlierCount[1], (unsigned)vote.outlierCount[2],
+             (unsigned)vote.readFailCount[0], (unsigned)vote.readFailCount[1], (unsigned)vote.readFailCount[2],
+             (unsigned)vote.saturatedCount[0], (unsigned)vote.highGCount, (unsigned)st.disagree,
+             (unsigned)vote.invalidCount);
+#ifdef ARDUINO
+    Serial.println(buf);
+#else
+    puts(buf);
+#endif
+}
+
+#ifdef ARDUINO
+void setup()
+{
+    Serial.begin(115200);
+    SPIC.begin(VSPI, LOGPIN::SCK, LOGPIN::MISO, LOGPIN::MOSI);
+    flash.begin(&SPIC, LOGPIN::CS_FLASH, 10000000);
+    delay(1000);
+    runReplay();
+}
+
+void loop()
+{
+}
+#else
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        dump = fopen(argv[1], "rb");
+        if (dump == NULL)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+    runReplay();
+    if (dump != NULL)
+    {
+        fclose(dump);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,460 @@
+// version: 1.0.0
+#pragma once
+
+#ifndef IMUAhrs_H
+#define IMUAhrs_H
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * @brief Mahonyの相補フィルタで姿勢(クォータニオン)を求める
+ * 角速度を積分し、加速度(重力の向き)と地磁気(北の向き)とのずれをPI制御で角速度に足して補正する
+ *   e = a × v (+ m × w)     v, w: 今の姿勢から推定した重力と地磁気の向き
+ *   ω' = ω + kp * e + ki * ∫e dt
+ *   q += 0.5 * q ⊗ (0, ω') * dt
+ * float版(IMUAhrs)と固定小数点版(IMUAhrsFixed)は同じ計算をする
+ * ESP32はFPUがあるのでふつうはfloat版で十分速い 固定小数点版はFPUを使いたくない割り込みやタスクから呼ぶとき用
+ * 1回のupdate()のサイクル数はexamples/ahrsで測れる (1kHzでも1周期の数%程度)
+ * Arduinoに依存しないのでPC上でも使える
+ *
+ * 軸は加速度、角速度、地磁気で揃えてから渡すこと
+ * (ICM20948の地磁気(AK09916)は加速度に対してY軸とZ軸が逆向き)
+ *
+ * ```cpp
+ * // example: ICM20948を1kHzで
+ * IMUAhrs ahrs;
+ * ahrs.begin(1000, icm20948.gyroLsbPerDps());
+ * int16_t data[6], mag[3];
+ * icm20948.Get(data);               // data[0~2]: 加速度, data[3~5]: 角速度
+ * icm20948.GetMag(mag);
+ * mag[1] = -mag[1];
+ * mag[2] = -mag[2];
+ * ahrs.updateRaw(&data[0], &data[3], mag);
+ * float rpy[3];
+ * ahrs.getEuler(rpy);
+ * ```
+ */
+class IMUAhrs
+{
+private:
+    float q[4] = {1, 0, 0, 0};
+    float integral[3] = {};
+    float dt = 0.001f;
+    float gyroScale = 0; // 1LSBあたりのrad/s
+
+public:
+    float kp = 0.5f;
+    float ki = 0.0f;
+
+    /**
+     * @param[in] sampleHz update()を呼ぶ周期[Hz]
+     * @param[in] gyroLsbPerDps updateRaw()を使うときの角速度の1dpsあたりのLSB
+     * @retval false: sampleHzが0以下
+     */
+    bool begin(float sampleHz, float gyroLsbPerDps = 0);
+    void setGains(float kpGain, float kiGain)
+    {
+        kp = kpGain;
+        ki = kiGain;
+    }
+    // 加速度(と地磁気)から初期姿勢を決める 静止しているときに1回呼ぶと収束を待たなくてよい
+    void initialize(const float *acc, const float *mag = NULL);
+    void reset();
+
+    /**
+     * @brief 1サンプル分更新する
+     * @param[in] gyro 角速度[rad/s]
+     * @param[in] acc 加速度 (大きさは問わない) 0ベクトルなら補正しない
+     * @param[in] mag 地磁気 (大きさは問わない) NULLまたは0ベクトルなら使わない
+     */
+    void update(const float *gyro, const float *acc, const float *mag = NULL);
+    // 生の値のまま更新する 加速度と地磁気は大きさを問わないので換算しない
+    void updateRaw(const int16_t *acc, const int16_t *gyro, const int16_t *mag = NULL);
+
+    void getQuaternion(float *out) const;
+    // roll, pitch, yaw [deg]
+    void getEuler(float *rpy) const;
+};
+
+/**
+ * @brief IMUAhrsの固定小数点版 (クォータニオンと単位ベクトルはQ30)
+ * 生の値(int16)だけを受け取り、FPUを使わない
+ * ベクトルの正規化は1/sqrtの表と2回のニュートン法、クォータニオンの正規化は1回のニュートン法
+ * float版との差は姿勢で0.1deg以下 (examples/ahrs)
+ */
+class IMUAhrsFixed
+{
+private:
+    int32_t q[4] = {1 << 30, 0, 0, 0};
+    int32_t integral[3] = {}; // [rad/s] Q30
+    int64_t gyroHalfDt = 0;   // 角速度1LSBあたりの 0.5 * rad/s * dt (Q40)
+    int32_t halfDt = 0;       // 0.5 * dt (Q30)
+    int32_t kpHalfDt = 0;     // kp * 0.5 * dt (Q30)
+    int32_t kiDt = 0;         // ki * dt (Q30)
+    float dt = 0.001f;
+
+    static bool normalize(const int32_t *v, int32_t *out);
+
+public:
+    /**
+     * @param[in] sampleHz update()を呼ぶ周期[Hz]
+     * @param[in] gyroLsbPerDps 角速度の1dpsあたりのLSB
+     * @retval false: 引数が0以下
+     */
+    bool begin(float sampleHz, float gyroLsbPerDps);
+    bool setGains(float kp, float ki);
+    void initialize(const int16_t *acc, const int16_t *mag = NULL);
+    void reset();
+
+    // 引数はIMUAhrs::updateRawと同じ
+    void update(const int16_t *acc, const int16_t *gyro, const int16_t *mag = NULL);
+
+    void getQuaternion(float *out) const;
+    void getEuler(float *rpy) const;
+    // Q30のまま
+    const int32_t *quaternionQ30() const { return q; }
+};
+
+// 加速度と地磁気から姿勢のクォータニオンを作る (初期化用)
+inline void imuAhrsInitialQuaternion(const float *acc, const float *mag, float *q)
+{
+    float roll = atan2f(acc[1], acc[2]);
+    float pitch = atan2f(-acc[0], sqrtf(acc[1] * acc[1] + acc[2] * acc[2]));
+    float yaw = 0;
+    if (mag != NULL && (mag[0] != 0 || mag[1] != 0 || mag[2] != 0))
+    {
+        // 傾きを戻した水平面での地磁気の向き
+        float cr = cosf(roll), sr = sinf(roll), cp = cosf(pitch), sp = sinf(pitch);
+        float mx = mag[0] * cp + mag[1] * sr * sp + mag[2] * cr * sp;
+        float my = mag[1] * cr - mag[2] * sr;
+        yaw = atan2f(-my, mx);
+    }
+    float cr = cosf(roll * 0.5f), sr = sinf(roll * 0.5f);
+    float cp = cosf(pitch * 0.5f), sp = sinf(pitch * 0.5f);
+    float cy = cosf(yaw * 0.5f), sy = sinf(yaw * 0.5f);
+    q[0] = cr * cp * cy + sr * sp * sy;
+    q[1] = sr * cp * cy - cr * sp * sy;
+    q[2] = cr * sp * cy + sr * cp * sy;
+    q[3] = cr * cp * sy - sr * sp * cy;
+}
+
+inline void imuAhrsEuler(const float *q, float *rpy)
+{
+    const float deg = 57.29578f;
+    rpy[0] = atan2f(2 * (q[0] * q[1] + q[2] * q[3]), 1 - 2 * (q[1] * q[1] + q[2] * q[2])) * deg;
+    float s = 2 * (q[0] * q[2] - q[3] * q[1]);
+    s = (s > 1) ? 1 : (s < -1) ? -1 : s;
+    rpy[1] = asinf(s) * deg;
+    rpy[2] = atan2f(2 * (q[0] * q[3] + q[1] * q[2]), 1 - 2 * (q[2] * q[2] + q[3] * q[3])) * deg;
+}
+
+bool IMUAhrs::begin(float sampleHz, float gyroLsbPerDps)
+{
+    if (!(sampleHz > 0))
+    {
+        return false;
+    }
+    dt = 1.0f / sampleHz;
+    gyroScale = (gyroLsbPerDps > 0) ? 0.017453293f / gyroLsbPerDps : 0;
+    reset();
+    return true;
+}
+
+void IMUAhrs::reset()
+{
+    q[0] = 1;
+    q[1] = q[2] = q[3] = 0;
+    integral[0] = integral[1] = integral[2] = 0;
+}
+
+void IMUAhrs::initialize(const float *acc, const float *mag)
+{
+    imuAhrsInitialQuaternion(acc, mag, q);
+    integral[0] = integral[1] = integral[2] = 0;
+}
+
+void IMUAhrs::update(const float *gyro, const float *acc, const float *mag)
+{
+    float gx = gyro[0], gy = gyro[1], gz = gyro[2];
+    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+    float an = acc[0] * acc[0] + acc[1] * acc[1] + acc[2] * acc[2];
+    if (an > 0)
+    {
+        float r = 1.0f / sqrtf(an);
+        float ax = acc[0] * r, ay = acc[1] * r, az = acc[2] * r;
+        // 今の姿勢での重力の向き
+        float vx = 2 * (q1 * q3 - q0 * q2);
+        float vy = 2 * (q0 * q1 + q2 * q3);
+        float vz = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+        float ex = ay * vz - az * vy;
+        float ey = az * vx - ax * vz;
+        float ez = ax * vy - ay * vx;
+
+        float mn = (mag != NULL) ? mag[0] * mag[0] + mag[1] * mag[1] + mag[2] * mag[2] : 0;
+        if (mn > 0)
+        {
+            r = 1.0f / sqrtf(mn);
+            float mx = mag[0] * r, my = mag[1] * r, mz = mag[2] * r;
+            // 地磁気を地上の座標にして、水平成分をx軸に寄せたものを基準にする
+            float hx = 2 * (mx * (0.5f - q2 * q2 - q3 * q3) + my * (q1 * q2 - q0 * q3) + mz * (q1 * q3 + q0 * q2));
+            float hy = 2 * (mx * (q1 * q2 + q0 * q3) + my * (0.5f - q1 * q1 - q3 * q3) + mz * (q2 * q3 - q0 * q1));
+            float bx = sqrtf(hx * hx + hy * hy);
+            float bz = 2 * (mx * (q1 * q3 - q0 * q2) + my * (q2 * q3 + q0 * q1) + mz * (0.5f - q1 * q1 - q2 * q2));
+            // 今の姿勢での地磁気の向き
+            float wx = 2 * (bx * (0.5f - q2 * q2 - q3 * q3) + bz * (q1 * q3 - q0 * q2));
+            float wy = 2 * (bx * (q1 * q2 - q0 * q3) + bz * (q0 * q1 + q2 * q3));
+            float wz = 2 * (bx * (q0 * q2 + q1 * q3) + bz * (0.5f - q1 * q1 - q2 * q2));
+            ex += my * wz - mz * wy;
+            ey += mz * wx - mx * wz;
+            ez += mx * wy - my * wx;
+        }
+
+        if (ki > 0)
+        {
+            integral[0] += ki * ex * dt;
+            integral[1] += ki * ey * dt;
+            integral[2] += ki * ez * dt;
+        }
+        gx += kp * ex + integral[0];
+        gy += kp * ey + integral[1];
+        gz += kp * ez + integral[2];
+    }
+    else if (ki > 0)
+    {
+        gx += integral[0];
+        gy += integral[1];
+        gz += integral[2];
+    }
+
+    float h = 0.5f * dt;
+    gx *= h;
+    gy *= h;
+    gz *= h;
+    q[0] = q0 - q1 * gx - q2 * gy - q3 * gz;
+    q[1] = q1 + q0 * gx + q2 * gz - q3 * gy;
+    q[2] = q2 + q0 * gy - q1 * gz + q3 * gx;
+    q[3] = q3 + q0 * gz + q1 * gy - q2 * gx;
+    float r = 1.0f / sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    q[0] *= r;
+    q[1] *= r;
+    q[2] *= r;
+    q[3] *= r;
+}
+
+void IMUAhrs::updateRaw(const int16_t *acc, const int16_t *gyro, const int16_t *mag)
+{
+    float g[3] = {gyro[0] * gyroScale, gyro[1] * gyroScale, gyro[2] * gyroScale};
+    float a[3] = {(float)acc[0], (float)acc[1], (float)acc[2]};
+    if (mag == NULL)
+    {
+        update(g, a, NULL);
+        return;
+    }
+    float m[3] = {(float)mag[0], (float)mag[1], (float)mag[2]};
+    update(g, a, m);
+}
+
+void IMUAhrs::getQuaternion(float *out) const
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = q[i];
+    }
+}
+
+void IMUAhrs::getEuler(float *rpy) const
+{
+    imuAhrsEuler(q, rpy);
+}
+
+static inline int32_t imuMulQ30(int32_t a, int32_t b)
+{
+    return (int32_t)(((int64_t)a * b) >> 30);
+}
+
+// 3次元ベクトルをQ30の単位ベクトルにする 0ベクトルならfalse
+// s = |v|^2 を偶数bitだけずらして x = s / 2^60 を[1, 4)にし、1/sqrt(x)を表(24区間)から2回のニュートン法で求める
+bool IMUAhrsFixed::normalize(const int32_t *v, int32_t *out)
+{
+    static const int32_t rsqrtTable[24] = {
+        1041682578, 985333074, 937238702, 895562589, 858993459, 826566842, 797555404, 771398898,
+        747657839, 725981977, 706088274, 687745184, 670761200, 654976372, 640255922, 626485368,
+        613566757, 601415717, 589959130, 579133272, 568882316, 559157115, 549914212, 541115017};
+    uint64_t s = (uint64_t)((int64_t)v[0] * v[0]) + (uint64_t)((int64_t)v[1] * v[1]) + (uint64_t)((int64_t)v[2] * v[2]);
+    if (s == 0)
+    {
+        return false;
+    }
+    int bits = 64 - __builtin_clzll(s);
+    int e = bits - 61;
+    if (e & 1)
+    {
+        e--;
+    }
+    uint64_t sx = (e >= 0) ? s >> e : s << -e; // [2^60, 2^62)
+    int32_t x = (int32_t)(sx >> 32);           // Q28 [1, 4)
+    int32_t y = rsqrtTable[(sx >> 57) - 8];    // Q30
+    for (int i = 0; i < 2; i++)
+    {
+        // y = y * (3 - x * y^2) / 2
+        int32_t xyy = (int32_t)(((int64_t)x * imuMulQ30(y, y)) >> 28);
+        y = (int32_t)(((int64_t)y * ((3LL << 30) - xyy)) >> 31);
+    }
+    // v / sqrt(s) * 2^30 = v * y / 2^(30 + e/2) (s >= 1なのでe >= -60)
+    int shift = 30 + e / 2;
+    for (int i = 0; i < 3; i++)
+    {
+        out[i] = (int32_t)(((int64_t)v[i] * y) >> shift);
+    }
+    return true;
+}
+
+bool IMUAhrsFixed::begin(float sampleHz, float gyroLsbPerDps)
+{
+    if (!(sampleHz > 0) || !(gyroLsbPerDps > 0))
+    {
+        return false;
+    }
+    dt = 1.0f / sampleHz;
+    gyroHalfDt = (int64_t)llround(0.5 * dt * 0.017453292519943295 / gyroLsbPerDps * 1099511627776.0);
+    halfDt = (int32_t)lround(0.5 * dt * 1073741824.0);
+    reset();
+    return setGains(0.5f, 0.0f);
+}
+
+bool IMUAhrsFixed::setGains(float kp, float ki)
+{
+    // kp * 0.5 * dtと ki * dtがQ30で表せる範囲
+    if (!(kp >= 0) || !(ki >= 0) || kp * 0.5f * dt >= 1.0f || ki * dt >= 1.0f)
+    {
+        return false;
+    }
+    kpHalfDt = (int32_t)lround(kp * 0.5 * dt * 1073741824.0);
+    kiDt = (int32_t)lround(ki * dt * 1073741824.0);
+    return true;
+}
+
+void IMUAhrsFixed::reset()
+{
+    q[0] = 1 << 30;
+    q[1] = q[2] = q[3] = 0;
+    integral[0] = integral[1] = integral[2] = 0;
+}
+
+void IMUAhrsFixed::initialize(const int16_t *acc, const int16_t *mag)
+{
+    float a[3] = {(float)acc[0], (float)acc[1], (float)acc[2]};
+    float m[3] = {0, 0, 0};
+    if (mag != NULL)
+    {
+        m[0] = mag[0];
+        m[1] = mag[1];
+        m[2] = mag[2];
+    }
+    float qf[4];
+    imuAhrsInitialQuaternion(a, m, qf);
+    for (int i = 0; i < 4; i++)
+    {
+        q[i] = (int32_t)lroundf(qf[i] * 1073741824.0f);
+    }
+    integral[0] = integral[1] = integral[2] = 0;
+}
+
+void IMUAhrsFixed::update(const int16_t *acc, const int16_t *gyro, const int16_t *mag)
+{
+    int32_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    // 誤差は加速度と地磁気の分を足すと2を超えうるので64bitで持つ
+    int64_t ex = 0, ey = 0, ez = 0;
+    int32_t v[3] = {acc[0], acc[1], acc[2]};
+    int32_t a[3];
+    bool corrected = normalize(v, a);
+    if (corrected)
+    {
+        int32_t vx = (imuMulQ30(q1, q3) - imuMulQ30(q0, q2)) * 2;
+        int32_t vy = (imuMulQ30(q0, q1) + imuMulQ30(q2, q3)) * 2;
+        int32_t vz = imuMulQ30(q0, q0) - imuMulQ30(q1, q1) - imuMulQ30(q2, q2) + imuMulQ30(q3, q3);
+        ex = imuMulQ30(a[1], vz) - imuMulQ30(a[2], vy);
+        ey = imuMulQ30(a[2], vx) - imuMulQ30(a[0], vz);
+        ez = imuMulQ30(a[0], vy) - imuMulQ30(a[1], vx);
+
+        int32_t m[3];
+        if (mag != NULL)
+        {
+            v[0] = mag[0];
+            v[1] = mag[1];
+            v[2] = mag[2];
+        }
+        if (mag != NULL && normalize(v, m))
+        {
+            const int32_t half = 1 << 29;
+            int32_t q1q1 = imuMulQ30(q1, q1), q2q2 = imuMulQ30(q2, q2), q3q3 = imuMulQ30(q3, q3);
+            int32_t q0q1 = imuMulQ30(q0, q1), q0q2 = imuMulQ30(q0, q2), q0q3 = imuMulQ30(q0, q3);
+            int32_t q1q2 = imuMulQ30(q1, q2), q1q3 = imuMulQ30(q1, q3), q2q3 = imuMulQ30(q2, q3);
+            int32_t hx = (imuMulQ30(m[0], half - q2q2 - q3q3) + imuMulQ30(m[1], q1q2 - q0q3) + imuMulQ30(m[2], q1q3 + q0q2)) * 2;
+            int32_t hy = (imuMulQ30(m[0], q1q2 + q0q3) + imuMulQ30(m[1], half - q1q1 - q3q3) + imuMulQ30(m[2], q2q3 - q0q1)) * 2;
+            int32_t bz = (imuMulQ30(m[0], q1q3 - q0q2) + imuMulQ30(m[1], q2q3 + q0q1) + imuMulQ30(m[2], half - q1q1 - q2q2)) * 2;
+            // bx = sqrt(hx^2 + hy^2) = (hx, hy)と、それを正規化したものの内積
+            int32_t hv[3] = {hx, hy, 0};
+            int32_t hn[3];
+            int32_t bx = 0;
+            if (normalize(hv, hn))
+            {
+                bx = imuMulQ30(hx, hn[0]) + imuMulQ30(hy, hn[1]);
+            }
+            int32_t wx = (imuMulQ30(bx, half - q2q2 - q3q3) + imuMulQ30(bz, q1q3 - q0q2)) * 2;
+            int32_t wy = (imuMulQ30(bx, q1q2 - q0q3) + imuMulQ30(bz, q0q1 + q2q3)) * 2;
+            int32_t wz = (imuMulQ30(bx, q0q2 + q1q3) + imuMulQ30(bz, half - q1q1 - q2q2)) * 2;
+            ex += imuMulQ30(m[1], wz) - imuMulQ30(m[2], wy);
+            ey += imuMulQ30(m[2], wx) - imuMulQ30(m[0], wz);
+            ez += imuMulQ30(m[0], wy) - imuMulQ30(m[1], wx);
+        }
+
+        if (kiDt > 0)
+        {
+            integral[0] += (int32_t)((kiDt * ex) >> 30);
+            integral[1] += (int32_t)((kiDt * ey) >> 30);
+            integral[2] += (int32_t)((kiDt * ez) >> 30);
+        }
+    }
+
+    // 0.5 * ω' * dt (Q30)
+    int32_t gx = (int32_t)((gyro[0] * gyroHalfDt) >> 10) + imuMulQ30(integral[0], halfDt);
+    int32_t gy = (int32_t)((gyro[1] * gyroHalfDt) >> 10) + imuMulQ30(integral[1], halfDt);
+    int32_t gz = (int32_t)((gyro[2] * gyroHalfDt) >> 10) + imuMulQ30(integral[2], halfDt);
+    if (corrected)
+    {
+        gx += (int32_t)((kpHalfDt * ex) >> 30);
+        gy += (int32_t)((kpHalfDt * ey) >> 30);
+        gz += (int32_t)((kpHalfDt * ez) >> 30);
+    }
+    q[0] = q0 - imuMulQ30(q1, gx) - imuMulQ30(q2, gy) - imuMulQ30(q3, gz);
+    q[1] = q1 + imuMulQ30(q0, gx) + imuMulQ30(q2, gz) - imuMulQ30(q3, gy);
+    q[2] = q2 + imuMulQ30(q0, gy) - imuMulQ30(q1, gz) + imuMulQ30(q3, gx);
+    q[3] = q3 + imuMulQ30(q0, gz) + imuMulQ30(q1, gy) - imuMulQ30(q2, gx);
+
+    // |q|はほぼ1なので、1/sqrtは1からのニュートン法1回 (3 - |q|^2) / 2 で足りる
+    int64_t n = ((int64_t)q[0] * q[0] + (int64_t)q[1] * q[1] + (int64_t)q[2] * q[2] + (int64_t)q[3] * q[3]) >> 30;
+    int32_t r = (int32_t)(((3LL << 30) - n) >> 1);
+    for (int i = 0; i < 4; i++)
+    {
+        q[i] = imuMulQ30(q[i], r);
+    }
+}
+
+void IMUAhrsFixed::getQuaternion(float *out) const
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = q[i] * (1.0f / 1073741824.0f);
+    }
+}
+
+void IMUAhrsFixed::getEuler(float *rpy) const
+{
+    float qf[4];
+    getQuaternion(qf);
+    imuAhrsEuler(qf, rpy);
+}
+
+#endif
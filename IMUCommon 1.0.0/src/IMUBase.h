@@ -0,0 +1,113 @@
+// version: 1.0.0
+#pragma once
+
+#ifndef IMUBase_H
+#define IMUBase_H
+#include <stdint.h>
+
+/**
+ * ICM20602, ICM20948, ICM42688で共通の1サンプル
+ * 値はセンサの生の値 (big endianを並べ直しただけ) 物理量にするにはaccelLsbPerG, gyroLsbPerDpsで割る
+ */
+struct IMUSample
+{
+    int16_t acc[3];
+    int16_t gyro[3];
+    int16_t temp;      // 生の値 換算式はセンサごとに違う
+    int64_t timestamp; // 結果を受け取った時刻 esp_timer_get_time() [us]
+};
+
+/**
+ * @brief IMUのドライバに共通のインターフェース (CRTP)
+ * ドライバは class ICM20948 : public IMUBase<ICM20948> のように継承し、
+ * queueReadImpl(), collectImpl(IMUSample *), accelLsbPerG(), gyroLsbPerDps() を実装する
+ * 仮想関数を使わないので、呼び出しのコストは直接呼ぶのと同じ
+ *
+ * 読み出しは2段階
+ *   queueRead(): SPIの読み出しをキューに積むだけで待たない
+ *   collect(): 読み出しの完了を待って、IMUSampleにする
+ * 複数のIMUをIMUSweepで読むと、全部のIMUの読み出しを続けて積んでから結果を受け取るので、
+ * 通信の間の隙間(1回ごとの送信の準備と完了待ち)がなくなり、冗長なIMUを増やしても増えるのはほぼ通信そのものの時間だけになる
+ */
+template <class Derived>
+class IMUBase
+{
+private:
+    bool pending = false;
+
+    Derived &self() { return *static_cast<Derived *>(this); }
+
+public:
+    // 読み出しをキューに積む 前の結果を受け取っていなければfalse
+    bool queueRead()
+    {
+        if (pending)
+        {
+            return false;
+        }
+        pending = self().queueReadImpl();
+        return pending;
+    }
+    // queueReadした読み出しの結果を受け取る 積んでいなければfalse
+    bool collect(IMUSample *sample)
+    {
+        if (!pending)
+        {
+            return false;
+        }
+        pending = false;
+        return self().collectImpl(sample);
+    }
+    // 1つだけ読むとき
+    bool read(IMUSample *sample)
+    {
+        return queueRead() && collect(sample);
+    }
+    bool isPending() { return pending; }
+};
+
+inline bool imuQueueAll()
+{
+    return true;
+}
+template <class Head, class... Tail>
+bool imuQueueAll(Head &head, Tail &...tail)
+{
+    bool ok = head.queueRead();
+    return imuQueueAll(tail...) && ok;
+}
+inline bool imuCollectAll(IMUSample *)
+{
+    return true;
+}
+template <class Head, class... Tail>
+bool imuCollectAll(IMUSample *samples, Head &head, Tail &...tail)
+{
+    bool ok = head.collect(samples);
+    return imuCollectAll(samples + 1, tail...) && ok;
+}
+
+/**
+ * @brief 複数のIMUを1回でまとめて読む
+ * 全部のIMUの読み出しを積んでから、順に結果を受け取る
+ * @param[out] samples IMUの数以上の配列 引数の順に入る
+ * @retval false: どれかのIMUの読み出しに失敗した (成功したIMUのサンプルは入っている)
+ *
+ * ```cpp
+ * // example
+ * ICM20602 icm20602;
+ * ICM20948 icm20948;
+ * ICM42688 icm42688;
+ * IMUSample samples[3];
+ * IMUSweep(samples, icm20602, icm20948, icm42688);
+ * ```
+ */
+template <class... IMUs>
+bool IMUSweep(IMUSample *samples, IMUs &...imus)
+{
+    bool queued = imuQueueAll(imus...);
+    bool collected = imuCollectAll(samples, imus...);
+    return queued && collected;
+}
+
+#endif
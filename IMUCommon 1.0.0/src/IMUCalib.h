@@ -0,0 +1,175 @@
+// version: 1.0.0
+#pragma once
+
+#ifndef IMUCalib_H
+#define IMUCalib_H
+#include <stdint.h>
+#include <stddef.h>
+#include "IMUConvert.h"
+
+// バイアスの温度多項式の係数の数 (0次, 1次, 2次)
+#define IMU_CALIB_TEMP_TERMS 3
+
+/**
+ * @brief 3軸センサ1つ (加速度か角速度) の補正係数
+ * 補正後の値 = matrix * (raw - bias(T))
+ * bias(T) = bias[0] + bias[1] * dT + bias[2] * dT^2, dT = T - refTemp
+ * matrixはスケール (物理量/LSB) と軸のずれをまとめた3x3
+ * tools/imu_calib_fit.pyがタンブルテストの記録からこの形で出力する
+ */
+struct IMUCalibParams
+{
+    float bias[IMU_CALIB_TEMP_TERMS][3]; // [次数][軸] 生の値[LSB]
+    float matrix[3][3];                  // [出力の軸][生の値の軸] 物理量/LSB
+    float refTemp;                       // [℃]
+};
+
+/**
+ * @brief 3軸センサのバイアス、スケール、軸のずれと、バイアスの温度変化を補正する
+ * 温度はゆっくりしか変わらないので、setTemperature()で今の温度のときの
+ * out = A * raw + offset (Aとoffsetは温度込み) を作っておき、毎サンプルは掛け算9回と足し算だけにする
+ * applyBatch()はPCではIMUConvertと同じGCCのベクトル拡張で4フレームずつ処理する
+ * ESP32 (IMU_VECTOR_EXTが0のXtensa) ではapplyBatchScalarと同じスカラーのループになる
+ * (PIEにはfloatの演算がないので、実機ではまとめて呼んでも関数呼び出しが減るだけ)
+ * (～Scalarが基準 H3LIS331のように温度センサがないものは温度を変えなければよい)
+ * Arduinoに依存しないのでPC上でも使える
+ *
+ * ```cpp
+ * // example: ICM20602のFIFOのフレーム (accel, temp, gyro) をまとめて補正する
+ * IMUCalib accCal, gyroCal;
+ * accCal.setParams(accParams);  // imu_calib_fit.pyの出力
+ * gyroCal.setParams(gyroParams);
+ * IMUConvert::decodeBE16(rx_buf, raw, n * 7);
+ * float t = ICM20602::TempToCelsius(raw[3]);
+ * accCal.setTemperature(t);
+ * gyroCal.setTemperature(t);
+ * // 単位はimu_calib_fit.pyの--acc-unit, --gyro-unitで決まる (出力の先頭のunits:の行)
+ * // デフォルトはm/s^2とrad/s、--acc-unit g --gyro-unit dps (--selftestもこちら) ならGとdps
+ * accCal.applyBatch(raw, 7, acc, 3, n);
+ * gyroCal.applyBatch(raw + 4, 7, gyro, 3, n);
+ * ```
+ */
+class IMUCalib
+{
+private:
+    IMUCalibParams params = {};
+    float temperature = 0;
+    // 今の温度での out = a * raw + offset
+    float a[3][3] = {};
+    float offset[3] = {};
+    void update();
+
+public:
+    IMUCalib() { setScale(1.0f); }
+
+    void setParams(const IMUCalibParams &p);
+    const IMUCalibParams &getParams() const { return params; }
+    // 補正しない (スケールだけ) にする
+    void setScale(float unitPerLsb);
+
+    // 温度が変わったら呼ぶ (0.1℃程度変わるごとで十分)
+    void setTemperature(float tempC);
+    float getTemperature() const { return temperature; }
+
+    // 1サンプル raw[3] -> out[3]
+    void apply(const int16_t *raw, float *out) const;
+    /**
+     * @brief framesフレームをまとめて補正する
+     * @param[in] src 1フレーム目の3軸の先頭 (例: ICM20602のフレームの角速度ならraw + 4)
+     * @param[in] srcStride srcのフレームの間隔 (int16の個数)
+     * @param[out] dst 1フレーム目の出力の先頭
+     * @param[in] dstStride dstのフレームの間隔 (floatの個数)
+     */
+    void applyBatchScalar(const int16_t *src, size_t srcStride, float *dst, size_t dstStride, size_t frames) const;
+    void applyBatch(const int16_t *src, size_t srcStride, float *dst, size_t dstStride, size_t frames) const;
+};
+
+void IMUCalib::setParams(const IMUCalibParams &p)
+{
+    params = p;
+    update();
+}
+
+void IMUCalib::setScale(float unitPerLsb)
+{
+    params = {};
+    for (int i = 0; i < 3; i++)
+    {
+        params.matrix[i][i] = unitPerLsb;
+    }
+    params.refTemp = temperature;
+    update();
+}
+
+void IMUCalib::setTemperature(float tempC)
+{
+    temperature = tempC;
+    update();
+}
+
+void IMUCalib::update()
+{
+    float dT = temperature - params.refTemp;
+    float bias[3];
+    for (int i = 0; i < 3; i++)
+    {
+        bias[i] = params.bias[0][i] + (params.bias[1][i] + params.bias[2][i] * dT) * dT;
+    }
+    for (int r = 0; r < 3; r++)
+    {
+        offset[r] = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            a[r][c] = params.matrix[r][c];
+            offset[r] -= params.matrix[r][c] * bias[c];
+        }
+    }
+}
+
+void IMUCalib::apply(const int16_t *raw, float *out) const
+{
+    float x = raw[0], y = raw[1], z = raw[2];
+    for (int r = 0; r < 3; r++)
+    {
+        out[r] = a[r][0] * x + a[r][1] * y + a[r][2] * z + offset[r];
+    }
+}
+
+void IMUCalib::applyBatchScalar(const int16_t *src, size_t srcStride, float *dst, size_t dstStride, size_t frames) const
+{
+    for (size_t f = 0; f < frames; f++)
+    {
+        apply(src + f * srcStride, dst + f * dstStride);
+    }
+}
+
+void IMUCalib::applyBatch(const int16_t *src, size_t srcStride, float *dst, size_t dstStride, size_t frames) const
+{
+#if !IMU_VECTOR_EXT
+    applyBatchScalar(src, srcStride, dst, dstStride, frames);
+    return;
+#endif
+    const size_t s1 = srcStride, s2 = 2 * srcStride, s3 = 3 * srcStride;
+    const size_t d1 = dstStride, d2 = 2 * dstStride, d3 = 3 * dstStride;
+    size_t f = 0;
+    // 4フレームのx, y, zをそれぞれ1本のベクトルにして、行列の1行を4フレーム同時に計算する
+    for (; f + 4 <= frames; f += 4)
+    {
+        const int16_t *s = src + f * srcStride;
+        float *d = dst + f * dstStride;
+        imu_f32x4 x = {(float)s[0], (float)s[s1], (float)s[s2], (float)s[s3]};
+        imu_f32x4 y = {(float)s[1], (float)s[s1 + 1], (float)s[s2 + 1], (float)s[s3 + 1]};
+        imu_f32x4 z = {(float)s[2], (float)s[s1 + 2], (float)s[s2 + 2], (float)s[s3 + 2]};
+        for (int r = 0; r < 3; r++)
+        {
+            imu_f32x4 v = x * a[r][0] + y * a[r][1] + z * a[r][2] + offset[r];
+            d[r] = v[0];
+            d[d1 + r] = v[1];
+            d[d2 + r] = v[2];
+            d[d3 + r] = v[3];
+        }
+    }
+    applyBatchScalar(src + f * srcStride, srcStride, dst + f * dstStride, dstStride, frames - f);
+}
+
+#endif
@@ -0,0 +1,318 @@
+// version: 1.0.0
+#pragma once
+
+#ifndef IMUConvert_H
+#define IMUConvert_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+// 1フレームの値の数の最大 (ICM20602のFIFOフレームは7)
+#define IMU_MAX_CHANNELS 8
+// ベクトル版で1回に処理するフレーム数
+#define IMU_VECTOR_FRAMES 4
+
+// ベクトル版の実装の選び方 (-DIMU_CONVERT_PIE=0 等で変えられる)
+// IMU_CONVERT_PIE: ESP32-S3のPIE (128bitのSIMD命令) でbyteを入れ替える
+//   実機での確認 (examples/benchでmismatch:0) がまだなので、デフォルトは0 使うときは-DIMU_CONVERT_PIE=1
+//   PIEにはfloatの演算と16bit x 16bit -> 32bitの積がないので、toFloat/toFixedには使わない
+//   なので実機でSIMDを使うのはdecodeBE16のbyteの入れ替えだけ
+// IMU_VECTOR_EXT: GCCのベクトル拡張を使う PC (SSE/NEON) 向け
+//   XtensaではSIMDのレジスタを使わず1要素ずつに展開されて遅くなるので、スカラー版を使う
+#if defined(__XTENSA__) && defined(__has_include)
+#if __has_include(<sdkconfig.h>)
+#include <sdkconfig.h>
+#endif
+#endif
+#ifndef IMU_CONVERT_PIE
+#define IMU_CONVERT_PIE 0
+#endif
+#if IMU_CONVERT_PIE && !(defined(__XTENSA__) && defined(CONFIG_IDF_TARGET_ESP32S3))
+#error "IMU_CONVERT_PIE needs ESP32-S3"
+#endif
+#ifndef IMU_VECTOR_EXT
+#ifdef __XTENSA__
+#define IMU_VECTOR_EXT 0
+#else
+#define IMU_VECTOR_EXT 1
+#endif
+#endif
+
+/**
+ * @brief センサの生データをまとめてint16に並べ直し、物理量に変換する
+ * ICM20602/20948/42688の16bit big endian、H3LIS331の16bit little endianを扱う
+ * スカラー版(～Scalar)が基準で、ベクトル版は
+ *   PC: GCCのベクトル拡張 (SSE/NEON)
+ *   ESP32-S3: decodeBE16はIMU_CONVERT_PIEが1ならPIE (srcとdstが16byte境界のとき)、toFloat/toFixedはスカラー版
+ *   ESP32: decodeBE16は32bitずつ2個まとめて入れ替え、toFloat/toFixedはスカラー版
+ * PIEはISRの中では使えない (コプロセッサの切り替えがタスク単位のため)
+ * Arduinoに依存しないのでPC上でも使える
+ *
+ * ```cpp
+ * // example: ICM20602のFIFOのフレーム (accel, temp, gyro) をm/s^2, ℃, rad/sにする
+ * IMUConvert conv;
+ * const float scale[7] = {9.80665f / 2048, 9.80665f / 2048, 9.80665f / 2048, 1 / 326.8f,
+ *                         0.001065264f, 0.001065264f, 0.001065264f};
+ * const float offset[7] = {0, 0, 0, 25, 0, 0, 0};
+ * conv.setScale(scale, offset, 7);
+ * conv.decodeBE16(rx_buf, raw, n * 7);
+ * conv.toFloat(raw, si, n);
+ * ```
+ */
+class IMUConvert
+{
+private:
+    uint8_t channels = 0;
+    // IMU_VECTOR_FRAMESフレーム分並べたスケール (ベクトル版で使う)
+    float scalePattern[IMU_MAX_CHANNELS * IMU_VECTOR_FRAMES] = {};
+    float offsetPattern[IMU_MAX_CHANNELS * IMU_VECTOR_FRAMES] = {};
+    // 固定小数点用 out(Q16.16) = (raw * mult) >> shift + offsetQ16
+    // shiftは全チャンネル共通 (チャンネルごとに変えるとベクトルのシフトが遅い)
+    int32_t multPattern[IMU_MAX_CHANNELS * IMU_VECTOR_FRAMES] = {};
+    int32_t offsetQ16Pattern[IMU_MAX_CHANNELS * IMU_VECTOR_FRAMES] = {};
+    int shift = 0;
+
+public:
+    /**
+     * @brief 値1LSBあたりの物理量とオフセットを設定する 物理量 = raw * scale + offset
+     * @param[in] scale channels個
+     * @param[in] offset channels個 NULLなら0
+     * @param[in] channels 1フレームの値の数 (1 ~ IMU_MAX_CHANNELS)
+     * @retval false: channelsが範囲外、または|scale| >= 0.5 (固定小数点で表せない 物理量の1LSBはふつう十分小さい)
+     */
+    bool setScale(const float *scale, const float *offset, uint8_t channels);
+    uint8_t getChannels() { return channels; }
+
+    // big endianの16bitの値をcount個並べ直す
+    // ESP32-S3でPIEを使うには、srcとdstを16byte境界に置く (例: uint8_t buf[N] __attribute__((aligned(16))))
+    static void decodeBE16Scalar(const uint8_t *src, int16_t *dst, size_t count);
+    static void decodeBE16(const uint8_t *src, int16_t *dst, size_t count);
+    // little endian (H3LIS331)
+    static void decodeLE16Scalar(const uint8_t *src, int16_t *dst, size_t count);
+    static void decodeLE16(const uint8_t *src, int16_t *dst, size_t count);
+
+    // framesフレーム (frames * channels個) をfloatにする
+    void toFloatScalar(const int16_t *src, float *dst, size_t frames) const;
+    void toFloat(const int16_t *src, float *dst, size_t frames) const;
+    // Q16.16の固定小数点にする
+    // 誤差は (最大の|scale| / 各チャンネルの|scale|) / 16384 程度 (加速度と角速度なら0.02%程度)
+    void toFixedScalar(const int16_t *src, int32_t *dst, size_t frames) const;
+    void toFixed(const int16_t *src, int32_t *dst, size_t frames) const;
+};
+
+typedef uint16_t imu_u16x8 __attribute__((vector_size(16)));
+typedef int32_t imu_i32x4 __attribute__((vector_size(16)));
+typedef float imu_f32x4 __attribute__((vector_size(16)));
+
+bool IMUConvert::setScale(const float *scale, const float *offset, uint8_t ch)
+{
+    if (ch == 0 || ch > IMU_MAX_CHANNELS)
+    {
+        return false;
+    }
+    for (uint8_t c = 0; c < ch; c++)
+    {
+        if (!(fabsf(scale[c]) < 0.5f))
+        {
+            return false;
+        }
+    }
+    channels = ch;
+    // raw(16bit) * mult が31bitに収まるように、最大のmultを2^14 ~ 2^15にする
+    double maxQ = 0;
+    for (uint8_t c = 0; c < ch; c++)
+    {
+        double q = fabs((double)scale[c]) * 65536.0;
+        if (q > maxQ)
+        {
+            maxQ = q;
+        }
+    }
+    shift = 0;
+    while (maxQ != 0 && maxQ < 16384.0 && shift < 30)
+    {
+        maxQ *= 2;
+        shift++;
+    }
+    for (uint8_t c = 0; c < ch; c++)
+    {
+        float o = (offset != NULL) ? offset[c] : 0.0f;
+        int32_t mult = (int32_t)lrint((double)scale[c] * 65536.0 * (1 << shift));
+        for (int f = 0; f < IMU_VECTOR_FRAMES; f++)
+        {
+            int i = f * ch + c;
+            scalePattern[i] = scale[c];
+            offsetPattern[i] = o;
+            multPattern[i] = mult;
+            offsetQ16Pattern[i] = (int32_t)lrintf(o * 65536.0f);
+        }
+    }
+    return true;
+}
+
+void IMUConvert::decodeBE16Scalar(const uint8_t *src, int16_t *dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = (int16_t)(src[2 * i] << 8 | src[2 * i + 1]);
+    }
+}
+
+void IMUConvert::decodeLE16Scalar(const uint8_t *src, int16_t *dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = (int16_t)(src[2 * i + 1] << 8 | src[2 * i]);
+    }
+}
+
+#if IMU_CONVERT_PIE
+// 16byte (8個) ずつ、32bitのレーンごとに ((v << 8) & 0xFF00FF00) | ((v >> 8) & 0x00FF00FF)
+// srcとdstは16byte境界 (EE.VLD/VST.128は下位4bitを無視する)
+// EE.VSL.32/EE.VSR.32はSARをシフト量に使う
+static void imuDecodeBE16Pie(const uint8_t *src, int16_t *dst, size_t blocks)
+{
+    static const uint32_t masks[8] __attribute__((aligned(16))) = {
+        0xFF00FF00, 0xFF00FF00, 0xFF00FF00, 0xFF00FF00, 0x00FF00FF, 0x00FF00FF, 0x00FF00FF, 0x00FF00FF};
+    const uint32_t *m = masks;
+    asm volatile(
+        "ssai 8\n"
+        "ee.vld.128.ip q6, %[m], 16\n"
+        "ee.vld.128.ip q7, %[m], 16\n"
+        "beqz %[n], 2f\n"
+        "1:\n"
+        "ee.vld.128.ip q0, %[s], 16\n"
+        "ee.vsl.32 q1, q0\n"
+        "ee.vsr.32 q2, q0\n"
+        "ee.andq q1, q1, q6\n"
+        "ee.andq q2, q2, q7\n"
+        "ee.orq q0, q1, q2\n"
+        "ee.vst.128.ip q0, %[d], 16\n"
+        "addi %[n], %[n], -1\n"
+        "bnez %[n], 1b\n"
+        "2:\n"
+        : [s] "+r"(src), [d] "+r"(dst), [m] "+r"(m), [n] "+r"(blocks)
+        :
+        : "sar", "memory");
+}
+#endif
+
+void IMUConvert::decodeBE16(const uint8_t *src, int16_t *dst, size_t count)
+{
+    size_t i = 0;
+#if IMU_CONVERT_PIE
+    if ((((uintptr_t)src | (uintptr_t)dst) & 15) == 0)
+    {
+        i = count & ~(size_t)7;
+        imuDecodeBE16Pie(src, dst, i / 8);
+    }
+#elif IMU_VECTOR_EXT
+    // 8個ずつ上位と下位のbyteを入れ替える (バッファのアラインメントは問わない)
+    for (; i + 8 <= count; i += 8)
+    {
+        imu_u16x8 v;
+        memcpy(&v, src + 2 * i, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        v = (v << 8) | (v >> 8);
+#endif
+        memcpy(dst + i, &v, sizeof(v));
+    }
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // 32bitの中の2個をまとめて入れ替える
+    for (; i + 2 <= count; i += 2)
+    {
+        uint32_t v;
+        memcpy(&v, src + 2 * i, sizeof(v));
+        v = ((v << 8) & 0xFF00FF00) | ((v >> 8) & 0x00FF00FF);
+        memcpy(dst + i, &v, sizeof(v));
+    }
+#endif
+    decodeBE16Scalar(src + 2 * i, dst + i, count - i);
+}
+
+void IMUConvert::decodeLE16(const uint8_t *src, int16_t *dst, size_t count)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(dst, src, count * 2);
+#else
+    decodeLE16Scalar(src, dst, count);
+#endif
+}
+
+void IMUConvert::toFloatScalar(const int16_t *src, float *dst, size_t frames) const
+{
+    for (size_t f = 0; f < frames; f++)
+    {
+        for (uint8_t c = 0; c < channels; c++)
+        {
+            size_t i = f * channels + c;
+            dst[i] = src[i] * scalePattern[c] + offsetPattern[c];
+        }
+    }
+}
+
+void IMUConvert::toFixedScalar(const int16_t *src, int32_t *dst, size_t frames) const
+{
+    for (size_t f = 0; f < frames; f++)
+    {
+        for (uint8_t c = 0; c < channels; c++)
+        {
+            size_t i = f * channels + c;
+            dst[i] = ((src[i] * multPattern[c]) >> shift) + offsetQ16Pattern[c];
+        }
+    }
+}
+
+// IMU_VECTOR_FRAMESフレームはchannels * 4個の値なので、4個ずつのベクトルでちょうど割り切れる
+void IMUConvert::toFloat(const int16_t *src, float *dst, size_t frames) const
+{
+#if !IMU_VECTOR_EXT
+    toFloatScalar(src, dst, frames);
+    return;
+#endif
+    const size_t block = (size_t)channels * IMU_VECTOR_FRAMES;
+    size_t f = 0;
+    for (; f + IMU_VECTOR_FRAMES <= frames; f += IMU_VECTOR_FRAMES)
+    {
+        const int16_t *s = src + f * channels;
+        float *d = dst + f * channels;
+        for (size_t i = 0; i < block; i += 4)
+        {
+            imu_f32x4 x = {(float)s[i], (float)s[i + 1], (float)s[i + 2], (float)s[i + 3]};
+            imu_f32x4 k, o;
+            memcpy(&k, scalePattern + i, sizeof(k));
+            memcpy(&o, offsetPattern + i, sizeof(o));
+            x = x * k + o;
+            memcpy(d + i, &x, sizeof(x));
+        }
+    }
+    toFloatScalar(src + f * channels, dst + f * channels, frames - f);
+}
+
+void IMUConvert::toFixed(const int16_t *src, int32_t *dst, size_t frames) const
+{
+#if !IMU_VECTOR_EXT
+    toFixedScalar(src, dst, frames);
+    return;
+#endif
+    const size_t block = (size_t)channels * IMU_VECTOR_FRAMES;
+    size_t f = 0;
+    for (; f + IMU_VECTOR_FRAMES <= frames; f += IMU_VECTOR_FRAMES)
+    {
+        const int16_t *s = src + f * channels;
+        int32_t *d = dst + f * channels;
+        for (size_t i = 0; i < block; i += 4)
+        {
+            imu_i32x4 x = {s[i], s[i + 1], s[i + 2], s[i + 3]};
+            imu_i32x4 m, o;
+            memcpy(&m, multPattern + i, sizeof(m));
+            memcpy(&o, offsetQ16Pattern + i, sizeof(o));
+            x = ((x * m) >> shift) + o;
+            memcpy(d + i, &x, sizeof(x));
+        }
+    }
+    toFixedScalar(src + f * channels, dst + f * channels, frames - f);
+}
+
+#endif
@@ -0,0 +1,488 @@
+// version: 1.0.0
+#pragma once
+
+#ifndef IMUVote_H
+#define IMUVote_H
+#include <stdint.h>
+#include <math.h>
+#include "IMUBase.h"
+
+// 多数決にかけるIMUの数の最大
+#define IMU_VOTE_MAX_IMUS 4
+
+// IMUVoteResult::accSource, gyroSourceのビット
+// bit 0~3: 使ったIMUの番号, IMU_VOTE_SRC_HIGHG: 高G加速度計(H3LIS331)の値を使った
+#define IMU_VOTE_SRC_HIGHG 0x80
+
+// IMUVoteResult::flags
+#define IMU_VOTE_ACC_INVALID 0x01   // 加速度を決められなかった軸がある (前の値のまま)
+#define IMU_VOTE_GYRO_INVALID 0x02  // 角速度を決められなかった軸がある (前の値のまま)
+#define IMU_VOTE_GYRO_SATURATED 0x04 // 角速度が振り切れている軸がある (フルスケールの値を出す)
+#define IMU_VOTE_DISAGREE 0x08      // 残ったIMUが2つで、値が食い違っている (どちらが正しいか決められないので平均)
+#define IMU_VOTE_HIGHG 0x10         // 高G加速度計に切り替えている軸がある
+
+/**
+ * 多数決の結果 加速度はG、角速度はdps
+ */
+struct IMUVoteResult
+{
+    float acc[3];
+    float gyro[3];
+    uint8_t accSource[3];
+    uint8_t gyroSource[3];
+    uint8_t flags;
+    int64_t timestamp; // 使ったサンプルのうち最初のIMUのもの
+};
+
+/**
+ * @brief 冗長なIMUの値を比べて1つの値にする Arduinoに依存しないのでPC上でも使える
+ * 軸ごと(加速度3軸、角速度3軸)に、使えるIMUの値を集めて
+ *   3つ以上: 中央値からaccTolerance/gyroToleranceより離れた値を外して平均
+ *   2つ: 平均 (離れていればIMU_VOTE_DISAGREE)
+ *   1つ: その値
+ * にする
+ *
+ * 使えない値
+ *   振り切れ: |生の値| >= saturationRaw
+ *   固着: 同じ生の値がstuckSamples回続いた (値が変われば戻る)
+ *   読み出し失敗: update()のvalidMaskでビットが0のIMU
+ *   隔離: 3つ以上で多数決をした結果から外れた回数が、合った回数よりisolateSamples回多くなった
+ *         隔離した後は、残りのIMUの結果と合うことがisolateSamples回続けば戻す
+ *
+ * ICMの加速度が振り切れて使えるIMUがなくなった軸は、高G加速度計(H3LIS331 ±400G)の値に切り替える
+ * 振り切れが終わってもhighGHoldSamples回の間は高G加速度計のままにして、範囲の境目で行ったり来たりしないようにする
+ *
+ * 値は全部同じ座標系(ボードの軸)に揃えてから渡すこと
+ * 1回のupdate()はIMU 4つで数百サイクル程度なので、1kHzの周期に十分収まる (examples/voteで測れる)
+ *
+ * ```cpp
+ * // example
+ * IMUVote vote;
+ * vote.setIMU(0, icm20602.accelLsbPerG(), icm20602.gyroLsbPerDps());
+ * vote.setIMU(1, icm20948.accelLsbPerG(), icm20948.gyroLsbPerDps());
+ * vote.setIMU(2, icm42688.accelLsbPerG(), icm42688.gyroLsbPerDps());
+ * vote.setHighG(16.0f / 0.195f); // H3LIS331 400G (12bit左詰め)
+ *
+ * IMUSample samples[3];
+ * int16_t highG[3];
+ * bool ok = IMUSweep(samples, icm20602, icm20948, icm42688);
+ * H3lis331.Get(highG);
+ * IMUVoteResult result;
+ * vote.update(samples, ok ? 0xFF : 0x00, highG, &result); // 読み出しに失敗したIMUがわかるなら、そのビットを0にする
+ * ```
+ */
+class IMUVote
+{
+private:
+    uint8_t imuCount = 0;
+    float accScale[IMU_VOTE_MAX_IMUS] = {};  // 1LSBあたりのG
+    float gyroScale[IMU_VOTE_MAX_IMUS] = {}; // 1LSBあたりのdps
+    float highGScale = 0;
+
+    // チャンネル0~2: 加速度, 3~5: 角速度
+    int16_t lastRaw[IMU_VOTE_MAX_IMUS][6] = {};
+    uint16_t sameCount[IMU_VOTE_MAX_IMUS][6] = {};
+    uint16_t outlierScore[IMU_VOTE_MAX_IMUS][6] = {};
+    int16_t highGLastRaw[3] = {};
+    uint16_t highGSameCount[3] = {};
+    uint16_t highGHold[3] = {};
+    uint8_t faults[IMU_VOTE_MAX_IMUS] = {};
+    float fused[6] = {};
+
+    float vote(uint8_t n, const float *values, const uint8_t *index, uint8_t *source, bool *disagree, float tolerance) const;
+
+public:
+    uint16_t stuckSamples = 50;
+    int16_t saturationRaw = 32000;
+    float accTolerance = 0.5f;
+    float gyroTolerance = 20.0f;
+    uint16_t isolateSamples = 20; // 1 ~ 32767
+    uint16_t highGHoldSamples = 20;
+
+    // 故障の回数 (サンプル数)
+    uint32_t stuckCount[IMU_VOTE_MAX_IMUS] = {};
+    uint32_t saturatedCount[IMU_VOTE_MAX_IMUS] = {};
+    uint32_t outlierCount[IMU_VOTE_MAX_IMUS] = {};
+    uint32_t readFailCount[IMU_VOTE_MAX_IMUS] = {};
+    uint32_t highGCount = 0;
+    uint32_t highGStuckCount = 0;
+    uint32_t invalidCount = 0;
+
+    /**
+     * @brief IMUを登録する 0から順に登録し、update()のsamplesも同じ順に並べる
+     * @param[in] index 0 ~ IMU_VOTE_MAX_IMUS-1
+     * @param[in] accLsbPerG, gyroLsbPerDps 各ドライバのaccelLsbPerG(), gyroLsbPerDps()
+     * @retval false: indexが範囲外、または係数が0以下
+     */
+    bool setIMU(uint8_t index, float accLsbPerG, float gyroLsbPerDps);
+    // 高G加速度計の1GあたりのLSB 0なら使わない
+    void setHighG(float lsbPerG) { highGScale = (lsbPerG > 0) ? 1.0f / lsbPerG : 0; }
+    // 故障の状態と回数を消す (IMUの登録はそのまま)
+    void reset();
+
+    /**
+     * @brief 1サンプル分の多数決をする
+     * @param[in] samples 登録したIMUの数
+     * @param[in] validMask 読み出しに成功したIMUのビット
+     * @param[in] highG 高G加速度計の生の値 3軸 NULLなら使わない
+     * @param[out] result
+     * @retval false: 決められなかった軸がある
+     */
+    bool update(const IMUSample *samples, uint8_t validMask, const int16_t *highG, IMUVoteResult *result);
+
+    // 直前のupdate()で外したチャンネルのビット (bit 0~2: 加速度, 3~5: 角速度)
+    uint8_t faultMask(uint8_t index) const { return (index < IMU_VOTE_MAX_IMUS) ? faults[index] : 0; }
+    bool isIsolated(uint8_t index, uint8_t channel) const
+    {
+        return index < IMU_VOTE_MAX_IMUS && channel < 6 && outlierScore[index][channel] >= isolateSamples;
+    }
+};
+
+bool IMUVote::setIMU(uint8_t index, float accLsbPerG, float gyroLsbPerDps)
+{
+    if (index >= IMU_VOTE_MAX_IMUS || !(accLsbPerG > 0) || !(gyroLsbPerDps > 0))
+    {
+        return false;
+    }
+    accScale[index] = 1.0f / accLsbPerG;
+    gyroScale[index] = 1.0f / gyroLsbPerDps;
+    if (index >= imuCount)
+    {
+        imuCount = index + 1;
+    }
+    return true;
+}
+
+void IMUVote::reset()
+{
+    for (uint8_t i = 0; i < IMU_VOTE_MAX_IMUS; i++)
+    {
+        for (uint8_t c = 0; c < 6; c++)
+        {
+            lastRaw[i][c] = 0;
+            sameCount[i][c] = 0;
+            outlierScore[i][c] = 0;
+        }
+        faults[i] = 0;
+        stuckCount[i] = 0;
+        saturatedCount[i] = 0;
+        outlierCount[i] = 0;
+        readFailCount[i] = 0;
+    }
+    for (uint8_t c = 0; c < 3; c++)
+    {
+        highGLastRaw[c] = 0;
+        highGSameCount[c] = 0;
+        highGHold[c] = 0;
+    }
+    for (uint8_t c = 0; c < 6; c++)
+    {
+        fused[c] = 0;
+    }
+    highGCount = 0;
+    highGStuckCount = 0;
+    invalidCount = 0;
+}
+
+// n(1~IMU_VOTE_MAX_IMUS)個の値から1つの値を決める
+float IMUVote::vote(uint8_t n, const float *values, const uint8_t *index, uint8_t *source, bool *disagree, float tolerance) const
+{
+    if (n == 1)
+    {
+        *source = 1 << index[0];
+        return values[0];
+    }
+    if (n == 2)
+    {
+        *source = (1 << index[0]) | (1 << index[1]);
+        if (fabsf(values[0] - values[1]) > tolerance)
+        {
+            *disagree = true;
+        }
+        return (values[0] + values[1]) * 0.5f;
+    }
+    // 3つ以上: 挿入ソートで中央値を出す (4つなら真ん中2つの平均)
+    float sorted[IMU_VOTE_MAX_IMUS] = {};
+    for (uint8_t k = 0; k < n; k++)
+    {
+        float v = values[k];
+        int8_t j = k - 1;
+        while (j >= 0 && sorted[j] > v)
+        {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = v;
+    }
+    float median = (n & 1) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) * 0.5f;
+    float sum = 0;
+    uint8_t used = 0;
+    *source = 0;
+    for (uint8_t k = 0; k < n; k++)
+    {
+        if (fabsf(values[k] - median) <= tolerance)
+        {
+            sum += values[k];
+            used++;
+            *source |= 1 << index[k];
+        }
+    }
+    if (used == 0)
+    {
+        // 全部ばらばら
+        *disagree = true;
+        for (uint8_t k = 0; k < n; k++)
+        {
+            *source |= 1 << index[k];
+        }
+        return median;
+    }
+    return sum / used;
+}
+
+bool IMUVote::update(const IMUSample *samples, uint8_t validMask, const int16_t *highG, IMUVoteResult *result)
+{
+    bool ok = true;
+    bool timestampSet = false;
+    result->flags = 0;
+    result->timestamp = 0;
+
+    // 値を取り出して、固着と振り切れを調べる
+    float values[6][IMU_VOTE_MAX_IMUS];
+    uint8_t index[6][IMU_VOTE_MAX_IMUS];
+    uint8_t usable[6] = {};
+    uint8_t saturated[6] = {}; // 振り切れていたIMUのビット
+    int8_t saturatedSign[6] = {};
+    for (uint8_t i = 0; i < imuCount; i++)
+    {
+        faults[i] = 0;
+        if (!(validMask & (1 << i)))
+        {
+            faults[i] = 0x3F;
+            readFailCount[i]++;
+            continue;
+        }
+        if (!timestampSet)
+        {
+            result->timestamp = samples[i].timestamp;
+            timestampSet = true;
+        }
+        bool stuck = false;
+        bool sat = false;
+        for (uint8_t c = 0; c < 6; c++)
+        {
+            int16_t raw = (c < 3) ? samples[i].acc[c] : samples[i].gyro[c - 3];
+            if (raw >= saturationRaw || raw <= -saturationRaw)
+            {
+                // 振り切れた値は変わらないのがふつうなので、固着とは数えない
+                sameCount[i][c] = 0;
+                lastRaw[i][c] = raw;
+                saturated[c] |= 1 << i;
+                saturatedSign[c] = (raw > 0) ? 1 : -1;
+                faults[i] |= 1 << c;
+                sat = true;
+                continue;
+            }
+            if (raw == lastRaw[i][c])
+            {
+                if (sameCount[i][c] < 0xFFFF)
+                {
+                    sameCount[i][c]++;
+                }
+            }
+            else
+            {
+                sameCount[i][c] = 0;
+                lastRaw[i][c] = raw;
+            }
+            if (sameCount[i][c] >= stuckSamples)
+            {
+                faults[i] |= 1 << c;
+                stuck = true;
+                continue;
+            }
+            float v = raw * ((c < 3) ? accScale[i] : gyroScale[i]);
+            // 隔離中の値も、戻せるかどうか調べるために結果と比べる
+            if (outlierScore[i][c] >= isolateSamples)
+            {
+                faults[i] |= 1 << c;
+                continue;
+            }
+            values[c][usable[c]] = v;
+            index[c][usable[c]] = i;
+            usable[c]++;
+        }
+        if (stuck)
+        {
+            stuckCount[i]++;
+        }
+        if (sat)
+        {
+            saturatedCount[i]++;
+        }
+    }
+
+    // 高G加速度計
+    float highGValue[3] = {};
+    bool highGUsable[3] = {};
+    if (highG != NULL && highGScale != 0)
+    {
+        bool stuck = false;
+        for (uint8_t c = 0; c < 3; c++)
+        {
+            if (highG[c] == highGLastRaw[c])
+            {
+                if (highGSameCount[c] < 0xFFFF)
+                {
+                    highGSameCount[c]++;
+                }
+            }
+            else
+            {
+                highGSameCount[c] = 0;
+                highGLastRaw[c] = highG[c];
+            }
+            if (highGSameCount[c] >= stuckSamples)
+            {
+                stuck = true;
+                continue;
+            }
+            highGValue[c] = highG[c] * highGScale;
+            highGUsable[c] = true;
+        }
+        if (stuck)
+        {
+            highGStuckCount++;
+        }
+    }
+
+    bool highGUsed = false;
+    for (uint8_t c = 0; c < 6; c++)
+    {
+        bool isAcc = c < 3;
+        uint8_t *source = isAcc ? &result->accSource[c] : &result->gyroSource[c - 3];
+        bool disagree = false;
+        *source = 0;
+
+        if (isAcc)
+        {
+            // 振り切れて使える値がなくなったら、しばらく高G加速度計にする
+            if (saturated[c] != 0 && usable[c] == 0)
+            {
+                highGHold[c] = highGHoldSamples;
+            }
+            else if (highGHold[c] > 0)
+            {
+                highGHold[c]--;
+            }
+            if (highGHold[c] > 0 && highGUsable[c])
+            {
+                fused[c] = highGValue[c];
+                *source = IMU_VOTE_SRC_HIGHG;
+                highGUsed = true;
+                continue;
+            }
+        }
+
+        if (usable[c] > 0)
+        {
+            fused[c] = vote(usable[c], values[c], index[c], source, &disagree, isAcc ? accTolerance : gyroTolerance);
+            if (disagree)
+            {
+                result->flags |= IMU_VOTE_DISAGREE;
+            }
+        }
+        else if (isAcc && highGUsable[c])
+        {
+            // 振り切れ以外の理由(固着、読み出し失敗)でICMが全滅したとき
+            fused[c] = highGValue[c];
+            *source = IMU_VOTE_SRC_HIGHG;
+            highGUsed = true;
+        }
+        else if (saturated[c] != 0)
+        {
+            // 振り切れていることだけはわかるので、フルスケールの値を出す
+            uint8_t i = 0;
+            while (!(saturated[c] & (1 << i)))
+            {
+                i++;
+            }
+            fused[c] = saturatedSign[c] * saturationRaw * (isAcc ? accScale[i] : gyroScale[i]);
+            *source = saturated[c];
+            result->flags |= isAcc ? IMU_VOTE_ACC_INVALID : IMU_VOTE_GYRO_SATURATED;
+            ok = ok && !isAcc;
+        }
+        else
+        {
+            result->flags |= isAcc ? IMU_VOTE_ACC_INVALID : IMU_VOTE_GYRO_INVALID;
+            ok = false;
+        }
+    }
+    if (highGUsed)
+    {
+        result->flags |= IMU_VOTE_HIGHG;
+        highGCount++;
+    }
+    if (!ok)
+    {
+        invalidCount++;
+    }
+
+    // 結果から外れた値を数えて、続いたら隔離する
+    for (uint8_t i = 0; i < imuCount; i++)
+    {
+        if (!(validMask & (1 << i)))
+        {
+            continue;
+        }
+        bool outlier = false;
+        for (uint8_t c = 0; c < 6; c++)
+        {
+            int16_t raw = (c < 3) ? samples[i].acc[c] : samples[i].gyro[c - 3];
+            if (sameCount[i][c] >= stuckSamples || raw >= saturationRaw || raw <= -saturationRaw)
+            {
+                continue;
+            }
+            const uint8_t *source = (c < 3) ? &result->accSource[c] : &result->gyroSource[c - 3];
+            if (*source & IMU_VOTE_SRC_HIGHG)
+            {
+                // 高G加速度計は分解能が粗いので、比べない
+                continue;
+            }
+            // 2つ以下ではどちらが外れているか決められないので、隔離中の値を戻すときだけ比べる
+            bool isolated = outlierScore[i][c] >= isolateSamples;
+            if (usable[c] == 0 || (!isolated && usable[c] < 3))
+            {
+                continue;
+            }
+            float v = raw * ((c < 3) ? accScale[i] : gyroScale[i]);
+            if (fabsf(v - fused[c]) > ((c < 3) ? accTolerance : gyroTolerance))
+            {
+                // isolateSamplesに届いたら、戻すまでにisolateSamples回合う必要があるように積み増す
+                outlierScore[i][c]++;
+                if (outlierScore[i][c] >= isolateSamples)
+                {
+                    outlierScore[i][c] = 2 * isolateSamples - 1;
+                }
+                outlier = true;
+            }
+            else if (outlierScore[i][c] > 0)
+            {
+                outlierScore[i][c]--;
+            }
+        }
+        if (outlier)
+        {
+            outlierCount[i]++;
+        }
+    }
+
+    for (uint8_t c = 0; c < 3; c++)
+    {
+        result->acc[c] = fused[c];
+        result->gyro[c] = fused[c + 3];
+    }
+    return ok;
+}
+
+#endif
@@ -0,0 +1,429 @@
+#!/usr/bin/env python3
+"""タンブルテストの記録からIMUCalibの補正係数 (IMUCalibParams) を求める
+
+入力はCSV t_us,ax,ay,az,gx,gy,gz,temp (生の値、ICM20602 examples/calib_record の出力)
+1行目が見出しなら読み飛ばす。数字で始まらない行 (起動時のメッセージなど) も読み飛ばす。
+
+求めるもの
+  加速度: 静止している区間の加速度の大きさが1Gになるように
+          バイアス(温度多項式)と上三角のスケール/軸のずれの行列を求める
+          (上三角にするのは、向きを回しても大きさは変わらず行列が1つに決まらないため
+           x軸はセンサのx軸、y軸はxy平面に合わせる)
+  角速度: 静止区間の平均からバイアスの温度多項式を求め、
+          静止区間の間を角速度で積分した回転が、前後の静止区間の重力の向きの変化と合うように
+          3x3の行列 (スケールと加速度の軸に対するずれ) を求める
+温度の次数は記録の温度の幅から決める (3℃未満は0次、10℃未満は1次、それ以上は2次)
+
+標準ライブラリだけで動く
+  python3 imu_calib_fit.py tumble.csv > calib.h
+  python3 imu_calib_fit.py --selftest    # 係数の分かっている記録を作って求め直す
+"""
+
+import argparse
+import math
+import random
+import sys
+
+G = 9.80665
+
+
+# ---- 行列の計算 (小さいので素直に書く) ----
+
+def solve(a, b):
+    """a x = b を部分ピボットのガウスの消去法で解く"""
+    n = len(b)
+    m = [row[:] + [b[i]] for i, row in enumerate(a)]
+    for c in range(n):
+        p = max(range(c, n), key=lambda r: abs(m[r][c]))
+        if abs(m[p][c]) < 1e-300:
+            raise ValueError("singular matrix")
+        m[c], m[p] = m[p], m[c]
+        for r in range(c + 1, n):
+            k = m[r][c] / m[c][c]
+            if k != 0.0:
+                for j in range(c, n + 1):
+                    m[r][j] -= k * m[c][j]
+    x = [0.0] * n
+    for c in range(n - 1, -1, -1):
+        x[c] = (m[c][n] - sum(m[c][j] * x[j] for j in range(c + 1, n))) / m[c][c]
+    return x
+
+
+def least_squares(f, p0, steps, iterations=30):
+    """残差f(p)の2乗和を最小にする (数値微分のレーベンバーグ・マーカート法)
+    stepsは各パラメータの数値微分の幅"""
+    p = list(p0)
+    r = f(p)
+    cost = sum(v * v for v in r)
+    lam = 1e-3
+    for _ in range(iterations):
+        jac = []
+        for i, h in enumerate(steps):
+            q = p[:]
+            q[i] += h
+            jac.append([(v - w) / h for v, w in zip(f(q), r)])
+        n = len(p)
+        jtj = [[sum(jac[i][k] * jac[j][k] for k in range(len(r))) for j in range(n)] for i in range(n)]
+        jtr = [sum(jac[i][k] * r[k] for k in range(len(r))) for i in range(n)]
+        improved = False
+        while lam < 1e12:
+            a = [[jtj[i][j] + (lam * jtj[i][i] if i == j else 0.0) for j in range(n)] for i in range(n)]
+            try:
+                d = solve(a, [-v for v in jtr])
+            except ValueError:
+                lam *= 10
+                continue
+            q = [v + w for v, w in zip(p, d)]
+            rq = f(q)
+            cq = sum(v * v for v in rq)
+            if cq < cost:
+                done = cost - cq < 1e-12 * (cost + 1e-30)
+                p, r, cost = q, rq, cq
+                lam = max(lam / 10, 1e-9)
+                improved = True
+                break
+            lam *= 10
+        if not improved or done:
+            break
+    return p, cost
+
+
+def mat_vec(m, v):
+    return [m[i][0] * v[0] + m[i][1] * v[1] + m[i][2] * v[2] for i in range(3)]
+
+
+def mat_inv(m):
+    cols = [solve(m, [1.0 if i == j else 0.0 for i in range(3)]) for j in range(3)]
+    return [[cols[j][i] for j in range(3)] for i in range(3)]
+
+
+def normalize(v):
+    n = math.sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2])
+    return [x / n for x in v]
+
+
+def quat_mul(a, b):
+    return [a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3],
+            a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2],
+            a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1],
+            a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0]]
+
+
+def quat_step(q, w, dt):
+    """角速度w[rad/s]でdt回した姿勢 (機体座標で回す)"""
+    angle = math.sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]) * dt
+    if angle < 1e-12:
+        return q
+    s = math.sin(angle / 2) / (angle / dt)
+    return quat_mul(q, [math.cos(angle / 2), w[0] * s, w[1] * s, w[2] * s])
+
+
+def rotate_inv(q, v):
+    """q* v q (前の座標のベクトルvを今の機体座標で見る)"""
+    qc = [q[0], -q[1], -q[2], -q[3]]
+    r = quat_mul(quat_mul(qc, [0.0] + list(v)), q)
+    return r[1:]
+
+
+# ---- 記録 ----
+
+def read_csv(path):
+    rows = []
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line or not (line[0].isdigit() or line[0] == '-'):
+                continue
+            v = line.split(',')
+            if len(v) < 8:
+                continue
+            try:
+                rows.append([int(x) for x in v[:8]])
+            except ValueError:
+                continue
+    return rows
+
+
+def find_static(rows, rate, acc_lsb, gyro_lsb, window_s=0.25, min_s=1.0, acc_tol_g=0.02, gyro_tol_dps=1.5):
+    """静止している区間 [(開始, 終わり)] を探す 窓ごとの標準偏差で判定する"""
+    w = max(4, int(window_s * rate))
+    static = []
+    for start in range(0, len(rows) - w + 1, w):
+        block = rows[start:start + w]
+        ok = True
+        for axis, tol in ((1, acc_tol_g * acc_lsb), (2, acc_tol_g * acc_lsb), (3, acc_tol_g * acc_lsb),
+                          (4, gyro_tol_dps * gyro_lsb), (5, gyro_tol_dps * gyro_lsb), (6, gyro_tol_dps * gyro_lsb)):
+            mean = sum(r[axis] for r in block) / w
+            var = sum((r[axis] - mean) ** 2 for r in block) / w
+            if var > tol * tol:
+                ok = False
+                break
+        static.append(ok)
+    intervals = []
+    i = 0
+    while i < len(static):
+        if not static[i]:
+            i += 1
+            continue
+        j = i
+        while j < len(static) and static[j]:
+            j += 1
+        # 両端の窓は動き始め、止まりかけを含むことがあるので1つずつ削る
+        begin, end = (i + 1) * w, (j - 1) * w
+        if end - begin >= min_s * rate:
+            intervals.append((begin, end))
+        i = j
+    return intervals
+
+
+def poly(coef, dt):
+    return coef[0] + coef[1] * dt + coef[2] * dt * dt
+
+
+# ---- 推定 ----
+
+def fit(rows, args):
+    n = len(rows)
+    if n < 100:
+        raise SystemExit("too few samples: %d" % n)
+    rate = (n - 1) / ((rows[-1][0] - rows[0][0]) * 1e-6)
+    temps = [r[7] / args.temp_lsb + args.temp_offset for r in rows]
+    intervals = find_static(rows, rate, args.acc_lsb, args.gyro_lsb)
+    if len(intervals) < 9:
+        raise SystemExit("only %d static poses found (need 9 or more, 12~20 recommended)" % len(intervals))
+
+    poses = []
+    for begin, end in intervals:
+        m = end - begin
+        poses.append({
+            'begin': begin, 'end': end,
+            'acc': [sum(rows[k][1 + a] for k in range(begin, end)) / m for a in range(3)],
+            'gyro': [sum(rows[k][4 + a] for k in range(begin, end)) / m for a in range(3)],
+            'temp': sum(temps[begin:end]) / m,
+        })
+    t_min = min(p['temp'] for p in poses)
+    t_max = max(p['temp'] for p in poses)
+    ref_temp = round(sum(p['temp'] for p in poses) / len(poses), 1)
+    order = args.temp_order
+    if order is None:
+        span = t_max - t_min
+        order = 0 if span < 3 else (1 if span < 10 else 2)
+    order = min(order, 2)
+
+    # 角速度のバイアス: 軸ごとに静止区間の平均を温度の多項式で近似する
+    gyro_bias = [[0.0] * 3 for _ in range(3)]
+    terms = order + 1
+    for axis in range(3):
+        ata = [[0.0] * terms for _ in range(terms)]
+        atb = [0.0] * terms
+        for p in poses:
+            dt = p['temp'] - ref_temp
+            basis = [dt ** k for k in range(terms)]
+            for i in range(terms):
+                atb[i] += basis[i] * p['gyro'][axis]
+                for j in range(terms):
+                    ata[i][j] += basis[i] * basis[j]
+        c = solve(ata, atb)
+        for k in range(terms):
+            gyro_bias[k][axis] = c[k]
+
+    # 加速度: p = バイアス (次数ごとに3個) + 上三角の補正 (6個)
+    # 行列 = diag(1/acc_lsb) * (I + E) [G/LSB]
+    upper = [(0, 0), (0, 1), (0, 2), (1, 1), (1, 2), (2, 2)]
+
+    def acc_model(p):
+        bias = [[p[3 * k + a] if k < terms else 0.0 for a in range(3)] for k in range(3)]
+        e = p[3 * terms:]
+        m = [[0.0] * 3 for _ in range(3)]
+        for (i, j), v in zip(upper, e):
+            m[i][j] = ((1.0 if i == j else 0.0) + v) / args.acc_lsb
+        return bias, m
+
+    def acc_vector(bias, m, raw, temp):
+        dt = temp - ref_temp
+        return mat_vec(m, [raw[a] - poly([bias[0][a], bias[1][a], bias[2][a]], dt) for a in range(3)])
+
+    def acc_residual(p):
+        bias, m = acc_model(p)
+        res = []
+        for pose in poses:
+            v = acc_vector(bias, m, pose['acc'], pose['temp'])
+            res.append(math.sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]) - 1.0)
+        return res
+
+    p0 = [0.0] * (3 * terms + 6)
+    steps = [1e-2] * (3 * terms) + [1e-6] * 6
+    p, cost = least_squares(acc_residual, p0, steps)
+    acc_bias, acc_m = acc_model(p)
+    acc_rms = math.sqrt(cost / len(poses))
+    for pose in poses:
+        pose['up'] = normalize(acc_vector(acc_bias, acc_m, pose['acc'], pose['temp']))
+
+    # 角速度の行列: 隣り合う静止区間の間を積分して、重力の向きの変化と合わせる
+    # 静止区間の中ほどから次の静止区間の中ほどまで (静止している部分はバイアスを引けばほぼ0)
+    seg = []
+    for a, b in zip(poses, poses[1:]):
+        start = (a['begin'] + a['end']) // 2
+        stop = (b['begin'] + b['end']) // 2
+        if (rows[stop][0] - rows[start][0]) * 1e-6 > args.max_gap:
+            continue
+        samples = []
+        for k in range(start, stop):
+            dt = (rows[k + 1][0] - rows[k][0]) * 1e-6
+            d = temps[k] - ref_temp
+            samples.append(([rows[k][4 + ax] - poly([gyro_bias[0][ax], gyro_bias[1][ax], gyro_bias[2][ax]], d)
+                             for ax in range(3)], dt))
+        seg.append((a['up'], b['up'], samples))
+    if len(seg) < 3:
+        raise SystemExit("only %d rotations between static poses (need 3 or more)" % len(seg))
+    k_rad = math.pi / 180 / args.gyro_lsb
+
+    def gyro_matrix(e):
+        return [[((1.0 if i == j else 0.0) + e[3 * i + j]) * k_rad for j in range(3)] for i in range(3)]
+
+    def gyro_residual(e):
+        m = gyro_matrix(e)
+        res = []
+        for up0, up1, samples in seg:
+            q = [1.0, 0.0, 0.0, 0.0]
+            for raw, dt in samples:
+                q = quat_step(q, mat_vec(m, raw), dt)
+            pred = rotate_inv(q, up0)
+            res.extend(pred[i] - up1[i] for i in range(3))
+        return res
+
+    e, gcost = least_squares(gyro_residual, [0.0] * 9, [1e-5] * 9, iterations=15)
+    gyro_m = gyro_matrix(e)
+    gyro_rms = math.degrees(math.sqrt(gcost / len(seg)))
+
+    acc_unit = G if args.acc_unit == 'mps2' else 1.0
+    gyro_unit = 1.0 if args.gyro_unit == 'rads' else 180 / math.pi
+    return {
+        'rate': rate, 'poses': len(poses), 'rotations': len(seg), 'order': order,
+        'temp_range': (t_min, t_max), 'ref_temp': ref_temp,
+        'acc_bias': acc_bias, 'acc_matrix': [[v * acc_unit for v in row] for row in acc_m],
+        'gyro_bias': gyro_bias, 'gyro_matrix': [[v * gyro_unit for v in row] for row in gyro_m],
+        'acc_rms_mg': acc_rms * 1000, 'gyro_rms_deg': gyro_rms,
+        'units': ('m/s^2' if args.acc_unit == 'mps2' else 'G', 'rad/s' if args.gyro_unit == 'rads' else 'dps'),
+    }
+
+
+def format_params(name, bias, matrix, ref_temp):
+    def num(x):
+        s = '%.9g' % x
+        return s + ('f' if ('.' in s or 'e' in s) else '.0f')
+
+    def vec(v):
+        return '{' + ', '.join(num(x) for x in v) + '}'
+    indent = ' ' * (len('const IMUCalibParams %s = {' % name))
+    return ('const IMUCalibParams %s = {{%s},\n%s{%s},\n%s%.1ff};\n' % (
+        name, ', '.join(vec(b) for b in bias), indent,
+        (',\n' + indent + ' ').join(vec(row) for row in matrix), indent, ref_temp))
+
+
+def report(result, source):
+    print('// imu_calib_fit.py %s' % source)
+    print('// %d static poses, %d rotations, %.0f Hz, temperature %.1f ~ %.1f C (order %d)' % (
+        result['poses'], result['rotations'], result['rate'],
+        result['temp_range'][0], result['temp_range'][1], result['order']))
+    print('// residual: acc %.2f mG rms, gyro %.3f deg rms' % (result['acc_rms_mg'], result['gyro_rms_deg']))
+    print('// units: acc %s, gyro %s (matrix = unit / LSB, bias = LSB)' % result['units'])
+    print(format_params('accParams', result['acc_bias'], result['acc_matrix'], result['ref_temp']))
+    print(format_params('gyroParams', result['gyro_bias'], result['gyro_matrix'], result['ref_temp']))
+
+
+# ---- 自己テスト ----
+
+def synthetic(args, seed=1):
+    """係数の分かっている記録を作る 20の向きに2.5秒ずつ置き、間は1.5秒で回す 温度は20→40℃"""
+    rnd = random.Random(seed)
+    rate = 200.0
+    acc_m = [[1.004, 0.006, -0.003], [0.0, 0.996, 0.004], [0.0, 0.0, 1.002]]
+    acc_b = [[35.0, -22.0, 60.0], [0.9, -0.4, 1.3], [0.01, 0.0, -0.015]]
+    gyro_m = [[1.003, 0.004, -0.002], [-0.003, 0.997, 0.005], [0.002, -0.004, 1.005]]
+    gyro_b = [[-6.0, 9.0, 4.0], [0.25, 0.1, -0.35], [0.0, 0.004, 0.0]]
+    ref = 30.0
+    # 真の値 -> 生の値
+    acc_inv = mat_inv([[v / args.acc_lsb for v in row] for row in acc_m])
+    gyro_inv = mat_inv([[v * math.pi / 180 / args.gyro_lsb for v in row] for row in gyro_m])
+    rows = []
+    q = [1.0, 0.0, 0.0, 0.0]  # 機体 -> 世界
+    t = 0
+    n_pose = 20
+    total = int(n_pose * 4.0 * rate)
+    for pose in range(n_pose):
+        for phase, dur in (('static', 2.5), ('move', 1.5)):
+            steps = int(dur * rate)
+            if phase == 'move':
+                axis = normalize([rnd.gauss(0, 1) for _ in range(3)])
+                speed = math.radians(rnd.uniform(60, 120))
+            for s in range(steps):
+                if phase == 'move':
+                    # なめらかに加速、減速する
+                    w = [a * speed * 2 * math.sin(math.pi * s / steps) ** 2 for a in axis]
+                else:
+                    w = [0.0, 0.0, 0.0]
+                temp = 20.0 + 20.0 * len(rows) / total
+                d = temp - ref
+                up = rotate_inv(q, [0.0, 0.0, 1.0])
+                acc_raw = mat_vec(acc_inv, up)
+                gyro_raw = mat_vec(gyro_inv, w)
+                row = [t]
+                row += [int(round(acc_raw[a] + poly([acc_b[0][a], acc_b[1][a], acc_b[2][a]], d) + rnd.gauss(0, 4)))
+                        for a in range(3)]
+                row += [int(round(gyro_raw[a] + poly([gyro_b[0][a], gyro_b[1][a], gyro_b[2][a]], d) +
+                                  rnd.gauss(0, 1.5))) for a in range(3)]
+                row.append(int(round((temp - args.temp_offset) * args.temp_lsb)))
+                rows.append(row)
+                q = quat_step(q, w, 1.0 / rate)
+                t += int(1e6 / rate)
+    truth = {'acc_m': acc_m, 'acc_b': acc_b, 'gyro_m': gyro_m, 'gyro_b': gyro_b, 'ref': ref}
+    return rows, truth
+
+
+def selftest(args):
+    rows, truth = synthetic(args)
+    args.acc_unit, args.gyro_unit = 'g', 'dps'
+    result = fit(rows, args)
+    report(result, '--selftest')
+    d = result['ref_temp'] - truth['ref']
+    # 基準温度が違うので、真のバイアスを求めた基準温度に直して比べる
+    worst = {}
+    for name, lsb in (('acc', args.acc_lsb), ('gyro', args.gyro_lsb)):
+        b, m = truth[name + '_b'], truth[name + '_m']
+        est_b, est_m = result[name + '_bias'], result[name + '_matrix']
+        b0 = [poly([b[0][a], b[1][a], b[2][a]], d) for a in range(3)]
+        b1 = [b[1][a] + 2 * b[2][a] * d for a in range(3)]
+        worst[name + '_bias0_lsb'] = max(abs(b0[a] - est_b[0][a]) for a in range(3))
+        worst[name + '_bias1_lsb'] = max(abs(b1[a] - est_b[1][a]) for a in range(3))
+        worst[name + '_matrix'] = max(abs(m[i][j] - est_m[i][j] * lsb) for i in range(3) for j in range(3))
+    print('// selftest max error: ' + ', '.join('%s %.2g' % kv for kv in sorted(worst.items())))
+    ok = (worst['acc_bias0_lsb'] < 3 and worst['gyro_bias0_lsb'] < 1 and
+          worst['acc_matrix'] < 1e-3 and worst['gyro_matrix'] < 2e-3)
+    print('// selftest ' + ('passed' if ok else 'FAILED'))
+    return 0 if ok else 1
+
+
+def main():
+    ap = argparse.ArgumentParser(description='fit IMUCalibParams from a tumble test recording')
+    ap.add_argument('csv', nargs='?', help='t_us,ax,ay,az,gx,gy,gz,temp')
+    ap.add_argument('--acc-lsb', type=float, default=2048.0, help='LSB per G (default: ICM20602 16G)')
+    ap.add_argument('--gyro-lsb', type=float, default=16.4, help='LSB per dps (default: ICM20602 2000dps)')
+    ap.add_argument('--temp-lsb', type=float, default=326.8, help='temperature LSB per degC')
+    ap.add_argument('--temp-offset', type=float, default=25.0, help='temperature at raw 0 [degC]')
+    ap.add_argument('--temp-order', type=int, default=None, help='bias polynomial order 0~2 (default: from range)')
+    ap.add_argument('--acc-unit', choices=('mps2', 'g'), default='mps2')
+    ap.add_argument('--gyro-unit', choices=('rads', 'dps'), default='rads')
+    ap.add_argument('--max-gap', type=float, default=20.0, help='ignore rotations longer than this [s]')
+    ap.add_argument('--selftest', action='store_true')
+    args = ap.parse_args()
+    if args.selftest:
+        return selftest(args)
+    if args.csv is None:
+        ap.error('csv is required')
+    report(fit(read_csv(args.csv), args), args.csv)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
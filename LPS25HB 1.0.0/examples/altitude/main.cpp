@@ -0,0 +1,106 @@
+// LPSAltitudeの精度と速度を確かめる
+// 260~1260hPaの全ての生の値について表の補間と式(double)を比べ、最大誤差と、1回あたりの時間をpowf()と比べて出力する
+// PC: g++ -O2 -I"LPS25HB 1.0.0/src" main.cpp (単位はns)
+// ESP32: そのままビルドしてシリアルに出力 (単位はCPUサイクル)
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdio.h>
+#include <chrono>
+#endif
+#include "LPSAltitude.h"
+
+#define BENCH_COUNT 4096
+
+LPSAltitude altitude;
+static uint32_t raws[BENCH_COUNT];
+static volatile int32_t sinkFixed;
+static volatile float sinkFloat;
+
+static uint32_t now()
+{
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+static void runTest()
+{
+    altitude.begin();
+
+    // 精度: 全ての生の値 (ESP32では時間がかかるので64おき)
+#ifdef ARDUINO
+    const uint32_t step = 64;
+#else
+    const uint32_t step = 1;
+#endif
+    double maxErr = 0;
+    uint32_t maxErrRaw = 0;
+    double maxErrSea = 0; // 950~1050hPa
+    for (uint32_t raw = LPS_ALT_RAW_MIN; raw <= LPS_ALT_RAW_MAX; raw += step)
+    {
+        double err = fabs(altitude.altitudeMm(raw) * 0.001 - LPSAltitude::reference(raw));
+        if (err > maxErr)
+        {
+            maxErr = err;
+            maxErrRaw = raw;
+        }
+        if (raw >= 950 * 4096 && raw <= 1050 * 4096 && err > maxErrSea)
+        {
+            maxErrSea = err;
+        }
+    }
+
+    // 速度
+    uint32_t seed = 1;
+    for (int i = 0; i < BENCH_COUNT; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        raws[i] = LPS_ALT_RAW_MIN + (seed >> 8) % (LPS_ALT_RAW_MAX - LPS_ALT_RAW_MIN);
+    }
+    uint32_t start = now();
+    for (int i = 0; i < BENCH_COUNT; i++)
+    {
+        sinkFixed = altitude.altitudeMm(raws[i]);
+    }
+    uint32_t tTable = (now() - start) / BENCH_COUNT;
+    start = now();
+    for (int i = 0; i < BENCH_COUNT; i++)
+    {
+        sinkFloat = 44330.77f * (1.0f - powf(raws[i] / 4096.0f / 1013.25f, 0.190263f));
+    }
+    uint32_t tPowf = (now() - start) / BENCH_COUNT;
+
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "{\"bench\":\"lpsaltitude\",\"entries\":%u,\"max_err_m\":%.4f,\"max_err_hpa\":%.2f,\"max_err_sea_m\":%.4f,\"table\":%u,\"powf\":%u}",
+             (unsigned)LPS_ALT_ENTRIES, maxErr, maxErrRaw / 4096.0, maxErrSea, (unsigned)tTable, (unsigned)tPowf);
+#ifdef ARDUINO
+    Serial.println(buf);
+#else
+    puts(buf);
+#endif
+}
+
+#ifdef ARDUINO
+void setup()
+{
+    Serial.begin(115200);
+    delay(1000);
+    runTest();
+}
+
+void loop()
+{
+}
+#else
+int main()
+{
+    runTest();
+    return 0;
+}
+#endif
@@ -5,16 +5,56 @@
 #define LPS_H
 #include <SPICREATE.h> // 2.0.0
 #include <Arduino.h>
+#include "LPSAltitude.h"
 
 #define LPS_Data_Adress_0 0x28
 #define LPS_Data_Adress_1 0x29
 #define LPS_Data_Adress_2 0x2A
+#define LPS_Temp_Adress_0 0x2B
+#define LPS_Temp_Adress_1 0x2C
+// 連続して読むときにアドレスを進める (SPIのMSビット)
+#define LPS_AUTO_INCREMENT 0x40
+// 気圧3byte + 温度2byte (0x28~0x2C)
+#define LPS_SAMPLE_LENGTH 5
 
 #define LPS_WakeUp_Adress 0x20
 #define LPS_WakeUp_Value 0xC0
 #define LPS_Setting_Adress 0x21
 #define LPS_Settig_Value 0x08
 #define LPS_WhoAmI_Adress 0x0F
+#define LPS_WhoAmI_Value 0xBD
+#define LPS_Status_Adress 0x27
+#define LPS_FifoCtrl_Adress 0x2E
+#define LPS_FifoStatus_Adress 0x2F
+
+// CTRL_REG1 (LPS_WakeUp_Value | LPS_BDU) 上位と下位のbyteを両方読むまで値を更新しない
+#define LPS_BDU 0x04
+// CTRL_REG2
+#define LPS_FIFO_EN 0x40
+
+// FIFO_CTRLのモード (bit7-5)
+#define LPS_FIFO_BYPASS 0x00
+#define LPS_FIFO_MODE 0x20   // 32個溜まったら止まる
+#define LPS_FIFO_STREAM 0x40 // 32個溜まったら古いものから上書き
+#define LPS_FIFO_MEAN 0xC0   // 直近の値の移動平均を出力レジスタに出す
+// FIFO_MEANで平均するサンプル数 (FIFO_CTRLのWTM_POINT)
+#define LPS_FIFO_MEAN_2 0x01
+#define LPS_FIFO_MEAN_4 0x03
+#define LPS_FIFO_MEAN_8 0x07
+#define LPS_FIFO_MEAN_16 0x0F
+#define LPS_FIFO_MEAN_32 0x1F
+// FIFO_STATUS
+#define LPS_FIFO_FTH 0x80        // WTM_POINT以上溜まった
+#define LPS_FIFO_OVR 0x40        // 満杯 (STREAMでは上書きが起きた)
+#define LPS_FIFO_EMPTY 0x20      // 空
+#define LPS_FIFO_LEVEL_MASK 0x1F // FSS 0~31 (32個はOVRで分かる)
+#define LPS_FIFO_DEPTH 32
+
+struct LPS_FifoSample
+{
+    uint32_t pressureRaw; // 4096で1hPa
+    int16_t temperatureRaw; // 42.5 + raw / 480 [℃]
+};
 
 class LPS
 {
@@ -22,13 +62,54 @@ class LPS
     int deviceHandle{-1};
     SPICREATE::SPICreate *LPSSPI;
 
+    uint8_t fifoCtrl = LPS_FIFO_BYPASS;
+
+    void readBurst(uint8_t reg, uint8_t *rx_buf, size_t len);
+    void setFifo(uint8_t ctrl);
+
 public:
-    uint32_t PlessureRaw;
-    int Plessure;
+    uint32_t PlessureRaw; // 4096で1hPa 高度はLPSAltitudeで計算する
+    int Plessure;         // [Pa] PlessureRaw * 100 / 4096 (100 / 4096 = 25 / 1024 なのでuint32_tで桁あふれしない)
+    int16_t TemperatureRaw;
+    float Temperature; // [℃]
     void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000);
     uint8_t WhoAmI();
+    // 今の設定 (CTRL_REG1, CTRL_REG2, FIFO) を書き直す addDeviceはしない
+    // センサの電源が落ちた等で設定が消えたときに使う WhoAmIと読み返した値が正しければtrue
+    bool reinit();
+    // このセンサのSPI通信のエラーの数
+    uint32_t spiErrorCount() { return LPSSPI->getErrorCount(deviceHandle); }
+    // 気圧だけ rxに3byte入る (通信は気圧と温度を1回で読む)
     void Get(uint8_t *rx);
     // (uint32_t)rx[2] << 16 | (uint32_t)rx[1] << 8 | (uint32_t)rx[0] means pressure
+    // 気圧と温度を1回の通信で読む rxに5byte (LPS_SAMPLE_LENGTH) 入る
+    // rx[3] | rx[4] << 8 means temperature
+    void GetWithTemp(uint8_t *rx);
+
+    /**
+     * @brief FIFOを使い始める
+     * LPS_FIFO_STREAM: 最大32サンプル溜めておき、ReadFifoでまとめて読む
+     * @param[in] mode LPS_FIFO_MODE / LPS_FIFO_STREAM
+     */
+    void beginFifo(uint8_t mode = LPS_FIFO_STREAM);
+    /**
+     * @brief FIFO_MEANモードにする 出力レジスタが直近samples個の移動平均になる (Get, GetWithTempはそのまま使える)
+     * ノイズが減る分、応答はsamples / ODR 程度遅れる
+     * @param[in] samples LPS_FIFO_MEAN_2 ~ LPS_FIFO_MEAN_32
+     * @retval false: samplesが範囲外
+     */
+    bool beginFifoMean(uint8_t samples);
+    // バイパスモードに戻す (FIFOの中身は消える)
+    void endFifo();
+    // FIFOに溜まっているサンプル数 (0 ~ LPS_FIFO_DEPTH) overrunに満杯(STREAMでは上書きが起きた)かが入る
+    uint8_t fifoLevel(bool *overrun = NULL);
+    /**
+     * @brief FIFOに溜まっているサンプルを読む 1サンプルごとに1回の通信 (5byte)
+     * @param[out] samples
+     * @param[in] maxSamples
+     * @return 読んだサンプル数 (古い順)
+     */
+    uint8_t ReadFifo(LPS_FifoSample *samples, uint8_t maxSamples);
 };
 
 void LPS::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
@@ -53,37 +134,139 @@ void LPS::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
 
     deviceHandle = LPSSPI->addDevice(&if_cfg, cs);
     LPSSPI->setReg(LPS_Setting_Adress, LPS_Settig_Value, deviceHandle);
-    LPSSPI->setReg(LPS_WakeUp_Adress, LPS_WakeUp_Value, deviceHandle);
+    // 気圧と温度をまとめて読むので、BDUをつける
+    LPSSPI->setReg(LPS_WakeUp_Adress, LPS_WakeUp_Value | LPS_BDU, deviceHandle);
 
     return;
 }
+bool LPS::reinit()
+{
+    LPSSPI->setReg(LPS_WakeUp_Adress, LPS_WakeUp_Value | LPS_BDU, deviceHandle);
+    setFifo(fifoCtrl);
+    return WhoAmI() == LPS_WhoAmI_Value &&
+           LPSSPI->readByte(LPS_WakeUp_Adress | 0x80, deviceHandle) == (LPS_WakeUp_Value | LPS_BDU);
+}
 uint8_t LPS::WhoAmI()
 {
     return LPSSPI->readByte(LPS_WhoAmI_Adress | 0x80, deviceHandle);
     // registor 0x0F and you'll get 0d177 or 0xb1 or 0b10110001
 }
 
-void LPS::Get(uint8_t *rx)
+void LPS::readBurst(uint8_t reg, uint8_t *rx_buf, size_t len)
 {
     spi_transaction_t comm = {};
     comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
-    comm.length = (14) * 8;
-    comm.cmd = LPS_Data_Adress_0 | 0x80;
+    comm.length = len * 8;
+    comm.cmd = reg | LPS_AUTO_INCREMENT | 0x80;
 
     comm.tx_buffer = NULL;
-    comm.rx_buffer = NULL;
+    comm.rx_buffer = rx_buf;
     comm.user = (void *)CS;
 
     spi_transaction_ext_t spi_transaction = {};
     spi_transaction.base = comm;
     spi_transaction.command_bits = 8;
+    LPSSPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+}
 
-    rx[0] = LPSSPI->readByte(LPS_Data_Adress_0 | 0x80, deviceHandle);
-    rx[1] = LPSSPI->readByte(LPS_Data_Adress_1 | 0x80, deviceHandle);
-    rx[2] = LPSSPI->readByte(LPS_Data_Adress_2 | 0x80, deviceHandle);
+void LPS::Get(uint8_t *rx)
+{
+    // BDUがあるので温度まで読み切る (Temperatureも更新される)
+    uint8_t rx_buf[LPS_SAMPLE_LENGTH];
+    GetWithTemp(rx_buf);
+    rx[0] = rx_buf[0];
+    rx[1] = rx_buf[1];
+    rx[2] = rx_buf[2];
+    return;
+}
+
+void LPS::GetWithTemp(uint8_t *rx)
+{
+    readBurst(LPS_Data_Adress_0, rx, LPS_SAMPLE_LENGTH);
     PlessureRaw = (uint32_t)rx[2] << 16 | (uint32_t)rx[1] << 8 | (uint32_t)rx[0];
-    Plessure = (int)PlessureRaw * 100 / 4096;
+    Plessure = (int)(PlessureRaw * 25 / 1024);
+    TemperatureRaw = (int16_t)(rx[4] << 8 | rx[3]);
+    Temperature = 42.5f + TemperatureRaw / 480.0f;
     return;
 }
 
+// FIFO_CTRLを書き換える モードを変えるときは一度バイパスに戻す
+void LPS::setFifo(uint8_t ctrl)
+{
+    LPSSPI->setReg(LPS_FifoCtrl_Adress, LPS_FIFO_BYPASS, deviceHandle);
+    uint8_t ctrl2 = LPS_Settig_Value;
+    if (ctrl != LPS_FIFO_BYPASS)
+    {
+        LPSSPI->setReg(LPS_FifoCtrl_Adress, ctrl, deviceHandle);
+        ctrl2 |= LPS_FIFO_EN;
+    }
+    LPSSPI->setReg(LPS_Setting_Adress, ctrl2, deviceHandle);
+    fifoCtrl = ctrl;
+}
+
+void LPS::beginFifo(uint8_t mode)
+{
+    setFifo(mode & 0xE0);
+}
+
+bool LPS::beginFifoMean(uint8_t samples)
+{
+    if (samples != LPS_FIFO_MEAN_2 && samples != LPS_FIFO_MEAN_4 && samples != LPS_FIFO_MEAN_8 &&
+        samples != LPS_FIFO_MEAN_16 && samples != LPS_FIFO_MEAN_32)
+    {
+        return false;
+    }
+    setFifo(LPS_FIFO_MEAN | samples);
+    return LPSSPI->readByte(LPS_FifoCtrl_Adress | 0x80, deviceHandle) == fifoCtrl;
+}
+
+void LPS::endFifo()
+{
+    setFifo(LPS_FIFO_BYPASS);
+}
+
+uint8_t LPS::fifoLevel(bool *overrun)
+{
+    uint8_t status = LPSSPI->readByte(LPS_FifoStatus_Adress | 0x80, deviceHandle);
+    if (overrun != NULL)
+    {
+        *overrun = (status & LPS_FIFO_OVR) != 0;
+    }
+    if (status & LPS_FIFO_EMPTY)
+    {
+        return 0;
+    }
+    // FSSは5bitなので、32個溜まったときはOVRで見分ける
+    if (status & LPS_FIFO_OVR)
+    {
+        return LPS_FIFO_DEPTH;
+    }
+    return status & LPS_FIFO_LEVEL_MASK;
+}
+
+uint8_t LPS::ReadFifo(LPS_FifoSample *samples, uint8_t maxSamples)
+{
+    uint8_t n = fifoLevel();
+    if (n > maxSamples)
+    {
+        n = maxSamples;
+    }
+    uint8_t rx_buf[LPS_SAMPLE_LENGTH];
+    for (uint8_t i = 0; i < n; i++)
+    {
+        // 出力レジスタを読むたびにFIFOから1サンプル取り出される
+        readBurst(LPS_Data_Adress_0, rx_buf, LPS_SAMPLE_LENGTH);
+        samples[i].pressureRaw = (uint32_t)rx_buf[2] << 16 | (uint32_t)rx_buf[1] << 8 | (uint32_t)rx_buf[0];
+        samples[i].temperatureRaw = (int16_t)(rx_buf[4] << 8 | rx_buf[3]);
+    }
+    if (n > 0)
+    {
+        PlessureRaw = samples[n - 1].pressureRaw;
+        Plessure = (int)(PlessureRaw * 25 / 1024);
+        TemperatureRaw = samples[n - 1].temperatureRaw;
+        Temperature = 42.5f + TemperatureRaw / 480.0f;
+    }
+    return n;
+}
+
 #endif
\ No newline at end of file
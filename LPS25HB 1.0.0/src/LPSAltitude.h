@@ -0,0 +1,105 @@
+// version: 1.0.0
+#pragma once
+
+#ifndef LPSAltitude_H
+#define LPSAltitude_H
+#include <stdint.h>
+#include <math.h>
+
+// 表の範囲 (LPS25HBの測定範囲 260~1260hPa) 生の値は4096で1hPa
+#define LPS_ALT_RAW_MIN (260UL * 4096)
+#define LPS_ALT_RAW_MAX (1260UL * 4096)
+// 表の間隔 2^13 (2hPa)
+#define LPS_ALT_SHIFT 13
+#define LPS_ALT_ENTRIES (((LPS_ALT_RAW_MAX - LPS_ALT_RAW_MIN) >> LPS_ALT_SHIFT) + 1)
+
+/**
+ * @brief 気圧の生の値から高度を出す (国際標準大気の対流圏 h = 44330.77 * (1 - (p / p0)^0.190263))
+ * begin()で2hPaごとの高度[mm]の表を作り、毎回は表の線形補間だけをする (整数の掛け算1回とシフト)
+ * powf()を使うより1桁以上速いので、全てのサンプルで計算してよい
+ * Arduinoに依存しないのでPC上でも使える
+ *
+ * 誤差 (式に対して、examples/altitudeで確かめられる)
+ *   線形補間の誤差は曲率の大きい低気圧側ほど大きく、最大 約4cm (260hPa付近)、950~1050hPaで 約5mm以下
+ *   1LSB(1/4096hPa)の分解能は高度で 約2mm (海面付近) ~ 約8mm (260hPa)
+ *   範囲外の値は端の値にする
+ * 式そのものは標準大気なので、実際の大気との差 (気温、海面気圧の違い) は数%ある
+ * 地上からの高さにするなら、setGround()で地上の気圧を基準にすると海面気圧の違いがほぼ消える
+ *
+ * ```cpp
+ * // example
+ * LPSAltitude altitude;
+ * altitude.begin();                   // 海面気圧 1013.25hPa
+ * Lps25.Get(rx);
+ * altitude.setGround(Lps25.PlessureRaw); // 発射前に
+ * int32_t h = altitude.heightMm(Lps25.PlessureRaw); // 地上からの高さ[mm]
+ * ```
+ */
+class LPSAltitude
+{
+private:
+    int32_t table[LPS_ALT_ENTRIES] = {};
+    int32_t groundMm = 0;
+    bool ready = false;
+
+public:
+    /**
+     * @brief 表を作る
+     * @param[in] seaLevelHPa 海面気圧[hPa]
+     * @retval false: seaLevelHPaが0以下
+     */
+    bool begin(float seaLevelHPa = 1013.25f);
+    bool isReady() const { return ready; }
+
+    // 海面気圧に対する高度[mm] rawはLPS::PlessureRaw (4096で1hPa)
+    int32_t altitudeMm(uint32_t raw) const;
+    float altitude(uint32_t raw) const { return altitudeMm(raw) * 0.001f; }
+
+    // 地上の気圧を基準にする
+    void setGround(uint32_t raw) { groundMm = altitudeMm(raw); }
+    // 地上からの高さ[mm]
+    int32_t heightMm(uint32_t raw) const { return altitudeMm(raw) - groundMm; }
+
+    // 表を使わずに式で計算する (比較用)
+    static double reference(uint32_t raw, double seaLevelHPa = 1013.25);
+};
+
+bool LPSAltitude::begin(float seaLevelHPa)
+{
+    if (!(seaLevelHPa > 0))
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < LPS_ALT_ENTRIES; i++)
+    {
+        table[i] = (int32_t)lround(reference(LPS_ALT_RAW_MIN + (i << LPS_ALT_SHIFT), seaLevelHPa) * 1000.0);
+    }
+    groundMm = 0;
+    ready = true;
+    return true;
+}
+
+int32_t LPSAltitude::altitudeMm(uint32_t raw) const
+{
+    if (raw <= LPS_ALT_RAW_MIN)
+    {
+        return table[0];
+    }
+    if (raw >= LPS_ALT_RAW_MAX)
+    {
+        return table[LPS_ALT_ENTRIES - 1];
+    }
+    uint32_t offset = raw - LPS_ALT_RAW_MIN;
+    uint32_t i = offset >> LPS_ALT_SHIFT;
+    int32_t frac = offset & ((1 << LPS_ALT_SHIFT) - 1);
+    // 1区間の差は最大 約60m = 60000mm なので、2^13を掛けても31bitに収まる
+    int32_t diff = table[i + 1] - table[i];
+    return table[i] + ((diff * frac) >> LPS_ALT_SHIFT);
+}
+
+double LPSAltitude::reference(uint32_t raw, double seaLevelHPa)
+{
+    return 44330.77 * (1.0 - pow(raw / 4096.0 / seaLevelHPa, 0.190263));
+}
+
+#endif
@@ -4,14 +4,51 @@
 #ifndef LogTIMER_H
 #define LogTIMER_H
 #include <Arduino.h>
+#include <esp_timer.h>
+
+// ジッタのヒストグラムのビン数 (最後のビンはそれ以上をまとめて数える)
+#ifndef LOG67_JITTER_BINS
+#define LOG67_JITTER_BINS 8
+#endif
 
 class Log67Timer
 {
+private:
+    // ドリフト補正用 anchorLocalのときの補正後の時刻がanchorCorrected
+    // SetReferenceとCorrectedTimeは別のコアから呼ばれうるので、3つはanchorMuxの中でまとめて読み書きする
+    int64_t anchorLocal = 0;
+    int64_t anchorCorrected = 0;
+    int32_t driftPpb = 0;
+    portMUX_TYPE anchorMux = portMUX_INITIALIZER_UNLOCKED;
+    // 最初に外部の基準時刻を受け取ったときの時刻
+    bool referenceValid = false;
+    int64_t referenceLocal = 0;
+    int64_t referenceRemote = 0;
+
 public:
     unsigned long Gettime_record();
     unsigned long start_time;
     unsigned long time;
     bool start_flag = true;
+
+    // 64bit版 micros()と違い約71分で一周しない
+    // start_time64はCorrectedTime()と同じ時間軸
+    int64_t start_time64 = 0;
+    // start_time, start_time64を今の時刻にする
+    void Start();
+    // Start()からの時間[us] (ドリフト補正済み)
+    int64_t Gettime_record64();
+    // esp_timer_get_time()にドリフト補正をかけた時刻[us] 単調増加
+    int64_t CorrectedTime();
+    /**
+     * @brief 外部の基準時刻(GPSのPPS、CANで受け取った時刻等)を与えてドリフトを補正する
+     * 最初の呼び出しからの経過時間を比べるので、2回目以降の呼び出しで補正がかかる
+     * 時刻を飛ばさず、傾きだけを変えるので補正後の時刻も単調増加のまま
+     * @param[in] referenceUs 呼び出した瞬間の基準時刻[us]
+     */
+    void SetReference(int64_t referenceUs);
+    // 推定したドリフト[ppb] 正なら基準より遅れている
+    int32_t GetDriftPpb();
 };
 
 unsigned long Log67Timer::Gettime_record()
@@ -21,4 +58,245 @@ unsigned long Log67Timer::Gettime_record()
     return time;
 }
 
-#endif
\ No newline at end of file
+void Log67Timer::Start()
+{
+    start_time = micros();
+    start_time64 = CorrectedTime();
+    start_flag = false;
+}
+
+int64_t Log67Timer::Gettime_record64()
+{
+    return CorrectedTime() - start_time64;
+}
+
+int64_t Log67Timer::CorrectedTime()
+{
+    portENTER_CRITICAL(&anchorMux);
+    int64_t local = anchorLocal;
+    int64_t corrected = anchorCorrected;
+    int32_t ppb = driftPpb;
+    portEXIT_CRITICAL(&anchorMux);
+    // 起点を読んだ後に今の時刻を読むので、elapsedは負にならない
+    int64_t elapsed = esp_timer_get_time() - local;
+    return corrected + elapsed + elapsed * ppb / 1000000000;
+}
+
+int32_t Log67Timer::GetDriftPpb()
+{
+    portENTER_CRITICAL(&anchorMux);
+    int32_t ppb = driftPpb;
+    portEXIT_CRITICAL(&anchorMux);
+    return ppb;
+}
+
+void Log67Timer::SetReference(int64_t referenceUs)
+{
+    int64_t local = esp_timer_get_time();
+    if (!referenceValid)
+    {
+        referenceLocal = local;
+        referenceRemote = referenceUs;
+        referenceValid = true;
+        return;
+    }
+    int64_t localElapsed = local - referenceLocal;
+    int64_t remoteElapsed = referenceUs - referenceRemote;
+    // 1秒以上間隔がないと精度が出ない
+    if (localElapsed < 1000000)
+    {
+        return;
+    }
+    int64_t ppb = (remoteElapsed - localElapsed) * 1000000000 / localElapsed;
+    // 水晶のずれとしてありえない値(1000ppm以上)は無視する
+    if (ppb > 1000000 || ppb < -1000000)
+    {
+        return;
+    }
+    // 今の時刻を起点に傾きだけを変える
+    // 起点の時刻はロックの中で読む (他のコアが古い傾きで起点より後の時刻を返していると、単調増加でなくなる)
+    portENTER_CRITICAL(&anchorMux);
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - anchorLocal;
+    anchorCorrected += elapsed + elapsed * driftPpb / 1000000000;
+    anchorLocal = now;
+    driftPpb = (int32_t)ppb;
+    portEXIT_CRITICAL(&anchorMux);
+}
+
+/**
+ * @brief esp_timerで一定周期のサンプリングのタイミングを作るクラス
+ * loop()の処理時間に左右されずに決まった周期でセンサを読むために使う
+ * 待つ側のタスクは優先度を高くしておくこと
+ *
+ * ```cpp
+ * // example
+ * Log67SampleClock sampleClock;
+ * void task(void *pvParameters)
+ * {
+ *     sampleClock.begin(1000); // 1kHz
+ *     while (1)
+ *     {
+ *         sampleClock.waitTick();
+ *         // センサを読む
+ *     }
+ * }
+ * ```
+ */
+class Log67SampleClock
+{
+private:
+    esp_timer_handle_t timerHandle = NULL;
+    TaskHandle_t waitingTask = NULL;
+    uint32_t periodUs = 1000;
+    int64_t startUs = 0;
+    // 開始からの理想的なtickの番号
+    uint64_t tickIndex = 0;
+
+    static void onTimer(void *arg);
+
+public:
+    // 処理したtickの数
+    volatile uint32_t tickCount = 0;
+    // 前のサンプリングが終わらず飛ばしたtickの数
+    volatile uint32_t missedCount = 0;
+    // 理想の時刻からlateThresholdUs以上遅れて起きたtickの数
+    volatile uint32_t lateCount = 0;
+    // 理想の時刻からの遅れの最大値[us]
+    volatile uint32_t maxJitterUs = 0;
+    // 遅れのヒストグラム 1ビンはjitterBinUs[us]
+    volatile uint32_t jitterHistogram[LOG67_JITTER_BINS] = {};
+    uint32_t jitterBinUs = 10;
+    uint32_t lateThresholdUs = 500;
+
+    /**
+     * @brief タイマを開始する waitTickを呼ぶタスクから呼び出すこと
+     * @param[in] period サンプリング周期[us]
+     * @param[in] binUs ジッタのヒストグラムの1ビンの幅[us]
+     * @retval true: success
+     * @retval false: esp_timerを作れなかった
+     */
+    bool begin(uint32_t period, uint32_t binUs = 10);
+    void end();
+    /**
+     * @brief 次のtickまで待つ
+     * @return 前回呼び出してから進んだtickの数 (2以上ならサンプリングが間に合っていない)
+     */
+    uint32_t waitTick();
+    uint32_t GetPeriodUs() { return periodUs; }
+    void resetStats();
+    // 統計をSerialに出力する
+    void printStats();
+};
+
+void Log67SampleClock::onTimer(void *arg)
+{
+    Log67SampleClock *clock = (Log67SampleClock *)arg;
+    xTaskNotifyGive(clock->waitingTask);
+}
+
+bool Log67SampleClock::begin(uint32_t period, uint32_t binUs)
+{
+    if (period == 0)
+    {
+        return false;
+    }
+    end();
+    periodUs = period;
+    jitterBinUs = (binUs == 0) ? 1 : binUs;
+    lateThresholdUs = periodUs / 2;
+    waitingTask = xTaskGetCurrentTaskHandle();
+    resetStats();
+
+    esp_timer_create_args_t args = {};
+    args.callback = onTimer;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "log67Clock";
+    if (esp_timer_create(&args, &timerHandle) != ESP_OK)
+    {
+        timerHandle = NULL;
+        return false;
+    }
+    tickIndex = 0;
+    startUs = esp_timer_get_time();
+    if (esp_timer_start_periodic(timerHandle, periodUs) != ESP_OK)
+    {
+        esp_timer_delete(timerHandle);
+        timerHandle = NULL;
+        return false;
+    }
+    return true;
+}
+
+void Log67SampleClock::end()
+{
+    if (timerHandle == NULL)
+    {
+        return;
+    }
+    esp_timer_stop(timerHandle);
+    esp_timer_delete(timerHandle);
+    timerHandle = NULL;
+}
+
+uint32_t Log67SampleClock::waitTick()
+{
+    uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    if (ticks > 1)
+    {
+        missedCount += ticks - 1;
+    }
+    tickIndex += ticks;
+    tickCount++;
+
+    int64_t late = now - (startUs + (int64_t)tickIndex * periodUs);
+    uint32_t jitter = (late > 0) ? (uint32_t)late : 0;
+    if (jitter > maxJitterUs)
+    {
+        maxJitterUs = jitter;
+    }
+    if (jitter >= lateThresholdUs)
+    {
+        lateCount++;
+    }
+    uint32_t bin = jitter / jitterBinUs;
+    if (bin >= LOG67_JITTER_BINS)
+    {
+        bin = LOG67_JITTER_BINS - 1;
+    }
+    jitterHistogram[bin]++;
+    return ticks;
+}
+
+void Log67SampleClock::resetStats()
+{
+    tickCount = 0;
+    missedCount = 0;
+    lateCount = 0;
+    maxJitterUs = 0;
+    for (int i = 0; i < LOG67_JITTER_BINS; i++)
+    {
+        jitterHistogram[i] = 0;
+    }
+}
+
+void Log67SampleClock::printStats()
+{
+    Serial.printf("period: %u us, ticks: %u, missed: %u, late: %u, max jitter: %u us\n",
+                  periodUs, tickCount, missedCount, lateCount, maxJitterUs);
+    for (int i = 0; i < LOG67_JITTER_BINS; i++)
+    {
+        if (i == LOG67_JITTER_BINS - 1)
+        {
+            Serial.printf("  >=%u us: %u\n", i * jitterBinUs, jitterHistogram[i]);
+        }
+        else
+        {
+            Serial.printf("  %u-%u us: %u\n", i * jitterBinUs, (i + 1) * jitterBinUs, jitterHistogram[i]);
+        }
+    }
+}
+
+#endif
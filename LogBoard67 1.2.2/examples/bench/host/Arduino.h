@@ -0,0 +1,79 @@
+// PCでベンチマークを動かすためのArduinoとFreeRTOSの代わり
+// 時間はstd::chrono::steady_clock ESP.getCycleCount()は1GHz (1サイクル = 1ns) として返す
+// タスクは作れない (beginPipelineはfalseを返す) ので、RoutineWorkだけを使う
+#pragma once
+
+#ifndef LOG67_HOST_ARDUINO_H
+#define LOG67_HOST_ARDUINO_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#define IRAM_ATTR
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+
+inline uint64_t log67HostNs()
+{
+    static const auto origin = std::chrono::steady_clock::now();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+inline unsigned long micros() { return (unsigned long)(uint32_t)(log67HostNs() / 1000); }
+inline unsigned long millis() { return (unsigned long)(uint32_t)(log67HostNs() / 1000000); }
+inline void delayMicroseconds(uint32_t us)
+{
+    uint64_t end = log67HostNs() + (uint64_t)us * 1000;
+    while (log67HostNs() < end)
+    {
+    }
+}
+inline void delay(uint32_t ms) { delayMicroseconds(ms * 1000); }
+inline uint32_t getCpuFrequencyMhz() { return 1000; }
+
+struct Log67HostSerial
+{
+    void begin(unsigned long) {}
+    void printf(const char *format, ...)
+    {
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+    void println(const char *s) { puts(s); }
+};
+static Log67HostSerial Serial;
+
+struct Log67HostEsp
+{
+    uint32_t getCycleCount() { return (uint32_t)log67HostNs(); }
+};
+static Log67HostEsp ESP;
+
+// FreeRTOS
+typedef int BaseType_t;
+typedef void *TaskHandle_t;
+typedef int portMUX_TYPE;
+#define pdTRUE 1
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFF
+#define configMAX_PRIORITIES 25
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void *), const char *, uint32_t, void *, int, TaskHandle_t *, BaseType_t) { return pdFAIL; }
+inline void vTaskDelay(uint32_t) {}
+inline void vTaskDelete(TaskHandle_t) {}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return NULL; }
+inline uint32_t ulTaskNotifyTake(BaseType_t, uint32_t) { return 1; }
+inline void xTaskNotifyGive(TaskHandle_t) {}
+
+#endif
@@ -0,0 +1,51 @@
+// PCでベンチマークを動かすためのH3LIS331のモデル
+// 毎回新しい値 (Zに1G + ノイズ) を返す 設定と割り込みは受け付けるだけ
+#pragma once
+
+#ifndef LOG67_HOST_H3LIS331_H
+#define LOG67_HOST_H3LIS331_H
+#include <SPICREATE.h>
+
+#define H3LIS331_WhoAmI_Value 0x32
+#define H3LIS331_SAMPLE_LENGTH 7
+#define H3LIS331_HPCF_ODR_50 0x00
+#define H3LIS331_HPF_INT1 0x04
+#define H3LIS331_INT_HIGH_ANY 0x2A
+
+struct H3LIS331_Sample
+{
+    int16_t acc[3];
+    uint8_t status;
+    bool fresh;
+    bool overrun;
+};
+
+class H3LIS331
+{
+public:
+    void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000) {}
+    uint8_t WhoAmI() { return H3LIS331_WhoAmI_Value; }
+    bool reinit() { return true; }
+    uint32_t spiErrorCount() { return 0; }
+    bool GetWithStatus(H3LIS331_Sample *sample, uint8_t *rx_buf)
+    {
+        // ±400Gで1G = 16LSB (12bitを左詰め)
+        const int16_t base[3] = {0, 0, 16 * 16};
+        rx_buf[0] = 0x08; // ZYXDA
+        for (int i = 0; i < 3; i++)
+        {
+            sample->acc[i] = base[i] + (int16_t)(log67HostNoise() % 64) - 32;
+            rx_buf[1 + 2 * i] = sample->acc[i] & 0xFF;
+            rx_buf[2 + 2 * i] = (uint16_t)sample->acc[i] >> 8;
+        }
+        sample->status = rx_buf[0];
+        sample->fresh = true;
+        sample->overrun = false;
+        return true;
+    }
+    bool setHighPass(uint8_t cutoff, uint8_t targets) { return true; }
+    bool setInterrupt(uint8_t line, uint8_t events, float thresholdG, uint32_t durationUs = 0, bool latch = false) { return true; }
+    bool attachInterrupt(uint8_t line, int pin, void (*callback)(void *arg, uint8_t line) = NULL, void *arg = NULL) { return true; }
+};
+
+#endif
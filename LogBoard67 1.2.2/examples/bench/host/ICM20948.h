@@ -0,0 +1,69 @@
+// PCでベンチマークを動かすためのICM20948のモデル
+// 加速度 (Zに1G)、角速度、地磁気にノイズをのせて返す 地磁気は10回に1回更新する (100Hz)
+#pragma once
+
+#ifndef LOG67_HOST_ICM20948_H
+#define LOG67_HOST_ICM20948_H
+#include <SPICREATE.h>
+
+#define ICM20948_WhoAmI_Value 0xEA
+#define ICM_SAMPLE_LENGTH 23
+
+struct ICM_Sample
+{
+    int16_t acc[3];
+    int16_t gyro[3];
+    int16_t temp;
+    int16_t mag[3];
+    uint8_t magStatus;
+};
+
+class ICM20948
+{
+private:
+    uint32_t calls = 0;
+    int16_t mag[3] = {};
+
+public:
+    void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000) {}
+    uint8_t WhoAmI() { return ICM20948_WhoAmI_Value; }
+    bool reinit() { return true; }
+    uint32_t spiErrorCount() { return 0; }
+    uint32_t getGyroPeriodUs() { return 1000; }
+    void GetAll(ICM_Sample *sample, uint8_t *rx_buf)
+    {
+        // ±16Gで1G = 2048LSB
+        const int16_t base[3] = {0, 0, 2048};
+        for (int i = 0; i < 3; i++)
+        {
+            sample->acc[i] = base[i] + (int16_t)(log67HostNoise() % 32) - 16;
+            sample->gyro[i] = (int16_t)(log67HostNoise() % 16) - 8;
+        }
+        sample->temp = 0;
+        sample->magStatus = (calls++ % 10 == 0) ? 0x01 : 0x00;
+        if (sample->magStatus)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                mag[i] = 200 + (int16_t)(log67HostNoise() % 16);
+            }
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            sample->mag[i] = mag[i];
+            rx_buf[2 * i] = (uint16_t)sample->acc[i] >> 8;
+            rx_buf[2 * i + 1] = sample->acc[i] & 0xFF;
+            rx_buf[6 + 2 * i] = (uint16_t)sample->gyro[i] >> 8;
+            rx_buf[7 + 2 * i] = sample->gyro[i] & 0xFF;
+            rx_buf[15 + 2 * i] = mag[i] & 0xFF;
+            rx_buf[16 + 2 * i] = (uint16_t)mag[i] >> 8;
+        }
+        rx_buf[12] = 0;
+        rx_buf[13] = 0;
+        rx_buf[14] = sample->magStatus;
+        rx_buf[21] = 0;
+        rx_buf[22] = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,27 @@
+// PCでベンチマークを動かすためのLPS25HBのモデル 1013hPa付近にノイズをのせて返す
+#pragma once
+
+#ifndef LOG67_HOST_LPS25HB_H
+#define LOG67_HOST_LPS25HB_H
+#include <SPICREATE.h>
+#include <LPSAltitude.h>
+
+#define LPS_WhoAmI_Value 0xBD
+
+class LPS
+{
+public:
+    void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000) {}
+    uint8_t WhoAmI() { return LPS_WhoAmI_Value; }
+    bool reinit() { return true; }
+    uint32_t spiErrorCount() { return 0; }
+    void Get(uint8_t *rx)
+    {
+        uint32_t raw = 1013 * 4096 + log67HostNoise() % 256;
+        rx[0] = raw & 0xFF;
+        rx[1] = (raw >> 8) & 0xFF;
+        rx[2] = (raw >> 16) & 0xFF;
+    }
+};
+
+#endif
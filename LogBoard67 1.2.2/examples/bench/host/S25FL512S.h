@@ -0,0 +1,50 @@
+// PCでベンチマークを動かすためのS25FL512Sのモデル
+// 書き込んだページは保存せず、ページ数とレコードの時間の順番だけを調べる
+// ページの書き込みにはLOG67_HOST_FLASH_PAGE_US[us]かかり、その間isBusy()がtrueになる
+#pragma once
+
+#ifndef LOG67_HOST_S25FL512S_H
+#define LOG67_HOST_S25FL512S_H
+#include <SPICREATE.h>
+#include <esp_timer.h>
+
+// S25FL512Sのページ書き込み時間 (typ.)
+#ifndef LOG67_HOST_FLASH_PAGE_US
+#define LOG67_HOST_FLASH_PAGE_US 340
+#endif
+
+uint32_t SPI_FLASH_MAX_ADDRESS = 0x8000000;
+uint32_t SPIFlashLatestAddress = 0x000;
+
+class Flash
+{
+private:
+    int64_t busyUntil = 0;
+    uint32_t lastTime = 0;
+
+public:
+    uint32_t pageCount = 0;
+    // 前のレコードより時間が戻っていたレコードの数 (32byteのレコード、時間は0-3byte)
+    uint32_t orderErrors = 0;
+
+    void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000) {}
+    uint32_t setFlashAddress() { return 0x100; }
+    bool isBusy() { return esp_timer_get_time() < busyUntil; }
+    void write(uint32_t addr, uint8_t *tx)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            const uint8_t *record = &tx[32 * i];
+            uint32_t t = record[0] | record[1] << 8 | record[2] << 16 | (uint32_t)record[3] << 24;
+            if (pageCount + i > 0 && t < lastTime)
+            {
+                orderErrors++;
+            }
+            lastTime = t;
+        }
+        pageCount++;
+        busyUntil = esp_timer_get_time() + LOG67_HOST_FLASH_PAGE_US;
+    }
+};
+
+#endif
@@ -0,0 +1,28 @@
+// PCでベンチマークを動かすためのSPICREATEの代わり センサとSPI Flashのモデルは直接値を返すのでバスは何もしない
+#pragma once
+
+#ifndef LOG67_HOST_SPICREATE_H
+#define LOG67_HOST_SPICREATE_H
+#include "Arduino.h"
+
+#define VSPI 3
+#define HSPI 2
+
+namespace SPICREATE
+{
+    class SPICreate
+    {
+    public:
+        bool begin(uint8_t spi_bus, int8_t pin_sck, int8_t pin_miso, int8_t pin_mosi, uint32_t f = 8000000) { return true; }
+    };
+}
+
+// センサのモデルが作る値のノイズ (線形合同法)
+inline uint32_t log67HostNoise()
+{
+    static uint32_t state = 12345;
+    state = state * 1664525 + 1013904223;
+    return state >> 16;
+}
+
+#endif
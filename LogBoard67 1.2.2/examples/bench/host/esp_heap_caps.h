@@ -0,0 +1,13 @@
+// PCでベンチマークを動かすためのheap_capsの代わり PSRAMはないので全部mallocにする
+#pragma once
+
+#ifndef LOG67_HOST_HEAP_CAPS_H
+#define LOG67_HOST_HEAP_CAPS_H
+#include <stdlib.h>
+
+#define MALLOC_CAP_SPIRAM 0x400
+#define MALLOC_CAP_8BIT 0x4
+inline void *heap_caps_malloc(size_t size, uint32_t caps) { return (caps & MALLOC_CAP_SPIRAM) ? NULL : malloc(size); }
+inline void heap_caps_free(void *ptr) { free(ptr); }
+
+#endif
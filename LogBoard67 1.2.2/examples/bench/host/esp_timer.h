@@ -0,0 +1,32 @@
+// PCでベンチマークを動かすためのesp_timerの代わり 周期タイマは作れない
+#pragma once
+
+#ifndef LOG67_HOST_ESP_TIMER_H
+#define LOG67_HOST_ESP_TIMER_H
+#include "Arduino.h"
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+typedef void *esp_timer_handle_t;
+typedef enum
+{
+    ESP_TIMER_TASK,
+    ESP_TIMER_ISR
+} esp_timer_dispatch_t;
+typedef struct
+{
+    void (*callback)(void *);
+    void *arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char *name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+inline int64_t esp_timer_get_time() { return (int64_t)(log67HostNs() / 1000); }
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t *, esp_timer_handle_t *) { return ESP_FAIL; }
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t, uint64_t) { return ESP_FAIL; }
+inline esp_err_t esp_timer_stop(esp_timer_handle_t) { return ESP_OK; }
+inline esp_err_t esp_timer_delete(esp_timer_handle_t) { return ESP_OK; }
+
+#endif
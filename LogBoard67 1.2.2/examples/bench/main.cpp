@@ -0,0 +1,94 @@
+// LogBoard67のロギングの処理時間を測るベンチマーク
+// BENCH_DURATION_MSの間RoutineWorkを回し、スループットと処理ごとの時間(最小、平均、パーセンタイル、最大)をJSONで1行出力する
+// 出力例: {"bench":"logboard67","duration_ms":10000,"records":9999,"throughput_hz":999.9,"stages":{"total":{...},"h3lis":{...},...}}
+// -DBENCH_PRETRIGGER=2000 等でビルドすると、プリトリガで溜めてから途中でトリガをかけ、溜めた分の書き出しも含めて測る
+// ESP32: SPI Flashに書き込むので、消してもよい状態で実行すること
+// PC: host/のセンサとSPI Flashのモデルで動かす (センサの値は作った値、SPI Flashのページ書き込みは340usとする)
+//   g++ -O2 -I"LogBoard67 1.2.2/examples/bench/host" -I"LogBoard67 1.2.2/src" -I"Log67Timer 1.0.0/src" -I"LPS25HB 1.0.0/src" main.cpp
+//   SPI Flashに書いたページ数と、時間が戻ったレコードの数 (0であること) も出力する
+#define LOG67_BENCH 1
+#include <Arduino.h>
+#include <LogBoard67.h>
+
+// ピンはボードに合わせて変更する
+namespace LOGPIN
+{
+    const int SCK = 33;
+    const int MISO = 25;
+    const int MOSI = 26;
+    const int CS_FLASH = 27;
+    const int CS_H3LIS = 32;
+    const int CS_ICM = 4;
+    const int CS_LPS = 15;
+}
+
+#ifndef BENCH_DURATION_MS
+#define BENCH_DURATION_MS 10000
+#endif
+#define BENCH_PERIOD_US 1000
+// プリトリガで溜めるレコード数 0ならプリトリガを使わない
+#ifndef BENCH_PRETRIGGER
+#define BENCH_PRETRIGGER 0
+#endif
+
+SPICREATE::SPICreate SPIC;
+LogBoard67 logboard;
+
+void setup()
+{
+    Serial.begin(115200);
+    SPIC.begin(VSPI, LOGPIN::SCK, LOGPIN::MISO, LOGPIN::MOSI);
+    flash1.begin(&SPIC, LOGPIN::CS_FLASH, 10000000);
+    H3lis331.begin(&SPIC, LOGPIN::CS_H3LIS, 5000000);
+    icm20948.begin(&SPIC, LOGPIN::CS_ICM, 5000000);
+    Lps25.begin(&SPIC, LOGPIN::CS_LPS, 5000000);
+    SPIFlashLatestAddress = flash1.setFlashAddress();
+    delay(100);
+    // しきい値には届かないので、途中のTrigger()でだけトリガがかかる
+    if (BENCH_PRETRIGGER > 0 && !logboard.SetPreTrigger(BENCH_PRETRIGGER, LOG67_TRIG_H3LIS, 400.0))
+    {
+        Serial.println("failed to allocate the pre-trigger buffer");
+        return;
+    }
+
+    log67Bench.reset();
+    uint32_t start = millis();
+    uint32_t next = micros();
+    bool triggered = false;
+    while (millis() - start < BENCH_DURATION_MS)
+    {
+        // loop()から呼ぶ場合と同じく、決まった周期でRoutineWorkを呼ぶ
+        while ((int32_t)(micros() - next) < 0)
+        {
+        }
+        next += BENCH_PERIOD_US;
+        if (BENCH_PRETRIGGER > 0 && !triggered && millis() - start >= BENCH_DURATION_MS / 2)
+        {
+            logboard.Trigger();
+            triggered = true;
+        }
+        logboard.RoutineWork();
+    }
+    uint32_t duration = millis() - start;
+
+    char json[1024];
+    log67Bench.toJson(json, sizeof(json), getCpuFrequencyMhz(), duration);
+    Serial.println(json);
+#ifndef ARDUINO
+    Serial.printf("{\"flash_pages\":%u,\"order_errors\":%u,\"draining\":%s}\n",
+                  flash1.pageCount, flash1.orderErrors, logboard.IsDrainingPreTrigger() ? "true" : "false");
+#endif
+}
+
+void loop()
+{
+    delay(1000);
+}
+
+#ifndef ARDUINO
+int main()
+{
+    setup();
+    return 0;
+}
+#endif
@@ -0,0 +1,335 @@
+// Log67Flightのリプレイ
+// LogBoard67で記録したレコードを先頭から順にLog67Flight::updateRecord()に入れ、
+// 検出したイベントの時刻と、1レコードあたりの処理時間をJSONで1行出力する
+// 記録がなければ、発射から着地までのレコードを作って使い、実際の時刻との遅れも出す
+// (10G 1.5秒の燃焼、頂点の1秒後に開傘、8m/sで降下 ICM20948は16Gで振り切れる)
+// ESP32: SPI Flashの0x100から読む (処理時間の単位はCPUサイクル、予算は1kHzの1周期)
+// PC: g++ -O2 -I"LogBoard67 1.2.2/src" -I"LPS25HB 1.0.0/src" main.cpp && ./a.out [SPI Flashのダンプ] (単位はns)
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <S25FL512S.h>
+#else
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#endif
+#include "Log67Ring.h"
+#include "Log67Flight.h"
+
+#define REPLAY_FIRST_ADDRESS 0x100
+#define REPLAY_PERIOD_US 1000
+#define REPLAY_LPS_PERIOD 20 // LogBoard67のデフォルト 気圧は20回に1回
+#define REPLAY_SITE_HEIGHT 100.0 // 作る飛行の発射地点の標高[m]
+
+#ifdef ARDUINO
+namespace LOGPIN
+{
+    const int SCK = 33;
+    const int MISO = 25;
+    const int MOSI = 26;
+    const int CS_FLASH = 27;
+}
+SPICREATE::SPICreate SPIC;
+Flash flash;
+#else
+static FILE *dump = NULL;
+#endif
+
+Log67Flight flight;
+
+static uint32_t now()
+{
+#ifdef ARDUINO
+    return ESP.getCycleCount();
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+// 記録の256byteのページを読む なければfalse
+static bool readPage(uint32_t page, uint8_t *buf)
+{
+#ifdef ARDUINO
+    uint32_t addr = REPLAY_FIRST_ADDRESS + page * 256;
+    if (addr >= SPI_FLASH_MAX_ADDRESS)
+    {
+        return false;
+    }
+    flash.read(addr, buf);
+    return true;
+#else
+    // ダンプは0x100からのページを順に並べたもの
+    (void)page;
+    return dump != NULL && fread(buf, 1, 256, dump) == 256;
+#endif
+}
+
+struct ReplayStat
+{
+    uint32_t records;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t over;
+    int64_t detected[LOG67_EVENTS]; // イベントを確定したレコードの時刻
+};
+
+static void replayRecord(const uint8_t *record, int64_t t, uint32_t budget, ReplayStat *st)
+{
+    uint32_t start = now();
+    uint8_t events = flight.updateRecord(record, t);
+    asm volatile("" ::: "memory");
+    uint32_t elapsed = now() - start;
+
+    st->records++;
+    st->sum += elapsed;
+    st->min = (elapsed < st->min) ? elapsed : st->min;
+    st->max = (elapsed > st->max) ? elapsed : st->max;
+    if (elapsed > budget)
+    {
+        st->over++;
+    }
+    for (int i = 0; i < LOG67_EVENTS; i++)
+    {
+        if (events & (1 << i))
+        {
+            st->detected[i] = t;
+        }
+    }
+}
+
+// ---- 作る飛行 ----
+
+static uint32_t lcg = 1;
+static float noise(float amplitude)
+{
+    lcg = lcg * 1103515245 + 12345;
+    return ((int)((lcg >> 8) & 0xFFFF) - 32768) / 32768.0f * amplitude;
+}
+
+static int16_t clip(float v)
+{
+    if (v > 32767)
+    {
+        return 32767;
+    }
+    if (v < -32768)
+    {
+        return -32768;
+    }
+    return (int16_t)v;
+}
+
+// 機軸(+X)方向の加速度センサの値と気圧をレコードにする
+static void makeRecord(uint8_t *record, uint32_t n, float specificForce, double height)
+{
+    memset(record, 0, LOG67_RECORD_SIZE);
+    uint32_t t = n * REPLAY_PERIOD_US;
+    for (int i = 0; i < 4; i++)
+    {
+        record[i] = 0xFF & (t >> (8 * i));
+    }
+    float g = specificForce / LOG67_GRAVITY;
+    // H3LIS331 12bit左詰め リトルエンディアン
+    int16_t h3lis = (int16_t)(clip((g + noise(0.3f)) * LOG67_H3LIS_LSB_PER_G) & 0xFFF0);
+    record[4] = h3lis & 0xFF;
+    record[5] = (h3lis >> 8) & 0xFF;
+    int16_t h3lisZ = clip(noise(0.3f) * LOG67_H3LIS_LSB_PER_G) & 0xFFF0;
+    record[8] = h3lisZ & 0xFF;
+    record[9] = (h3lisZ >> 8) & 0xFF;
+    // ICM20948 ビッグエンディアン
+    int16_t icm = clip((g + noise(0.02f)) * LOG67_ICM_LSB_PER_G);
+    record[10] = (icm >> 8) & 0xFF;
+    record[11] = icm & 0xFF;
+    uint8_t fresh = (1 << LOG67_CH_H3LIS) | (1 << LOG67_CH_ICM);
+    if (n % REPLAY_LPS_PERIOD == 0)
+    {
+        double hPa = 1013.25 * pow(1.0 - (height + REPLAY_SITE_HEIGHT) / 44330.77, 1.0 / 0.190263) + noise(0.03f);
+        uint32_t raw = (uint32_t)(hPa * 4096);
+        record[28] = raw & 0xFF;
+        record[29] = (raw >> 8) & 0xFF;
+        record[30] = (raw >> 16) & 0xFF;
+        fresh |= 1 << LOG67_CH_LPS;
+    }
+    record[LOG67_FRESH_INDEX] = fresh;
+}
+
+// 実際の時刻[us]を truth に入れる
+static void runSynthetic(uint32_t budget, ReplayStat *st, int64_t *truth)
+{
+    const double dt = REPLAY_PERIOD_US * 1e-6;
+    const double launch = 2.0, burn = 1.5, thrust = 10.0 * LOG67_GRAVITY;
+    const double drag = 0.0015;         // 上昇中の抗力 / 質量 = drag * v^2
+    const double chute = LOG67_GRAVITY / 64.0; // 開傘後 終端速度8m/s
+    double h = 0, v = 0;
+    double apogee = -1;
+    uint8_t record[LOG67_RECORD_SIZE];
+    for (int i = 0; i < LOG67_EVENTS; i++)
+    {
+        truth[i] = -1;
+    }
+    for (uint32_t n = 0; n < 200000; n++)
+    {
+        double t = n * dt;
+        double f = 0; // 機軸方向の加速度センサの値 (重力を除く力 / 質量)
+        if (t < launch || truth[3] >= 0)
+        {
+            f = LOG67_GRAVITY;
+        }
+        else
+        {
+            if (truth[0] < 0)
+            {
+                truth[0] = (int64_t)(t * 1e6);
+            }
+            if (t < launch + burn)
+            {
+                f = thrust;
+            }
+            else if (truth[1] < 0)
+            {
+                truth[1] = (int64_t)(t * 1e6);
+            }
+            if (apogee < 0 || t < apogee + 1.0)
+            {
+                f -= drag * v * fabs(v);
+            }
+            else
+            {
+                // 開傘後は向きが定まらないので大きさだけ
+                f = chute * v * v;
+            }
+            v += (f - LOG67_GRAVITY) * dt;
+            h += v * dt;
+            if (apogee < 0 && v < 0)
+            {
+                apogee = t;
+                truth[2] = (int64_t)(t * 1e6);
+            }
+            if (h <= 0 && t > launch + burn)
+            {
+                h = 0;
+                v = 0;
+                truth[3] = (int64_t)(t * 1e6);
+            }
+        }
+        makeRecord(record, n, (float)f, h);
+        replayRecord(record, (int64_t)n * REPLAY_PERIOD_US, budget, st);
+        // 着地して5秒たったら終わり
+        if (truth[3] >= 0 && t * 1e6 > truth[3] + 5e6)
+        {
+            break;
+        }
+    }
+}
+
+static void runReplay()
+{
+    flight.begin();
+    flight.setAxis(0);
+#ifdef ARDUINO
+    uint32_t budget = getCpuFrequencyMhz() * REPLAY_PERIOD_US;
+#else
+    uint32_t budget = REPLAY_PERIOD_US * 1000;
+#endif
+    ReplayStat st = {0, 0xFFFFFFFF, 0, 0, 0, {-1, -1, -1, -1}};
+
+    // 記録を最後(消去したままの0xFF)まで読む 時刻はエポックのレコードの上位32bitとつなげる
+    static uint8_t page[256];
+    uint32_t epochHigh = 0;
+    bool end = false;
+    for (uint32_t p = 0; !end && readPage(p, page); p++)
+    {
+        for (int r = 0; r < 256 / LOG67_RECORD_SIZE; r++)
+        {
+            const uint8_t *rec = page + r * LOG67_RECORD_SIZE;
+            bool blank = true;
+            for (int k = 0; k < LOG67_RECORD_SIZE && blank; k++)
+            {
+                blank = rec[k] == 0xFF;
+            }
+            if (blank)
+            {
+                end = true;
+                break;
+            }
+            uint32_t low = rec[0] | rec[1] << 8 | rec[2] << 16 | (uint32_t)rec[3] << 24;
+            if (rec[LOG67_FRESH_INDEX] & LOG67_EPOCH_FLAG)
+            {
+                epochHigh = rec[4] | rec[5] << 8 | rec[6] << 16 | (uint32_t)rec[7] << 24;
+                continue;
+            }
+            replayRecord(rec, ((int64_t)epochHigh << 32) | low, budget, &st);
+        }
+    }
+    const char *source = "flash";
+    int64_t truth[LOG67_EVENTS] = {-1, -1, -1, -1};
+    if (st.records == 0)
+    {
+        source = "synthetic";
+        runSynthetic(budget, &st, truth);
+    }
+
+    static const char *names[LOG67_EVENTS] = {"launch", "burnout", "apogee", "landing"};
+    char buf[768];
+    int n = snprintf(buf, sizeof(buf),
+                     "{\"bench\":\"log67flight\",\"source\":\"%s\",\"records\":%u,\"time\":{\"min\":%u,\"mean\":%u,\"max\":%u},"
+                     "\"budget\":%u,\"over\":%u,\"max_height\":%.1f,\"events\":{",
+                     source, (unsigned)st.records, (unsigned)(st.records ? st.min : 0),
+                     (unsigned)(st.records ? st.sum / st.records : 0), (unsigned)st.max, (unsigned)budget,
+                     (unsigned)st.over, flight.getMaxHeight());
+    for (int i = 0; i < LOG67_EVENTS; i++)
+    {
+        // start: 条件を満たし始めた時刻, detected: 確定した時刻, latency: 実際の時刻から確定までの遅れ (作った飛行のみ)
+        int64_t start = flight.getEventTime(1 << i);
+        n += snprintf(buf + n, sizeof(buf) - n, "%s\"%s\":{\"start_ms\":%.1f,\"detected_ms\":%.1f",
+                      i ? "," : "", names[i], start / 1000.0, st.detected[i] / 1000.0);
+        if (truth[i] >= 0 && st.detected[i] >= 0)
+        {
+            n += snprintf(buf + n, sizeof(buf) - n, ",\"latency_ms\":%.1f", (st.detected[i] - truth[i]) / 1000.0);
+        }
+        n += snprintf(buf + n, sizeof(buf) - n, "}");
+    }
+    snprintf(buf + n, sizeof(buf) - n, "}}");
+#ifdef ARDUINO
+    Serial.println(buf);
+#else
+    puts(buf);
+#endif
+}
+
+#ifdef ARDUINO
+void setup()
+{
+    Serial.begin(115200);
+    SPIC.begin(VSPI, LOGPIN::SCK, LOGPIN::MISO, LOGPIN::MOSI);
+    flash.begin(&SPIC, LOGPIN::CS_FLASH, 10000000);
+    delay(1000);
+    runReplay();
+}
+
+void loop()
+{
+}
+#else
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        dump = fopen(argv[1], "rb");
+        if (dump == NULL)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+    runReplay();
+    if (dump != NULL)
+    {
+        fclose(dump);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,185 @@
+// version: 1.2.2
+#pragma once
+
+#ifndef Log67Bench_H
+#define Log67Bench_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// ベンチマークで測る処理
+#define LOG67_STAGE_TOTAL 0 // 1レコード分 (RoutineWork、またはサンプリングタスクの1周)
+#define LOG67_STAGE_H3LIS 1 // H3lis331.Get2
+#define LOG67_STAGE_ICM 2   // icm20948.GetAll (加速度、角速度、地磁気)
+#define LOG67_STAGE_LPS 3   // Lps25.Get
+#define LOG67_STAGE_FLASH 4 // flash1.write (書き込み完了待ちを含む)
+#define LOG67_STAGE_FLIGHT 5 // flight.updateRecord (BeginFlightしたとき)
+#define LOG67_STAGE_HEALTH 6 // log67Health.run (BeginHealthしたとき)
+#define LOG67_BENCH_STAGES 7
+
+// ヒストグラムのビン数 16未満はそのまま、それ以上は1オクターブを16分割する (誤差6%以内)
+#define LOG67_BENCH_BINS 464
+
+/**
+ * @brief 処理時間の統計 (最小、最大、平均、パーセンタイル)
+ * 値の単位は何でもよい (LogBoard67ではCPUのサイクル数)
+ * Arduinoに依存しないのでPC上でも使える
+ */
+class Log67BenchStat
+{
+private:
+    uint32_t hist[LOG67_BENCH_BINS] = {};
+
+    static uint16_t toBin(uint32_t value);
+    static uint32_t binUpper(uint16_t bin);
+
+public:
+    uint32_t count = 0;
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    uint64_t sum = 0;
+
+    void add(uint32_t value);
+    void reset();
+    // p[%]パーセンタイルの値 (ビンの上限なので少し大きめに出る)
+    uint32_t percentile(float p);
+};
+
+/**
+ * @brief LogBoard67の処理ごとの時間を集計する
+ * LOG67_BENCHを1にしてLogBoard67.hをincludeすると、log67Benchに自動で記録される
+ */
+class Log67Bench
+{
+public:
+    Log67BenchStat stage[LOG67_BENCH_STAGES];
+
+    void add(uint8_t st, uint32_t value)
+    {
+        if (st < LOG67_BENCH_STAGES)
+        {
+            stage[st].add(value);
+        }
+    }
+    void reset();
+    /**
+     * @brief 結果をJSONで1行に書き出す
+     * @param[out] buf 書き出し先 (1024byte程度あれば足りる)
+     * @param[in] len bufの大きさ
+     * @param[in] unitsPerUs 値1usあたりの値 (サイクル数ならCPUの周波数[MHz])
+     * @param[in] durationMs 測定した時間[ms] (スループットの計算に使う)
+     * @return 書き出した文字数
+     */
+    int toJson(char *buf, size_t len, float unitsPerUs, uint32_t durationMs);
+};
+
+uint16_t Log67BenchStat::toBin(uint32_t value)
+{
+    if (value < 16)
+    {
+        return value;
+    }
+    int msb = 31 - __builtin_clz(value);
+    return (msb - 3) * 16 + ((value >> (msb - 4)) & 15);
+}
+
+uint32_t Log67BenchStat::binUpper(uint16_t bin)
+{
+    if (bin < 16)
+    {
+        return bin;
+    }
+    int msb = bin / 16 + 3;
+    uint64_t upper = ((uint64_t)(16 + bin % 16 + 1) << (msb - 4)) - 1;
+    return (upper > UINT32_MAX) ? UINT32_MAX : (uint32_t)upper;
+}
+
+void Log67BenchStat::add(uint32_t value)
+{
+    hist[toBin(value)]++;
+    count++;
+    sum += value;
+    if (value < min)
+    {
+        min = value;
+    }
+    if (value > max)
+    {
+        max = value;
+    }
+}
+
+void Log67BenchStat::reset()
+{
+    for (int i = 0; i < LOG67_BENCH_BINS; i++)
+    {
+        hist[i] = 0;
+    }
+    count = 0;
+    min = UINT32_MAX;
+    max = 0;
+    sum = 0;
+}
+
+uint32_t Log67BenchStat::percentile(float p)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(count * p / 100.0f + 0.5f);
+    if (target == 0)
+    {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < LOG67_BENCH_BINS; i++)
+    {
+        seen += hist[i];
+        if (seen >= target)
+        {
+            uint32_t upper = binUpper(i);
+            return (upper > max) ? max : upper;
+        }
+    }
+    return max;
+}
+
+void Log67Bench::reset()
+{
+    for (int i = 0; i < LOG67_BENCH_STAGES; i++)
+    {
+        stage[i].reset();
+    }
+}
+
+int Log67Bench::toJson(char *buf, size_t len, float unitsPerUs, uint32_t durationMs)
+{
+    static const char *names[LOG67_BENCH_STAGES] = {"total", "h3lis", "icm", "lps", "flash", "flight", "health"};
+    size_t n = 0;
+    float seconds = durationMs / 1000.0f;
+    n += snprintf(buf + n, (n < len) ? len - n : 0,
+                  "{\"bench\":\"logboard67\",\"duration_ms\":%u,\"records\":%u,\"throughput_hz\":%.1f,\"stages\":{",
+                  (unsigned)durationMs, (unsigned)stage[LOG67_STAGE_TOTAL].count,
+                  (seconds > 0) ? stage[LOG67_STAGE_TOTAL].count / seconds : 0.0f);
+    bool first = true;
+    for (int i = 0; i < LOG67_BENCH_STAGES; i++)
+    {
+        Log67BenchStat &s = stage[i];
+        if (s.count == 0)
+        {
+            continue;
+        }
+        n += snprintf(buf + n, (n < len) ? len - n : 0,
+                      "%s\"%s\":{\"n\":%u,\"min_us\":%.2f,\"mean_us\":%.2f,\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}",
+                      first ? "" : ",", names[i], (unsigned)s.count,
+                      s.min / unitsPerUs, (float)s.sum / s.count / unitsPerUs,
+                      s.percentile(50) / unitsPerUs, s.percentile(90) / unitsPerUs,
+                      s.percentile(99) / unitsPerUs, s.max / unitsPerUs);
+        first = false;
+    }
+    n += snprintf(buf + n, (n < len) ? len - n : 0, "}}");
+    return (int)n;
+}
+
+#endif
@@ -0,0 +1,390 @@
+// version: 1.2.2
+#pragma once
+
+#ifndef Log67Flight_H
+#define Log67Flight_H
+#include <stdint.h>
+#include <math.h>
+#include <LPSAltitude.h> // 1.0.0
+#include "Log67Record.h"
+
+// 飛行の状態
+#define LOG67_FLIGHT_PAD 0     // 発射前
+#define LOG67_FLIGHT_BOOST 1   // 燃焼中
+#define LOG67_FLIGHT_COAST 2   // 慣性飛行
+#define LOG67_FLIGHT_DESCENT 3 // 頂点の後
+#define LOG67_FLIGHT_LANDED 4
+
+// イベント (update()の戻り値、getEvents()のビット)
+#define LOG67_EVENT_LAUNCH 0x01
+#define LOG67_EVENT_BURNOUT 0x02
+#define LOG67_EVENT_APOGEE 0x04
+#define LOG67_EVENT_LANDING 0x08
+#define LOG67_EVENTS 4
+
+#define LOG67_GRAVITY 9.80665f
+// サンプルの間隔がこれより空いたら、この分だけ進める (記録の途切れで推定が飛ばないように)
+#define LOG67_FLIGHT_MAX_DT 0.1f
+
+/**
+ * @brief 発射、燃焼終了、頂点、着地を検出する
+ * 高さ、鉛直速度、加速度センサのバイアスの3状態のカルマンフィルタで、
+ * 機軸方向の加速度で予測し、気圧高度で補正する
+ * 毎サンプルの計算は状態によらずほぼ一定 (3x3の行列の積と、気圧を読んだときだけ補正1回)
+ *
+ * 検出の遅れ (各条件が続いたら確定するので、最大でその時間 + フィルタの遅れ)
+ *   発射: 加速度がlaunchAccel以上でlaunchHoldUs (予備: 速度がlaunchVelocity以上)
+ *   燃焼終了: 加速度がburnoutAccel未満でburnoutHoldUs
+ *   頂点: 速度が負でapogeeHoldUs (予備: 最高高度からapogeeDrop下がった)
+ *   着地: 速度がlandingSpeed未満、高さの変化がlandingBand以内でlandingHoldUs
+ * getEventTime()は条件を満たし始めた時刻 (確定した時刻ではない)
+ * 頂点の後は機軸が鉛直とは限らないので、加速度を使わず気圧だけで推定する
+ *
+ * Arduinoに依存しないので、PCで記録を再生して確かめられる (examples/flight)
+ *
+ * ```cpp
+ * // example: LogBoard67のレコードから (logboard.BeginFlight()を使えばサンプリングタスクで呼ばれる)
+ * Log67Flight flight;
+ * flight.begin();        // 海面気圧 1013.25hPa 地上の高さは発射前の気圧から自動で合わせる
+ * flight.setAxis(0);     // 機体の上向きがセンサの+X
+ * uint8_t events = flight.updateRecord(record, t);
+ * if (events & LOG67_EVENT_APOGEE) { ... }
+ * ```
+ */
+class Log67Flight
+{
+private:
+    // 状態 [高さ m, 速度 m/s, 加速度のバイアス m/s^2] と誤差の共分散
+    float x[3] = {};
+    float P[3][3] = {};
+    int64_t lastT = -1;
+    float accUp = LOG67_GRAVITY;
+
+    uint8_t state = LOG67_FLIGHT_PAD;
+    volatile uint8_t events = 0;
+    int64_t eventTime[LOG67_EVENTS] = {};
+    int64_t holdStart = -1;
+    float holdHeight = 0;
+    float maxHeight = 0;
+
+    // updateRecord用
+    LPSAltitude altitude;
+    uint8_t axis = 0;
+    bool invert = false;
+    bool groundSet = false;
+    int32_t groundMm = 0;
+
+    void predict(float dt);
+    void correct(float height, float sigma);
+    bool hold(bool condition, int64_t t, uint32_t us);
+    uint8_t detect(int64_t t);
+    void fire(uint8_t event, int64_t t, uint8_t next);
+
+public:
+    // 検出のしきい値 (単位はm, m/s, m/s^2, us)
+    float launchAccel = 3.0f * LOG67_GRAVITY; // 加速度センサの値 (静止で+1G)
+    uint32_t launchHoldUs = 30000;
+    float launchVelocity = 25.0f;
+    float burnoutAccel = 0.0f; // 推力がなくなると抗力で負になる
+    uint32_t burnoutHoldUs = 30000;
+    uint32_t apogeeHoldUs = 50000;
+    float apogeeDrop = 5.0f;
+    float landingSpeed = 2.0f;
+    float landingBand = 2.0f;
+    uint32_t landingHoldUs = 2000000;
+
+    // カルマンフィルタの雑音
+    float accelSigma = 1.0f;     // 加速度 [m/s^2]
+    float descentSigma = 5.0f;   // 頂点の後、加速度を使わないときの速度の変化 [m/s^2]
+    float biasSigma = 0.05f;     // バイアスのランダムウォーク [m/s^2/√s]
+    float baroSigma = 0.5f;      // 気圧高度 [m]
+    float boostBaroSigma = 5.0f; // 燃焼中は機体まわりの流れで気圧が乱れるので信用しない [m]
+
+    // ICM20948の加速度の大きさがこれ[G]を超えたらH3LIS331の値を使う (ICM20948は16Gで振り切れる)
+    float highGSwitch = 15.0f;
+
+    /**
+     * @brief 状態を発射前に戻す
+     * @param[in] seaLevelHPa 気圧高度の表を作る海面気圧[hPa] (updateRecordで使う)
+     * @retval false: seaLevelHPaが0以下
+     */
+    bool begin(float seaLevelHPa = 1013.25f);
+    void reset();
+    // 機体の上向きの軸 0: X, 1: Y, 2: Z invertなら-方向が上
+    void setAxis(uint8_t upAxis, bool upInvert = false)
+    {
+        axis = (upAxis < 3) ? upAxis : 0;
+        invert = upInvert;
+    }
+
+    /**
+     * @brief 1サンプル進める
+     * @param[in] t 時刻[us]
+     * @param[in] acc 機軸方向の加速度センサの値[m/s^2] (静止で+9.8) accFreshがfalseなら前の値を使う
+     * @param[in] height 地上からの気圧高度[m] heightFreshがfalseなら補正しない
+     * @return このサンプルで起きたイベント (LOG67_EVENT_～のOR)
+     */
+    uint8_t update(int64_t t, float acc, bool accFresh, float height, bool heightFresh);
+    // LogBoard67のレコード1つから進める エポックのレコードは0を返す
+    uint8_t updateRecord(const uint8_t *record, int64_t t);
+
+    uint8_t getState() const { return state; }
+    // これまでに起きたイベント
+    uint8_t getEvents() const { return events; }
+    // eventは LOG67_EVENT_～ のどれか1つ 起きていなければ-1
+    int64_t getEventTime(uint8_t event) const;
+    float getHeight() const { return x[0]; }
+    float getVelocity() const { return x[1]; }
+    float getAccelBias() const { return x[2]; }
+    float getMaxHeight() const { return maxHeight; }
+};
+
+bool Log67Flight::begin(float seaLevelHPa)
+{
+    if (!altitude.begin(seaLevelHPa))
+    {
+        return false;
+    }
+    reset();
+    return true;
+}
+
+void Log67Flight::reset()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        x[i] = 0;
+        for (int j = 0; j < 3; j++)
+        {
+            P[i][j] = 0;
+        }
+    }
+    // 最初は高さとバイアスが分からない
+    P[0][0] = 100.0f;
+    P[1][1] = 1.0f;
+    P[2][2] = 1.0f;
+    lastT = -1;
+    accUp = LOG67_GRAVITY;
+    state = LOG67_FLIGHT_PAD;
+    events = 0;
+    for (int i = 0; i < LOG67_EVENTS; i++)
+    {
+        eventTime[i] = -1;
+    }
+    holdStart = -1;
+    maxHeight = 0;
+    groundSet = false;
+    groundMm = 0;
+}
+
+// x = F x + B u, P = F P F^T + Q
+// 頂点までは a = acc - g - bias、頂点の後は a = 0 で速度の変化を雑音として扱う
+void Log67Flight::predict(float dt)
+{
+    bool useAcc = state < LOG67_FLIGHT_DESCENT;
+    float h = 0.5f * dt * dt;
+    float a = useAcc ? accUp - LOG67_GRAVITY - x[2] : 0.0f;
+    x[0] += x[1] * dt + a * h;
+    x[1] += a * dt;
+
+    // F = [[1, dt, -h], [0, 1, -dt], [0, 0, 1]] (加速度を使わないときはバイアスの列が0)
+    float f02 = useAcc ? -h : 0.0f;
+    float f12 = useAcc ? -dt : 0.0f;
+    float FP[3][3];
+    for (int j = 0; j < 3; j++)
+    {
+        FP[0][j] = P[0][j] + dt * P[1][j] + f02 * P[2][j];
+        FP[1][j] = P[1][j] + f12 * P[2][j];
+        FP[2][j] = P[2][j];
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        P[i][0] = FP[i][0] + dt * FP[i][1] + f02 * FP[i][2];
+        P[i][1] = FP[i][1] + f12 * FP[i][2];
+        P[i][2] = FP[i][2];
+    }
+    // Q = q * g g^T, g = [h, dt, 0]
+    float sigma = useAcc ? accelSigma : descentSigma;
+    float q = sigma * sigma;
+    P[0][0] += q * h * h;
+    P[0][1] += q * h * dt;
+    P[1][0] += q * h * dt;
+    P[1][1] += q * dt * dt;
+    P[2][2] += biasSigma * biasSigma * dt;
+}
+
+// 高さだけを観測する H = [1, 0, 0]
+void Log67Flight::correct(float height, float sigma)
+{
+    float s = P[0][0] + sigma * sigma;
+    float k[3] = {P[0][0] / s, P[1][0] / s, P[2][0] / s};
+    float y = height - x[0];
+    float p0[3] = {P[0][0], P[0][1], P[0][2]};
+    for (int i = 0; i < 3; i++)
+    {
+        x[i] += k[i] * y;
+        for (int j = 0; j < 3; j++)
+        {
+            P[i][j] -= k[i] * p0[j];
+        }
+    }
+}
+
+// conditionがusの間続いたらtrue 続き始めた時刻はholdStartに残る
+bool Log67Flight::hold(bool condition, int64_t t, uint32_t us)
+{
+    if (!condition)
+    {
+        holdStart = -1;
+        return false;
+    }
+    if (holdStart < 0)
+    {
+        holdStart = t;
+        holdHeight = x[0];
+    }
+    return t - holdStart >= (int64_t)us;
+}
+
+void Log67Flight::fire(uint8_t event, int64_t t, uint8_t next)
+{
+    eventTime[__builtin_ctz(event)] = t;
+    events |= event;
+    state = next;
+    holdStart = -1;
+}
+
+uint8_t Log67Flight::detect(int64_t t)
+{
+    uint8_t fired = 0;
+    switch (state)
+    {
+    case LOG67_FLIGHT_PAD:
+        if (hold(accUp >= launchAccel, t, launchHoldUs))
+        {
+            fire(LOG67_EVENT_LAUNCH, holdStart, LOG67_FLIGHT_BOOST);
+            fired = LOG67_EVENT_LAUNCH;
+        }
+        else if (x[1] >= launchVelocity)
+        {
+            fire(LOG67_EVENT_LAUNCH, t, LOG67_FLIGHT_BOOST);
+            fired = LOG67_EVENT_LAUNCH;
+        }
+        break;
+    case LOG67_FLIGHT_BOOST:
+        if (hold(accUp < burnoutAccel, t, burnoutHoldUs))
+        {
+            fire(LOG67_EVENT_BURNOUT, holdStart, LOG67_FLIGHT_COAST);
+            fired = LOG67_EVENT_BURNOUT;
+        }
+        // 燃焼終了を見逃して落ち始めていたら、燃焼終了と頂点を同時に出す
+        else if (x[0] < maxHeight - apogeeDrop)
+        {
+            fire(LOG67_EVENT_BURNOUT, t, LOG67_FLIGHT_COAST);
+            fire(LOG67_EVENT_APOGEE, t, LOG67_FLIGHT_DESCENT);
+            fired = LOG67_EVENT_BURNOUT | LOG67_EVENT_APOGEE;
+        }
+        break;
+    case LOG67_FLIGHT_COAST:
+        if (hold(x[1] < 0, t, apogeeHoldUs))
+        {
+            fire(LOG67_EVENT_APOGEE, holdStart, LOG67_FLIGHT_DESCENT);
+            fired = LOG67_EVENT_APOGEE;
+        }
+        else if (x[0] < maxHeight - apogeeDrop)
+        {
+            fire(LOG67_EVENT_APOGEE, t, LOG67_FLIGHT_DESCENT);
+            fired = LOG67_EVENT_APOGEE;
+        }
+        break;
+    case LOG67_FLIGHT_DESCENT:
+        // 高さがholdHeightからlandingBand以上変わったら数え直す
+        if (holdStart >= 0 && fabsf(x[0] - holdHeight) > landingBand)
+        {
+            holdStart = -1;
+        }
+        if (hold(fabsf(x[1]) < landingSpeed, t, landingHoldUs))
+        {
+            fire(LOG67_EVENT_LANDING, holdStart, LOG67_FLIGHT_LANDED);
+            fired = LOG67_EVENT_LANDING;
+        }
+        break;
+    default:
+        break;
+    }
+    return fired;
+}
+
+uint8_t Log67Flight::update(int64_t t, float acc, bool accFresh, float height, bool heightFresh)
+{
+    if (accFresh)
+    {
+        accUp = acc;
+    }
+    if (lastT >= 0 && t > lastT)
+    {
+        float dt = (t - lastT) * 1e-6f;
+        predict((dt < LOG67_FLIGHT_MAX_DT) ? dt : LOG67_FLIGHT_MAX_DT);
+    }
+    lastT = t;
+    if (heightFresh)
+    {
+        correct(height, (state == LOG67_FLIGHT_BOOST) ? boostBaroSigma : baroSigma);
+    }
+    if (x[0] > maxHeight)
+    {
+        maxHeight = x[0];
+    }
+    return detect(t);
+}
+
+uint8_t Log67Flight::updateRecord(const uint8_t *record, int64_t t)
+{
+    uint8_t fresh = record[LOG67_FRESH_INDEX];
+    if (fresh & LOG67_EPOCH_FLAG)
+    {
+        return 0;
+    }
+    // 上向きの軸の加速度[G] ICM20948はビッグエンディアン、H3LIS331はリトルエンディアン
+    // ICM20948が振り切れそうならH3LIS331 (新しく読んでいなくても直前の値が入っている)
+    bool accFresh = fresh & ((1 << LOG67_CH_ICM) | (1 << LOG67_CH_H3LIS));
+    int16_t icm = (int16_t)(record[10 + 2 * axis] << 8 | record[11 + 2 * axis]);
+    int16_t h3lis = (int16_t)(record[5 + 2 * axis] << 8 | record[4 + 2 * axis]);
+    float g = icm / LOG67_ICM_LSB_PER_G;
+    if (!(fresh & (1 << LOG67_CH_ICM)) || fabsf(g) > highGSwitch)
+    {
+        g = h3lis / LOG67_H3LIS_LSB_PER_G;
+    }
+    float acc = (invert ? -g : g) * LOG67_GRAVITY;
+
+    bool heightFresh = fresh & (1 << LOG67_CH_LPS);
+    float height = 0;
+    if (heightFresh)
+    {
+        uint32_t raw = record[28] | record[29] << 8 | (uint32_t)record[30] << 16;
+        int32_t mm = altitude.altitudeMm(raw);
+        // 発射前は地上の気圧をゆっくり追いかける (天気による変化を消す)
+        if (!groundSet)
+        {
+            groundMm = mm;
+            groundSet = true;
+        }
+        else if (state == LOG67_FLIGHT_PAD)
+        {
+            groundMm += (mm - groundMm) / 64;
+        }
+        height = (mm - groundMm) * 0.001f;
+    }
+    return update(t, acc, accFresh, height, heightFresh);
+}
+
+int64_t Log67Flight::getEventTime(uint8_t event) const
+{
+    if (event == 0 || !(events & event))
+    {
+        return -1;
+    }
+    return eventTime[__builtin_ctz(event)];
+}
+
+#endif
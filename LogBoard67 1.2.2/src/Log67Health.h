@@ -0,0 +1,309 @@
+// version: 1.2.2
+#pragma once
+
+#ifndef Log67Health_H
+#define Log67Health_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// 見張れるセンサの数
+#define LOG67_HEALTH_MAX_SENSORS 4
+// 固着を調べるレコードの中の値の最大byte数 (ICM20948の加速度と角速度で12)
+#define LOG67_HEALTH_MAX_BYTES 12
+
+// センサの状態
+#define LOG67_HEALTH_OK 0
+#define LOG67_HEALTH_SUSPECT 1 // 異常を見つけたが、まだ続いていない
+#define LOG67_HEALTH_FAILED 2  // 異常が続いた 再初期化を待っている
+
+// 見つけた異常 (getFaults()のビット)
+#define LOG67_FAULT_WHOAMI 0x01 // WhoAmIが違う
+#define LOG67_FAULT_FROZEN 0x02 // 値がfrozenUsの間まったく変わらない
+#define LOG67_FAULT_RANGE 0x04  // 全部0xFF (zeroValidでなければ全部0も)、またはvalid()がfalse
+#define LOG67_FAULT_SPI 0x08    // SPI通信のエラーが増えた
+
+/**
+ * @brief 見張るセンサの設定
+ * 関数はNULLなら使わない
+ */
+struct Log67HealthSensor
+{
+    bool (*whoAmI)();                     // WhoAmIが正しければtrue
+    bool (*reinit)();                     // 設定を書き直す 成功したらtrue
+    uint32_t (*spiErrors)();              // SPI通信のエラーの累計
+    bool (*valid)(const uint8_t *record); // レコードの値が範囲内ならtrue
+    uint8_t offset;                       // レコードの中の値の位置
+    uint8_t length;                       // 値のbyte数 (LOG67_HEALTH_MAX_BYTES以下)
+    bool zeroValid;                       // 全部0の値がありえるならtrue (自由落下で0Gになる加速度等)
+    uint32_t frozenUs;                    // 値がこの時間変わらなければ固着 センサを読む周期より十分長くする
+};
+
+/**
+ * @brief センサの異常を見つけて、再初期化する
+ * run()を呼ぶたびにセンサ1つだけを調べる (順番に回る) ので、毎サンプルではなく間引いて呼ぶ
+ * LogBoard67ではスケジューラのチャンネルとして登録する (BeginHealth)
+ * 調べること
+ *   値が変わらない (固着)、全部0xFF / 全部0 (CSやMISOの異常)、範囲外
+ *   SPI通信のエラー (SPICreate::getErrorCount)
+ *   whoAmIEvery回に1回のWhoAmI (SPIの通信が1回増える)
+ * 異常がfailChecks回続いたらFAILEDにして、reinit()を呼ぶ
+ * 失敗したら間隔をminRetryUsから倍々にmaxRetryUsまで延ばして呼び直す
+ * 直ってからmaxRetryUsの間異常がなければ、間隔をminRetryUsに戻す
+ * 時刻はレコードの0-3byte (時間の下位32bit) を使う
+ * Arduinoに依存しないのでPC上でも使える
+ *
+ * ```cpp
+ * // example
+ * Log67HealthSensor lps = {lpsWhoAmI, lpsReinit, lpsSpiErrors, lpsValid, 28, 3, false, 1000000};
+ * health.setSensor(0, lps);
+ * health.run(record); // 100サンプルに1回等
+ * if (health.getStatus(0) != LOG67_HEALTH_OK) { ... }
+ * ```
+ */
+class Log67Health
+{
+private:
+    struct State
+    {
+        Log67HealthSensor cfg;
+        bool used;
+        uint8_t status;
+        uint8_t faults;
+        uint8_t lastFaults;
+        uint8_t badChecks;
+        uint16_t whoAmICount;
+        uint8_t snapshot[LOG67_HEALTH_MAX_BYTES];
+        bool snapshotValid;
+        uint32_t lastChange;
+        uint32_t spiErrors;
+        uint32_t retryAt;
+        uint32_t retryDelay;
+        uint32_t recoveredAt;
+        bool recovered;
+    };
+    State sensors[LOG67_HEALTH_MAX_SENSORS] = {};
+    uint8_t next = 0;
+
+    void check(State &s, const uint8_t *record, uint32_t now);
+    void tryReinit(State &s, const uint8_t *record, uint32_t now);
+    void restart(State &s, const uint8_t *record, uint32_t now);
+
+public:
+    uint16_t whoAmIEvery = 10;
+    uint8_t failChecks = 2;
+    uint32_t minRetryUs = 100000;
+    uint32_t maxRetryUs = 10000000;
+
+    // 数える
+    uint32_t failCount[LOG67_HEALTH_MAX_SENSORS] = {};    // FAILEDになった回数
+    uint32_t reinitCount[LOG67_HEALTH_MAX_SENSORS] = {};  // reinit()を呼んだ回数
+    uint32_t recoverCount[LOG67_HEALTH_MAX_SENSORS] = {}; // reinit()で直った回数
+
+    /**
+     * @brief センサを登録する 登録済みなら上書きする
+     * @retval false: iかlengthが範囲外
+     */
+    bool setSensor(uint8_t i, const Log67HealthSensor &sensor);
+    void removeSensor(uint8_t i);
+
+    // 次のセンサを1つ調べる recordは最新のレコード
+    void run(const uint8_t *record);
+
+    uint8_t getStatus(uint8_t i) const { return (i < LOG67_HEALTH_MAX_SENSORS) ? sensors[i].status : LOG67_HEALTH_OK; }
+    // これまでに見つけた異常 (clearFaultsまで残る)
+    uint8_t getFaults(uint8_t i) const { return (i < LOG67_HEALTH_MAX_SENSORS) ? sensors[i].faults : 0; }
+    // 最後に調べたときの異常
+    uint8_t getLastFaults(uint8_t i) const { return (i < LOG67_HEALTH_MAX_SENSORS) ? sensors[i].lastFaults : 0; }
+    void clearFaults(uint8_t i)
+    {
+        if (i < LOG67_HEALTH_MAX_SENSORS)
+        {
+            sensors[i].faults = 0;
+        }
+    }
+    // FAILEDのセンサのビットマスク
+    uint8_t failedMask() const;
+};
+
+bool Log67Health::setSensor(uint8_t i, const Log67HealthSensor &sensor)
+{
+    if (i >= LOG67_HEALTH_MAX_SENSORS || sensor.length == 0 || sensor.length > LOG67_HEALTH_MAX_BYTES ||
+        sensor.offset + sensor.length > 32)
+    {
+        return false;
+    }
+    State &s = sensors[i];
+    memset(&s, 0, sizeof(s));
+    s.cfg = sensor;
+    s.retryDelay = minRetryUs;
+    s.used = true;
+    return true;
+}
+
+void Log67Health::removeSensor(uint8_t i)
+{
+    if (i < LOG67_HEALTH_MAX_SENSORS)
+    {
+        sensors[i].used = false;
+        sensors[i].status = LOG67_HEALTH_OK;
+    }
+}
+
+uint8_t Log67Health::failedMask() const
+{
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < LOG67_HEALTH_MAX_SENSORS; i++)
+    {
+        if (sensors[i].used && sensors[i].status == LOG67_HEALTH_FAILED)
+        {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+void Log67Health::run(const uint8_t *record)
+{
+    uint32_t now = record[0] | record[1] << 8 | record[2] << 16 | (uint32_t)record[3] << 24;
+    for (uint8_t n = 0; n < LOG67_HEALTH_MAX_SENSORS; n++)
+    {
+        uint8_t i = next;
+        next = (next + 1) % LOG67_HEALTH_MAX_SENSORS;
+        if (sensors[i].used)
+        {
+            check(sensors[i], record, now);
+            return;
+        }
+    }
+}
+
+// 固着の判定とSPIのエラーの数を今の値からやり直す
+void Log67Health::restart(State &s, const uint8_t *record, uint32_t now)
+{
+    memcpy(s.snapshot, record + s.cfg.offset, s.cfg.length);
+    s.snapshotValid = true;
+    s.lastChange = now;
+    s.spiErrors = s.cfg.spiErrors ? s.cfg.spiErrors() : 0;
+    s.badChecks = 0;
+    s.whoAmICount = 0;
+}
+
+void Log67Health::tryReinit(State &s, const uint8_t *record, uint32_t now)
+{
+    if ((int32_t)(now - s.retryAt) < 0)
+    {
+        return;
+    }
+    uint8_t i = &s - sensors;
+    reinitCount[i]++;
+    bool ok = s.cfg.reinit != NULL && s.cfg.reinit();
+    if (ok && s.cfg.whoAmI != NULL)
+    {
+        ok = s.cfg.whoAmI();
+    }
+    if (!ok)
+    {
+        s.retryDelay = (s.retryDelay > maxRetryUs / 2) ? maxRetryUs : s.retryDelay * 2;
+        s.retryAt = now + s.retryDelay;
+        return;
+    }
+    recoverCount[i]++;
+    // 値が変わるまでは固着とは言えないので、今の値から数え直す
+    restart(s, record, now);
+    s.status = LOG67_HEALTH_OK;
+    s.recovered = true;
+    s.recoveredAt = now;
+}
+
+void Log67Health::check(State &s, const uint8_t *record, uint32_t now)
+{
+    if (s.status == LOG67_HEALTH_FAILED)
+    {
+        tryReinit(s, record, now);
+        return;
+    }
+    if (!s.snapshotValid)
+    {
+        restart(s, record, now);
+        return;
+    }
+    uint8_t found = 0;
+    const uint8_t *value = record + s.cfg.offset;
+
+    // 全部0xFF (MISOが浮いている) / 全部0
+    bool ones = true, zeros = true;
+    for (uint8_t k = 0; k < s.cfg.length; k++)
+    {
+        ones = ones && value[k] == 0xFF;
+        zeros = zeros && value[k] == 0x00;
+    }
+    if (ones || (zeros && !s.cfg.zeroValid) || (s.cfg.valid != NULL && !s.cfg.valid(record)))
+    {
+        found |= LOG67_FAULT_RANGE;
+    }
+
+    // 固着 ノイズがあるので、動いているセンサの値は1bitは変わる
+    if (memcmp(value, s.snapshot, s.cfg.length) != 0)
+    {
+        memcpy(s.snapshot, value, s.cfg.length);
+        s.lastChange = now;
+    }
+    else if (now - s.lastChange >= s.cfg.frozenUs)
+    {
+        found |= LOG67_FAULT_FROZEN;
+    }
+
+    if (s.cfg.spiErrors != NULL)
+    {
+        uint32_t errors = s.cfg.spiErrors();
+        if (errors != s.spiErrors)
+        {
+            found |= LOG67_FAULT_SPI;
+            s.spiErrors = errors;
+        }
+    }
+
+    // 他の異常があるときは、すぐに確かめる
+    if (s.cfg.whoAmI != NULL && (found || ++s.whoAmICount >= whoAmIEvery))
+    {
+        s.whoAmICount = 0;
+        if (!s.cfg.whoAmI())
+        {
+            found |= LOG67_FAULT_WHOAMI;
+        }
+    }
+
+    s.lastFaults = found;
+    s.faults |= found;
+    if (!found)
+    {
+        s.badChecks = 0;
+        s.status = LOG67_HEALTH_OK;
+        if (s.recovered && now - s.recoveredAt >= maxRetryUs)
+        {
+            s.recovered = false;
+            s.retryDelay = minRetryUs;
+        }
+        return;
+    }
+    if (++s.badChecks < failChecks)
+    {
+        s.status = LOG67_HEALTH_SUSPECT;
+        return;
+    }
+    s.status = LOG67_HEALTH_FAILED;
+    failCount[&s - sensors]++;
+    // 直ってすぐにまた異常になったなら、書き直しても直らないので間隔を延ばす
+    if (s.recovered)
+    {
+        s.retryDelay = (s.retryDelay > maxRetryUs / 2) ? maxRetryUs : s.retryDelay * 2;
+        s.retryAt = now + s.retryDelay;
+    }
+    else
+    {
+        s.retryAt = now;
+    }
+}
+
+#endif
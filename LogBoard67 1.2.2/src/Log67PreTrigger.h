@@ -0,0 +1,154 @@
+// version: 1.2.2
+#pragma once
+
+#ifndef Log67PreTrigger_H
+#define Log67PreTrigger_H
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include "Log67Ring.h"
+
+/**
+ * @brief トリガがかかるまで直近のレコードをRAMに溜めておくバッファ
+ * 満杯になったら古いものから上書きする
+ * PSRAMがあればPSRAMに、なければ内部RAMに確保する
+ * トリガは「値(の2乗)がしきい値以上のサンプルがsamples回連続した」ときにかかる
+ */
+class Log67PreTrigger
+{
+private:
+    uint8_t *buff = NULL;
+    uint32_t capacity = 0;
+    uint32_t head = 0;  // 次に書き込む位置
+    uint32_t count = 0; // 溜まっているレコード数
+
+    uint32_t thresholdSq = 0;
+    uint16_t samplesToTrigger = 1;
+    uint16_t overCount = 0;
+
+    bool armed = false;
+    volatile bool manualTrigger = false;
+
+public:
+    ~Log67PreTrigger() { end(); }
+
+    /**
+     * @brief バッファを確保してトリガ待ちにする
+     * @param[in] records 溜めておくレコード数 (1kHzで2秒分なら2000)
+     * @param[in] threshold しきい値 (update()に渡す値と同じ単位、2乗する前の値)
+     * @param[in] samples 何サンプル連続でしきい値を超えたらトリガとするか
+     * @retval true: success
+     * @retval false: メモリを確保できなかった
+     */
+    bool begin(uint32_t records, uint32_t threshold, uint16_t samples = 1);
+    void end();
+    // トリガ待ちならtrue トリガがかかった後はfalse
+    bool isArmed() { return armed; }
+    // 別のタスク等から強制的にトリガをかける (実際の処理は次のupdate()で行う)
+    void fire() { manualTrigger = true; }
+
+    // レコードを溜める
+    void push(const uint8_t *record);
+    /**
+     * @brief トリガの判定をする
+     * @param[in] magnitudeSq 値の2乗 (例: 加速度のx^2+y^2+z^2)
+     * @return トリガがかかったらtrue (isArmed()がfalseになる)
+     */
+    bool update(uint32_t magnitudeSq);
+    // 古い順にレコードを取り出す 空ならNULL
+    const uint8_t *pop();
+    uint32_t size() { return count; }
+    // 満杯なら次のpush()で一番古いレコードが上書きされる
+    bool isFull() { return count >= capacity; }
+};
+
+bool Log67PreTrigger::begin(uint32_t records, uint32_t threshold, uint16_t samples)
+{
+    end();
+    if (records == 0)
+    {
+        return false;
+    }
+    buff = (uint8_t *)heap_caps_malloc(records * LOG67_RECORD_SIZE, MALLOC_CAP_SPIRAM);
+    if (buff == NULL)
+    {
+        buff = (uint8_t *)heap_caps_malloc(records * LOG67_RECORD_SIZE, MALLOC_CAP_8BIT);
+    }
+    if (buff == NULL)
+    {
+        return false;
+    }
+    capacity = records;
+    head = 0;
+    count = 0;
+    if (threshold > 0xFFFF)
+    {
+        threshold = 0xFFFF;
+    }
+    thresholdSq = threshold * threshold;
+    samplesToTrigger = (samples == 0) ? 1 : samples;
+    overCount = 0;
+    manualTrigger = false;
+    armed = true;
+    return true;
+}
+
+void Log67PreTrigger::end()
+{
+    if (buff != NULL)
+    {
+        heap_caps_free(buff);
+        buff = NULL;
+    }
+    capacity = 0;
+    count = 0;
+    armed = false;
+}
+
+void Log67PreTrigger::push(const uint8_t *record)
+{
+    memcpy(&buff[head * LOG67_RECORD_SIZE], record, LOG67_RECORD_SIZE);
+    head++;
+    if (head >= capacity)
+    {
+        head = 0;
+    }
+    if (count < capacity)
+    {
+        count++;
+    }
+}
+
+bool Log67PreTrigger::update(uint32_t magnitudeSq)
+{
+    if (!armed)
+    {
+        return false;
+    }
+    if (magnitudeSq >= thresholdSq)
+    {
+        overCount++;
+    }
+    else
+    {
+        overCount = 0;
+    }
+    if (overCount >= samplesToTrigger || manualTrigger)
+    {
+        armed = false;
+        return true;
+    }
+    return false;
+}
+
+const uint8_t *Log67PreTrigger::pop()
+{
+    if (count == 0)
+    {
+        return NULL;
+    }
+    uint32_t tail = (head + capacity - count) % capacity;
+    count--;
+    return &buff[tail * LOG67_RECORD_SIZE];
+}
+
+#endif
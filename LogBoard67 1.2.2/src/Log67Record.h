@@ -0,0 +1,32 @@
+// version: 1.2.2
+#pragma once
+
+#ifndef Log67Record_H
+#define Log67Record_H
+
+// LogBoard67のレコードの形式 Arduinoに依存しないので、PCで記録を読むときにも使える
+
+// 1レコード(32byte)の中身
+// 0-3: 時間, 4-9: H3LIS331 加速度, 10-15: ICM20948 加速度, 16-21: ICM20948 角速度,
+// 22-27: ICM20948 地磁気, 28-30: LPS25HB 気圧, 31: そのレコードで新しく読んだセンサのビットマスク
+// 新しく読まなかったセンサの値は前のレコードの値のまま
+// 時間は64bitの時刻[us]の下位32bit 上位32bitはエポックのレコードで別に記録する
+#define LOG67_FRESH_INDEX 31
+
+// エポックのレコード (31byte目がLOG67_EPOCH_FLAG)
+// 0-3: 時間の下位32bit, 4-7: 時間の上位32bit, 8-11: ドリフト補正の値[ppb] (int32)
+// 最初のレコードの前と、時間の上位32bitが変わるたび(約71分ごと)に入る
+// 読むときは 時間 = (直前のエポックのレコードの上位32bit << 32) | 各レコードの下位32bit
+#define LOG67_EPOCH_FLAG 0x80
+
+// スケジューラのチャンネル番号 (freshのビットの位置)
+#define LOG67_CH_H3LIS 0
+#define LOG67_CH_ICM 1
+#define LOG67_CH_MAG 2
+#define LOG67_CH_LPS 3
+
+// 1Gあたりの生の値 (H3LIS331は400G、12bit左詰め、ICM20948は16G)
+#define LOG67_H3LIS_LSB_PER_G (16.0f / 0.195f)
+#define LOG67_ICM_LSB_PER_G 2048.0f
+
+#endif
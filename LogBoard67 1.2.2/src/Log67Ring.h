@@ -0,0 +1,107 @@
+// version: 1.2.2
+#pragma once
+
+#ifndef Log67Ring_H
+#define Log67Ring_H
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// 1レコードのバイト数 (SPI Flashの1ページ256byteに8レコード入る)
+#define LOG67_RECORD_SIZE 32
+
+/**
+ * @brief サンプリング側(producer)と書き込み側(consumer)をつなぐロックフリーのSPSCリングバッファ
+ * producer, consumer はそれぞれ1タスクのみから呼び出すこと
+ * 満杯のときは新しいレコードを捨て、overrunCountを増やす
+ * @tparam N レコード数 (2のべき乗)
+ */
+template <size_t N>
+class Log67Ring
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "Log67Ring: N must be a power of 2");
+
+    uint8_t buff[N][LOG67_RECORD_SIZE] = {};
+    // headはproducerのみ、tailはconsumerのみが書き込む
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+
+    std::atomic<uint32_t> overrunCount{0};
+    std::atomic<uint32_t> highWaterMark{0};
+
+public:
+    // producer側: 書き込み先のレコードを返す 満杯ならNULL
+    uint8_t *acquireWrite();
+    // producer側: acquireWriteで得たレコードを確定する
+    void commitWrite();
+
+    // consumer側: 読み出すレコードを返す 空ならNULL
+    const uint8_t *acquireRead();
+    // consumer側: acquireReadで得たレコードを解放する
+    void releaseRead();
+
+    uint32_t size() const;
+    uint32_t capacity() const { return N; }
+    // 満杯で捨てたレコード数
+    uint32_t getOverrunCount() const { return overrunCount.load(std::memory_order_relaxed); }
+    // これまでに溜まったレコード数の最大値
+    uint32_t getHighWaterMark() const { return highWaterMark.load(std::memory_order_relaxed); }
+    void resetStats();
+};
+
+template <size_t N>
+uint8_t *Log67Ring<N>::acquireWrite()
+{
+    uint32_t h = head.load(std::memory_order_relaxed);
+    uint32_t t = tail.load(std::memory_order_acquire);
+    if (h - t >= N)
+    {
+        overrunCount.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+    return buff[h & (N - 1)];
+}
+
+template <size_t N>
+void Log67Ring<N>::commitWrite()
+{
+    uint32_t h = head.load(std::memory_order_relaxed) + 1;
+    head.store(h, std::memory_order_release);
+    uint32_t used = h - tail.load(std::memory_order_relaxed);
+    if (used > highWaterMark.load(std::memory_order_relaxed))
+    {
+        highWaterMark.store(used, std::memory_order_relaxed);
+    }
+}
+
+template <size_t N>
+const uint8_t *Log67Ring<N>::acquireRead()
+{
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (head.load(std::memory_order_acquire) == t)
+    {
+        return NULL;
+    }
+    return buff[t & (N - 1)];
+}
+
+template <size_t N>
+void Log67Ring<N>::releaseRead()
+{
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+template <size_t N>
+uint32_t Log67Ring<N>::size() const
+{
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+template <size_t N>
+void Log67Ring<N>::resetStats()
+{
+    overrunCount.store(0, std::memory_order_relaxed);
+    highWaterMark.store(0, std::memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,162 @@
+// version: 1.2.2
+#pragma once
+
+#ifndef Log67Scheduler_H
+#define Log67Scheduler_H
+#include <stdint.h>
+#include <stddef.h>
+
+// 登録できるセンサ(チャンネル)の最大数 freshのビットマスクは1byteで、
+// 最上位bitはエポックのレコードの印 (LOG67_EPOCH_FLAG) なので7まで
+#define LOG67_SCHED_MAX_CHANNELS 7
+#define LOG67_SCHED_FRESH_MASK ((1 << LOG67_SCHED_MAX_CHANNELS) - 1)
+
+// recordの決まった位置にセンサの値を書き込む関数
+// 新しい値を書き込んだチャンネルのビットマスクを返す (1つのセンサで複数のチャンネルを読む場合があるため)
+typedef uint8_t (*Log67ReadFunc)(uint8_t *record);
+
+/**
+ * @brief センサごとに読む周期を変えるためのスケジューラ
+ * チャンネルchはperiod tickに1回、tick % period == phase のときに読まれる
+ * phaseを省略すると、他の低レートのチャンネルとなるべく同じtickにならないように自動で決める
+ * runの戻り値はそのtickで読んだ関数が返したビットマスクのOR (bit ch が1なら新しい値)
+ *
+ * ```cpp
+ * // example
+ * scheduler.setChannel(0, readH3lis, 1);  // 毎tick
+ * scheduler.setChannel(3, readLps, 20);   // 20tickに1回
+ * uint8_t fresh = scheduler.run(record);
+ * ```
+ */
+class Log67Scheduler
+{
+private:
+    struct Channel
+    {
+        Log67ReadFunc read;
+        uint16_t period; // 0なら無効
+        uint16_t phase;
+    };
+    Channel channels[LOG67_SCHED_MAX_CHANNELS] = {};
+    uint32_t tick = 0;
+
+    static uint16_t gcd(uint16_t a, uint16_t b);
+    uint16_t choosePhase(uint8_t ch, uint16_t period);
+
+public:
+    /**
+     * @brief チャンネルを登録する 登録済みなら上書きする
+     * @param[in] ch チャンネル番号 (0 ~ LOG67_SCHED_MAX_CHANNELS - 1)
+     * @param[in] read 値を読む関数
+     * @param[in] period 何tickに1回読むか 0で無効
+     * @param[in] phase 何tick目に読むか 負なら自動で決める
+     * @retval true: success
+     * @retval false: ch, phaseが範囲外
+     */
+    bool setChannel(uint8_t ch, Log67ReadFunc read, uint16_t period, int16_t phase = -1);
+    // 周期だけ変える phaseは自動で決め直す
+    bool setPeriod(uint8_t ch, uint16_t period, int16_t phase = -1);
+    uint16_t getPeriod(uint8_t ch) { return (ch < LOG67_SCHED_MAX_CHANNELS) ? channels[ch].period : 0; }
+    uint16_t getPhase(uint8_t ch) { return (ch < LOG67_SCHED_MAX_CHANNELS) ? channels[ch].phase : 0; }
+    // このtickで読むべきチャンネルを読み、新しい値のチャンネルのビットマスクを返す
+    uint8_t run(uint8_t *record);
+    void reset() { tick = 0; }
+};
+
+uint16_t Log67Scheduler::gcd(uint16_t a, uint16_t b)
+{
+    while (b != 0)
+    {
+        uint16_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+// 周期P1,P2,位相p1,p2の2つのチャンネルは p1 ≡ p2 (mod gcd(P1, P2)) のときに限り同じtickになる
+// 同じtickになる低レートのチャンネルの数が最も少ない位相を選ぶ
+uint16_t Log67Scheduler::choosePhase(uint8_t ch, uint16_t period)
+{
+    uint16_t best = 0;
+    int bestCollision = LOG67_SCHED_MAX_CHANNELS + 1;
+    for (uint16_t phase = 0; phase < period; phase++)
+    {
+        int collision = 0;
+        for (uint8_t i = 0; i < LOG67_SCHED_MAX_CHANNELS; i++)
+        {
+            // 毎tick読むチャンネルはどの位相でもぶつかるので数えない
+            if (i == ch || channels[i].period <= 1)
+            {
+                continue;
+            }
+            uint16_t g = gcd(period, channels[i].period);
+            if ((phase % g) == (channels[i].phase % g))
+            {
+                collision++;
+            }
+        }
+        if (collision < bestCollision)
+        {
+            bestCollision = collision;
+            best = phase;
+            if (collision == 0)
+            {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+bool Log67Scheduler::setChannel(uint8_t ch, Log67ReadFunc read, uint16_t period, int16_t phase)
+{
+    if (ch >= LOG67_SCHED_MAX_CHANNELS)
+    {
+        return false;
+    }
+    channels[ch].read = read;
+    return setPeriod(ch, period, phase);
+}
+
+bool Log67Scheduler::setPeriod(uint8_t ch, uint16_t period, int16_t phase)
+{
+    if (ch >= LOG67_SCHED_MAX_CHANNELS)
+    {
+        return false;
+    }
+    if (phase >= 0 && period != 0 && (uint16_t)phase >= period)
+    {
+        return false;
+    }
+    channels[ch].period = 0;
+    if (period == 0 || channels[ch].read == NULL)
+    {
+        return true;
+    }
+    channels[ch].phase = (phase >= 0) ? (uint16_t)phase : choosePhase(ch, period);
+    channels[ch].period = period;
+    return true;
+}
+
+uint8_t Log67Scheduler::run(uint8_t *record)
+{
+    uint8_t fresh = 0;
+    for (uint8_t ch = 0; ch < LOG67_SCHED_MAX_CHANNELS; ch++)
+    {
+        const Channel &c = channels[ch];
+        if (c.period == 0)
+        {
+            continue;
+        }
+        if (c.period == 1 || (tick % c.period) == c.phase)
+        {
+            fresh |= c.read(record);
+        }
+    }
+    tick++;
+    // 読む関数がチャンネルの外のbitを返しても、エポックのレコードにはしない
+    return fresh & LOG67_SCHED_FRESH_MASK;
+}
+
+#endif
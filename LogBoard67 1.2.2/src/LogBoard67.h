@@ -10,16 +10,125 @@
 #include <ICM20948.h>   // 2.0.0
 #include <LPS25HB.h>    // 1.0.0
 #include <Log67Timer.h> // 1.0.0
+#include "Log67Ring.h"
+#include "Log67Record.h"
+#include "Log67Flight.h"
+#include "Log67Health.h"
+#include "Log67Scheduler.h"
+#include "Log67PreTrigger.h"
+#include "Log67Bench.h"
+
+// サンプリングタスクとSPI Flash書き込みタスクの間のリングバッファのレコード数
+#ifndef LOG67_RING_SIZE
+#define LOG67_RING_SIZE 256
+#endif
+
+// プリトリガのトリガに使うセンサ
+#define LOG67_TRIG_H3LIS 0 // H3LIS331の加速度の大きさ
+#define LOG67_TRIG_ICM 1   // ICM20948の加速度の大きさ
+#define LOG67_TRIG_HARDWARE 2 // H3LIS331の割り込み (サンプルごとには判定しない)
+
+// トリガの後、1レコードを記録するたびにプリトリガのバッファから書き出すページ数の最大
+// 溜めていた分を一度に書き込むとその間サンプリングが止まる (RoutineWorkで2000レコードなら100ms以上) ので、少しずつ書き出す
+#ifndef LOG67_PRETRIGGER_DRAIN_PAGES
+#define LOG67_PRETRIGGER_DRAIN_PAGES 2
+#endif
+
+// センサの見張りのスケジューラのチャンネル番号 (レコードには何も書かない)
+#define LOG67_CH_HEALTH 4
+
+// ベンチマーク用 -DLOG67_BENCH=1 でビルドすると、処理ごとのCPUサイクル数をlog67Benchに記録する
+#ifndef LOG67_BENCH
+#define LOG67_BENCH 0
+#endif
+#if LOG67_BENCH
+Log67Bench log67Bench;
+#define LOG67_BENCH_START(name) uint32_t name = ESP.getCycleCount()
+#define LOG67_BENCH_END(name, st) log67Bench.add(st, ESP.getCycleCount() - name)
+#else
+#define LOG67_BENCH_START(name)
+#define LOG67_BENCH_END(name, st)
+#endif
 
 // センサのクラス
 H3LIS331 H3lis331;
-ICM icm20948;
+ICM20948 icm20948;
 LPS Lps25;
 Flash flash1;
 
 // Timerクラスのインスタンス化
 Log67Timer timer;
 
+// スケジューラから呼ばれる、各センサの値をレコードに書き込む関数
+uint8_t Log67ReadH3lis(uint8_t *record)
+{
+    LOG67_BENCH_START(start);
+    H3LIS331_Sample sample;
+    uint8_t H3lis_rx_buf[H3LIS331_SAMPLE_LENGTH];
+    bool fresh = H3lis331.GetWithStatus(&sample, H3lis_rx_buf);
+    // 新しい値でなければ、recordは前のレコードの値のままにする (同じ値を新しい値として記録しない)
+    if (fresh)
+    {
+        memcpy(&record[4], &H3lis_rx_buf[1], 6);
+    }
+    LOG67_BENCH_END(start, LOG67_STAGE_H3LIS);
+    return fresh ? 1 << LOG67_CH_H3LIS : 0;
+}
+// 加速度、角速度、地磁気を1回のSPI通信で読む
+uint8_t Log67ReadIcm(uint8_t *record)
+{
+    LOG67_BENCH_START(start);
+    ICM_Sample sample;
+    uint8_t Icm20948_rx_buf[ICM_SAMPLE_LENGTH];
+    icm20948.GetAll(&sample, Icm20948_rx_buf);
+    uint8_t fresh = 1 << LOG67_CH_ICM;
+    // 地磁気は100Hzでしか更新されないので、値が変わったときだけ新しい値とする
+    // recordには前のレコードの値が入っている
+    if ((sample.magStatus & 0x01) || memcmp(&record[22], &Icm20948_rx_buf[15], 6) != 0)
+    {
+        fresh |= 1 << LOG67_CH_MAG;
+    }
+    // 加速度と角速度 (ビッグエンディアン) 10-21, 地磁気 (リトルエンディアン) 22-27
+    memcpy(&record[10], Icm20948_rx_buf, 12);
+    memcpy(&record[22], &Icm20948_rx_buf[15], 6);
+    LOG67_BENCH_END(start, LOG67_STAGE_ICM);
+    return fresh;
+}
+uint8_t Log67ReadLps(uint8_t *record)
+{
+    LOG67_BENCH_START(start);
+    Lps25.Get(&record[28]);
+    LOG67_BENCH_END(start, LOG67_STAGE_LPS);
+    return 1 << LOG67_CH_LPS;
+}
+
+// センサの見張り センサの番号はLOG67_CH_H3LIS, LOG67_CH_ICM, LOG67_CH_LPS
+Log67Health log67Health;
+
+bool Log67WhoAmIH3lis() { return H3lis331.WhoAmI() == H3LIS331_WhoAmI_Value; }
+bool Log67WhoAmIIcm() { return icm20948.WhoAmI() == ICM20948_WhoAmI_Value; }
+bool Log67WhoAmILps() { return Lps25.WhoAmI() == LPS_WhoAmI_Value; }
+bool Log67ReinitH3lis() { return H3lis331.reinit(); }
+bool Log67ReinitIcm() { return icm20948.reinit(); }
+bool Log67ReinitLps() { return Lps25.reinit(); }
+uint32_t Log67SpiErrorsH3lis() { return H3lis331.spiErrorCount(); }
+uint32_t Log67SpiErrorsIcm() { return icm20948.spiErrorCount(); }
+uint32_t Log67SpiErrorsLps() { return Lps25.spiErrorCount(); }
+// 気圧は260hPa ~ 1260hPa (高度の表の範囲) の外なら異常
+bool Log67ValidLps(const uint8_t *record)
+{
+    uint32_t raw = record[28] | record[29] << 8 | (uint32_t)record[30] << 16;
+    return raw > LPS_ALT_RAW_MIN && raw < LPS_ALT_RAW_MAX;
+}
+// 1回にセンサ1つだけ調べる freshのビットは立てない
+uint8_t Log67RunHealth(uint8_t *record)
+{
+    LOG67_BENCH_START(start);
+    log67Health.run(record);
+    LOG67_BENCH_END(start, LOG67_STAGE_HEALTH);
+    return 0;
+}
+
 class LogBoard67
 {
 private:
@@ -30,92 +139,374 @@ private:
     int CountSPIFlashDataSetExistInBuff = 0;
 
     // 時間
-    unsigned long Record_time;
+    int64_t Record_time;
+    // サンプリング側で最後にエポックのレコードを入れたときの時間の上位32bit
+    bool epochWritten = false;
+    uint32_t epochHigh = 0;
+    // 書き込み側で最後に見たエポックのレコードの時間の上位32bit (プリトリガ用)
+    uint32_t storedEpochHigh = 0;
 
-    // 気圧の回数の測定(5回に1回)
-    uint8_t count_lps = 0;
+    // 前のレコード 新しく読まなかったセンサの値はここからコピーする
+    uint8_t LastRecord[LOG67_RECORD_SIZE] = {};
+
+    // デュアルコア用 サンプリングタスクからSPI Flash書き込みタスクへレコードを渡す
+    Log67Ring<LOG67_RING_SIZE> ring;
+    uint32_t samplePeriodUs = 1000;
+
+    uint8_t triggerSource = LOG67_TRIG_H3LIS;
+    // トリガがかかった後、プリトリガのバッファをまだ書き出している
+    bool preTriggerDraining = false;
+    bool flightEnabled = false;
+
+    int64_t RecordTime();
+    bool NeedEpochRecord(int64_t t);
+    void MakeEpochRecord(uint8_t *record, int64_t t);
+    void SampleEpochRecord(uint8_t *record, int64_t t);
+    void SampleRecord(uint8_t *record, int64_t t);
+    void StoreRecord(const uint8_t *record);
+    void CommitRow();
+    void DrainPreTrigger();
+    uint32_t TriggerMagnitude(const uint8_t *record);
+
+    static void sampleTask(void *pvParameters);
+    static void flashTask(void *pvParameters);
 
 public:
+    LogBoard67();
+
+    // センサごとの読む周期 (何サンプルに1回読むか) はここで変えられる
+    // 例: logboard.scheduler.setPeriod(LOG67_CH_LPS, 40);
+    Log67Scheduler scheduler;
+    // センサの出力周期sensorPeriodUs[us]に合わせてチャンネルchの周期を決める
+    // 同じ値を何度も読まないように、かつ出力を取りこぼさないように sensorPeriodUs / periodUs tickに1回にする
+    // 例: logboard.AlignChannel(LOG67_CH_ICM, icm20948.getGyroPeriodUs(), 1000);
+    bool AlignChannel(uint8_t ch, uint32_t sensorPeriodUs, uint32_t periodUs = 1000);
+
     void RoutineWork();
+
+    // beginPipelineで使うサンプリング周期のタイマ 遅れたtickの数やジッタはここから見る
+    Log67SampleClock sampleClock;
+
+    // マルチタスク用
+    // サンプリングとSPI Flashへの書き込みを別々のコアのタスクで行う
+    // サンプリングはesp_timerでperiodUs[us]ごとに行う
+    // beginPipelineを呼んだらRoutineWorkは呼ばないこと
+    bool beginPipeline(uint32_t periodUs = 1000, BaseType_t sampleCore = 1, BaseType_t flashCore = 0);
+    // リングが満杯で捨てたレコード数
+    uint32_t GetOverrunCount() { return ring.getOverrunCount(); }
+    // リングに溜まったレコード数の最大値 (LOG67_RING_SIZEに近いなら書き込みが追いついていない)
+    uint32_t GetHighWaterMark() { return ring.getHighWaterMark(); }
+    uint32_t GetRingUsage() { return ring.size(); }
+
+    // プリトリガ
+    // トリガがかかるまでは直近recordsレコードだけをRAMに溜め、SPI Flashには書かない
+    // 加速度の大きさがthresholdG[G]以上のサンプルがsamples回連続したら、溜めていた分を書き込んでから通常通り記録する
+    // 例: logboard.SetPreTrigger(2000, LOG67_TRIG_H3LIS, 3.0, 10); // 1kHzで2秒前から、3G以上が10サンプル連続で記録開始
+    // beginPipelineより前に呼ぶこと
+    bool SetPreTrigger(uint32_t records, uint8_t source, float thresholdG, uint16_t samples = 1);
+    // H3LIS331の割り込みでトリガをかける
+    // ハイパスフィルタ(ODR/50)を通した加速度のどれかの軸がthresholdG[G]以上の状態がdurationUs[us]続いたら、H3LIS331がINT1を出す
+    // サンプルごとの加速度の計算はしないので、点火の衝撃や分離の検出をCPUを使わずに待てる
+    // 例: logboard.SetHardwareTrigger(2000, LOGPIN::H3LIS_INT1, 20.0, 5000);
+    // H3lis331.beginの後、beginPipelineより前に呼ぶこと
+    bool SetHardwareTrigger(uint32_t records, int intPin, float thresholdG, uint32_t durationUs = 0);
+    // しきい値によらずトリガをかける (CANのコマンド等から)
+    void Trigger() { preTrigger.fire(); }
+    // トリガ待ちならtrue
+    bool IsWaitingTrigger() { return preTrigger.isArmed(); }
+    // トリガの後、溜めていた分をまだ書き出しているならtrue (その間の新しいレコードも一旦バッファに入る)
+    bool IsDrainingPreTrigger() { return preTriggerDraining; }
+    Log67PreTrigger preTrigger;
+
+    // 発射、燃焼終了、頂点、着地の検出
+    // サンプリングのたびにレコードをflightに入れる (ESP32で数us)
+    // upAxisは機体の上向きのセンサの軸 (0: X, 1: Y, 2: Z) invertなら-方向が上
+    // 例: logboard.BeginFlight(0); ... if (logboard.flight.getEvents() & LOG67_EVENT_APOGEE) { 開傘 }
+    // beginPipelineより前に呼ぶこと
+    bool BeginFlight(uint8_t upAxis, bool invert = false, float seaLevelHPa = 1013.25f);
+    Log67Flight flight;
+
+    // センサの見張り
+    // period tickに1回、センサを1つずつ順に調べる (WhoAmIはその10回に1回) ので、サンプルごとの処理は増えない
+    // 値の固着、全部0xFF、気圧の範囲外、SPI通信のエラー、WhoAmIの違いが続いたら、センサの設定を書き直す
+    // 書き直しに失敗したら間隔を0.1秒から10秒まで倍々に延ばして繰り返す
+    // 書き直しはサンプリングの中で行うので、そのtickは遅れる (ICM20948は地磁気の設定で最大100ms程度)
+    // 状態は log67Health.getStatus(LOG67_CH_ICM) 等で見る
+    // 例: logboard.BeginHealth(); ... if (log67Health.failedMask()) { 異常を知らせる }
+    // センサのbeginの後、beginPipelineより前に呼ぶこと
+    bool BeginHealth(uint16_t period = 100);
 };
 
-void LogBoard67::RoutineWork()
+// デフォルトの周期 加速度、角速度、地磁気は毎回、気圧は20回に1回
+// 地磁気はICM20948の加速度、角速度と一緒に読むのでチャンネルLOG67_CH_MAGは登録しない (freshのビットだけ使う)
+LogBoard67::LogBoard67()
 {
-    if (SPIFlashLatestAddress >= SPI_FLASH_MAX_ADDRESS)
+    scheduler.setChannel(LOG67_CH_H3LIS, Log67ReadH3lis, 1);
+    scheduler.setChannel(LOG67_CH_ICM, Log67ReadIcm, 1);
+    scheduler.setChannel(LOG67_CH_LPS, Log67ReadLps, 20);
+}
+
+bool LogBoard67::AlignChannel(uint8_t ch, uint32_t sensorPeriodUs, uint32_t periodUs)
+{
+    if (periodUs == 0)
     {
-        Serial.printf("SPIFlashLatestAddress: %u\n", SPIFlashLatestAddress);
-        // Serial2.write("SPI Flash is full");
-        // Serial2.write("Started At: ");
-        // Serial2.write(timer.start_time);
-        // Serial2.write("Now: ");
-        // Serial2.write(timer.Gettime_record());
-        return;
+        return false;
     }
-    // Serial.println("Running");
+    uint32_t ticks = sensorPeriodUs / periodUs;
+    if (ticks < 1)
+    {
+        ticks = 1;
+    }
+    if (ticks > 0xFFFF)
+    {
+        ticks = 0xFFFF;
+    }
+    return scheduler.setPeriod(ch, (uint16_t)ticks);
+}
+
+// 記録開始からの時間[us]
+int64_t LogBoard67::RecordTime()
+{
     if (timer.start_flag)
     {
-        timer.start_time = micros();
-        timer.start_flag = false;
-    }
-    Record_time = timer.Gettime_record();
-    // From SPI, Get data is tx
-    int16_t H3lisReceiveData[3] = {};
-    uint8_t H3lis_rx_buf[6] = {};
-    int16_t Icm20948ReceiveData[6] = {};
-    uint8_t Icm20948_rx_buf[12] = {};
-    uint8_t lps_rx[3] = {};
-    // CountSPIFlashDataSetExistInBuffは列。indexは行。
+        timer.Start();
+    }
+    return timer.Gettime_record64();
+}
+
+bool LogBoard67::NeedEpochRecord(int64_t t)
+{
+    return !epochWritten || (uint32_t)(t >> 32) != epochHigh;
+}
+
+void LogBoard67::MakeEpochRecord(uint8_t *record, int64_t t)
+{
+    uint32_t high = (uint32_t)(t >> 32);
+    int32_t drift = timer.GetDriftPpb();
+    memset(record, 0, LOG67_RECORD_SIZE);
+    for (int index = 0; index < 4; index++)
+    {
+        record[index] = 0xFF & (t >> (8 * index));
+        record[4 + index] = 0xFF & (high >> (8 * index));
+        record[8 + index] = 0xFF & (drift >> (8 * index));
+    }
+    record[LOG67_FRESH_INDEX] = LOG67_EPOCH_FLAG;
+}
+
+// サンプリング側でエポックのレコードを作る
+void LogBoard67::SampleEpochRecord(uint8_t *record, int64_t t)
+{
+    MakeEpochRecord(record, t);
+    epochHigh = (uint32_t)(t >> 32);
+    epochWritten = true;
+}
+
+// recordに32byte分のデータを詰める tは時間
+void LogBoard67::SampleRecord(uint8_t *record, int64_t t)
+{
+    Record_time = t;
+    memcpy(record, LastRecord, LOG67_RECORD_SIZE);
     // 時間をとる
     for (int index = 0; index < 4; index++)
     {
-        SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = 0xFF & (Record_time >> (8 * index));
+        record[index] = 0xFF & (Record_time >> (8 * index));
     }
 
-    // 加速度をとる
-    H3lis331.Get2(H3lisReceiveData, H3lis_rx_buf);
-    icm20948.Get(Icm20948ReceiveData, Icm20948_rx_buf);
-    for (int index = 4; index < 10; index++)
+    // このサンプルで読むセンサだけ読む
+    record[LOG67_FRESH_INDEX] = scheduler.run(record);
+    memcpy(LastRecord, record, LOG67_RECORD_SIZE);
+
+    if (flightEnabled)
     {
-        SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = H3lis_rx_buf[index - 4];
+        LOG67_BENCH_START(flightStart);
+        flight.updateRecord(record, t);
+        LOG67_BENCH_END(flightStart, LOG67_STAGE_FLIGHT);
     }
+}
+
+bool LogBoard67::BeginFlight(uint8_t upAxis, bool invert, float seaLevelHPa)
+{
+    if (upAxis > 2 || !flight.begin(seaLevelHPa))
+    {
+        return false;
+    }
+    flight.setAxis(upAxis, invert);
+    flightEnabled = true;
+    return true;
+}
 
-    // ICM20948の加速度をとる
-    for (int index = 10; index < 16; index++)
+bool LogBoard67::BeginHealth(uint16_t period)
+{
+    if (period == 0)
+    {
+        return false;
+    }
+    // H3LIS331は自由落下で全部0になりうる 固着の時間は各センサの出力周期より十分長くする
+    Log67HealthSensor h3lis = {Log67WhoAmIH3lis, Log67ReinitH3lis, Log67SpiErrorsH3lis, NULL, 4, 6, true, 500000};
+    Log67HealthSensor icm = {Log67WhoAmIIcm, Log67ReinitIcm, Log67SpiErrorsIcm, NULL, 10, 12, false, 500000};
+    Log67HealthSensor lps = {Log67WhoAmILps, Log67ReinitLps, Log67SpiErrorsLps, Log67ValidLps, 28, 3, false, 2000000};
+    log67Health.setSensor(LOG67_CH_H3LIS, h3lis);
+    log67Health.setSensor(LOG67_CH_ICM, icm);
+    log67Health.setSensor(LOG67_CH_LPS, lps);
+    return scheduler.setChannel(LOG67_CH_HEALTH, Log67RunHealth, period);
+}
+
+// トリガの判定に使う加速度の大きさの2乗 そのレコードで読んでいなければ0
+uint32_t LogBoard67::TriggerMagnitude(const uint8_t *record)
+{
+    int32_t x, y, z;
+    if (triggerSource == LOG67_TRIG_HARDWARE)
+    {
+        return 0;
+    }
+    if (triggerSource == LOG67_TRIG_ICM)
+    {
+        if (!(record[LOG67_FRESH_INDEX] & (1 << LOG67_CH_ICM)))
+        {
+            return 0;
+        }
+        // ICM20948はビッグエンディアン
+        x = (int16_t)(record[10] << 8 | record[11]);
+        y = (int16_t)(record[12] << 8 | record[13]);
+        z = (int16_t)(record[14] << 8 | record[15]);
+    }
+    else
     {
-        SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = Icm20948_rx_buf[index - 10];
+        if (!(record[LOG67_FRESH_INDEX] & (1 << LOG67_CH_H3LIS)))
+        {
+            return 0;
+        }
+        // H3LIS331はリトルエンディアン
+        x = (int16_t)(record[5] << 8 | record[4]);
+        y = (int16_t)(record[7] << 8 | record[6]);
+        z = (int16_t)(record[9] << 8 | record[8]);
     }
+    return (uint32_t)(x * x) + (uint32_t)(y * y) + (uint32_t)(z * z);
+}
+
+bool LogBoard67::SetPreTrigger(uint32_t records, uint8_t source, float thresholdG, uint16_t samples)
+{
+    triggerSource = source;
+    preTriggerDraining = false;
+    float lsbPerG = (source == LOG67_TRIG_ICM) ? LOG67_ICM_LSB_PER_G : LOG67_H3LIS_LSB_PER_G;
+    return preTrigger.begin(records, (uint32_t)(thresholdG * lsbPerG), samples);
+}
+
+// H3LIS331の割り込みから呼ばれる
+IRAM_ATTR void Log67HardwareTrigger(void *arg, uint8_t line)
+{
+    ((Log67PreTrigger *)arg)->fire();
+}
 
-    // ICM20948の角速度をとる
-    for (int index = 16; index < 22; index++)
+bool LogBoard67::SetHardwareTrigger(uint32_t records, int intPin, float thresholdG, uint32_t durationUs)
+{
+    triggerSource = LOG67_TRIG_HARDWARE;
+    preTriggerDraining = false;
+    // しきい値は届かない値にして、割り込みのfire()だけでトリガをかける
+    if (!preTrigger.begin(records, 0xFFFF, 1))
     {
-        SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = Icm20948_rx_buf[index - 10];
+        return false;
     }
+    bool ok = H3lis331.setHighPass(H3LIS331_HPCF_ODR_50, H3LIS331_HPF_INT1);
+    ok = H3lis331.setInterrupt(1, H3LIS331_INT_HIGH_ANY, thresholdG, durationUs) && ok;
+    return H3lis331.attachInterrupt(1, intPin, Log67HardwareTrigger, &preTrigger) && ok;
+}
 
-    // ICM20948の地磁気をとる
-    // for (int index = 22; index < 28; index++)
-    // {
-    //   SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = Icm20948_rx_buf[index - 10];
-    // }
+// 1レコードをSPI_FlashBuffに入れる
+// トリガ待ちの間はプリトリガのバッファに溜め、トリガがかかったら溜めていた分を古い順に入れる
+// 溜めていた分は呼ばれるたびにLOG67_PRETRIGGER_DRAIN_PAGESページずつ書き出し、書き終わるまでは新しいレコードもバッファの後ろに入れる
+void LogBoard67::StoreRecord(const uint8_t *record)
+{
+    if (record[LOG67_FRESH_INDEX] & LOG67_EPOCH_FLAG)
+    {
+        storedEpochHigh = record[4] | record[5] << 8 | record[6] << 16 | (uint32_t)record[7] << 24;
+    }
+    if (preTriggerDraining)
+    {
+        preTrigger.push(record);
+        DrainPreTrigger();
+        return;
+    }
+    if (preTrigger.isArmed())
+    {
+        preTrigger.push(record);
+        if (record[LOG67_FRESH_INDEX] & LOG67_EPOCH_FLAG)
+        {
+            return;
+        }
+        if (!preTrigger.update(TriggerMagnitude(record)))
+        {
+            return;
+        }
+        // 溜めていた分の最初のエポックのレコードは上書きされているかもしれないので、先頭に作り直して入れる
+        // 一番古いレコードの時間の下位32bitがトリガのレコードより大きければ、間で上位32bitが変わっている
+        uint32_t newestLow = record[0] | record[1] << 8 | record[2] << 16 | (uint32_t)record[3] << 24;
+        const uint8_t *buffered = preTrigger.pop();
+        uint32_t oldestLow = buffered[0] | buffered[1] << 8 | buffered[2] << 16 | (uint32_t)buffered[3] << 24;
+        uint32_t oldestHigh = (oldestLow > newestLow) ? storedEpochHigh - 1 : storedEpochHigh;
+        MakeEpochRecord(&SPI_FlashBuff[LOG67_RECORD_SIZE * CountSPIFlashDataSetExistInBuff], ((int64_t)oldestHigh << 32) | oldestLow);
+        CommitRow();
+        memcpy(&SPI_FlashBuff[LOG67_RECORD_SIZE * CountSPIFlashDataSetExistInBuff], buffered, LOG67_RECORD_SIZE);
+        CommitRow();
+        preTriggerDraining = true;
+        DrainPreTrigger();
+        return;
+    }
+    memcpy(&SPI_FlashBuff[LOG67_RECORD_SIZE * CountSPIFlashDataSetExistInBuff], record, LOG67_RECORD_SIZE);
+    CommitRow();
+}
 
-    // LPSの気圧をとる
-    if (count_lps % 20 == 0)
+// プリトリガのバッファから古い順に最大LOG67_PRETRIGGER_DRAIN_PAGESページ分書き出す
+// 前のページの書き込みが終わっていなければ待たずに次の呼び出しに回す (サンプリングを止めない)
+// ただしバッファが満杯なら次のpushでまだ書いていないレコードが上書きされるので、待って書き出す
+// 1ページ(8レコード)書く間に新しいレコードは1つしか増えないので、バッファはいずれ空になる
+void LogBoard67::DrainPreTrigger()
+{
+    for (uint8_t page = 0; page < LOG67_PRETRIGGER_DRAIN_PAGES; page++)
     {
-        Lps25.Get(lps_rx);
-        for (int index = 28; index < 31; index++)
+        if (SPIFlashLatestAddress >= SPI_FLASH_MAX_ADDRESS)
         {
-            SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = lps_rx[index - 28];
-            count_lps = 0;
+            return;
         }
+        if (flash1.isBusy() && !preTrigger.isFull())
+        {
+            return;
+        }
+        // 次のページが埋まるまで入れる
+        do
+        {
+            const uint8_t *buffered = preTrigger.pop();
+            if (buffered == NULL)
+            {
+                preTriggerDraining = false;
+                return;
+            }
+            memcpy(&SPI_FlashBuff[LOG67_RECORD_SIZE * CountSPIFlashDataSetExistInBuff], buffered, LOG67_RECORD_SIZE);
+            CommitRow();
+        } while (CountSPIFlashDataSetExistInBuff != 0);
+    }
+    if (preTrigger.size() == 0)
+    {
+        preTriggerDraining = false;
     }
+}
 
-    count_lps++;
+// SPI_FlashBuffの1列を確定し、8個のデータが溜まったらSPIFlashに書き込む
+void LogBoard67::CommitRow()
+{
     CountSPIFlashDataSetExistInBuff++;
 
-    // 8個のデータが溜まったらSPIFlashに書き込む
     if (CountSPIFlashDataSetExistInBuff >= 8)
     {
+        LOG67_BENCH_START(start);
+        // 前のページの書き込みが終わるまで待つ (ふつうは8レコードの間に終わっている)
+        while (flash1.isBusy())
+        {
+            delayMicroseconds(50);
+        }
         // データの書き込み
         flash1.write(SPIFlashLatestAddress, SPI_FlashBuff);
+        LOG67_BENCH_END(start, LOG67_STAGE_FLASH);
         // アドレスの更新
         SPIFlashLatestAddress += 0x100;
         // 列の番号の初期化
@@ -123,4 +514,116 @@ void LogBoard67::RoutineWork()
     }
 }
 
-#endif
\ No newline at end of file
+void LogBoard67::RoutineWork()
+{
+    if (SPIFlashLatestAddress >= SPI_FLASH_MAX_ADDRESS)
+    {
+        Serial.printf("SPIFlashLatestAddress: %u\n", SPIFlashLatestAddress);
+        // Serial2.write("SPI Flash is full");
+        // Serial2.write("Started At: ");
+        // Serial2.write(timer.start_time);
+        // Serial2.write("Now: ");
+        // Serial2.write(timer.Gettime_record());
+        return;
+    }
+    // Serial.println("Running");
+    LOG67_BENCH_START(start);
+    uint8_t record[LOG67_RECORD_SIZE];
+    int64_t t = RecordTime();
+    if (NeedEpochRecord(t))
+    {
+        SampleEpochRecord(record, t);
+        StoreRecord(record);
+    }
+    SampleRecord(record, t);
+    StoreRecord(record);
+    LOG67_BENCH_END(start, LOG67_STAGE_TOTAL);
+}
+
+// 呼び出し方は以下の通り
+// LogBoard67 logboard;
+// setup()の最後で logboard.beginPipeline(); (loop()ではRoutineWorkを呼ばない)
+// センサとSPI Flashが同じSPIバスにあるとページ書き込みの間センサの読み出しが待たされるので、別バスを推奨
+bool LogBoard67::beginPipeline(uint32_t periodUs, BaseType_t sampleCore, BaseType_t flashCore)
+{
+    if (periodUs == 0)
+    {
+        return false;
+    }
+    samplePeriodUs = periodUs;
+    ring.resetStats();
+    if (xTaskCreatePinnedToCore(flashTask, "log67Flash", 4096, this, 2, NULL, flashCore) != pdPASS)
+    {
+        return false;
+    }
+    // サンプリングのタスクはloop()等より十分高い優先度にする
+    if (xTaskCreatePinnedToCore(sampleTask, "log67Sample", 4096, this, configMAX_PRIORITIES - 5, NULL, sampleCore) != pdPASS)
+    {
+        return false;
+    }
+    return true;
+}
+
+// producer: センサを読んでリングに積むだけ。SPI Flashには触らない
+void LogBoard67::sampleTask(void *pvParameters)
+{
+    LogBoard67 *board = (LogBoard67 *)pvParameters;
+    if (!board->sampleClock.begin(board->samplePeriodUs))
+    {
+        Serial.println("failed to start sample clock");
+        vTaskDelete(NULL);
+        return;
+    }
+    while (1)
+    {
+        board->sampleClock.waitTick();
+        if (SPIFlashLatestAddress >= SPI_FLASH_MAX_ADDRESS)
+        {
+            continue;
+        }
+        LOG67_BENCH_START(start);
+        int64_t t = board->RecordTime();
+        uint8_t *record;
+        if (board->NeedEpochRecord(t))
+        {
+            record = board->ring.acquireWrite();
+            if (record == NULL)
+            {
+                continue;
+            }
+            board->SampleEpochRecord(record, t);
+            board->ring.commitWrite();
+        }
+        record = board->ring.acquireWrite();
+        if (record == NULL)
+        {
+            // 書き込みが追いついていない overrunとして数える
+            continue;
+        }
+        board->SampleRecord(record, t);
+        board->ring.commitWrite();
+        LOG67_BENCH_END(start, LOG67_STAGE_TOTAL);
+    }
+}
+
+// consumer: リングから取り出して256byte溜まったらSPI Flashに書き込む
+void LogBoard67::flashTask(void *pvParameters)
+{
+    LogBoard67 *board = (LogBoard67 *)pvParameters;
+    while (1)
+    {
+        const uint8_t *record = board->ring.acquireRead();
+        if (record == NULL)
+        {
+            vTaskDelay(1);
+            continue;
+        }
+        if (SPIFlashLatestAddress < SPI_FLASH_MAX_ADDRESS)
+        {
+            board->StoreRecord(record);
+        }
+        board->ring.releaseRead();
+    }
+}
+
+#endif
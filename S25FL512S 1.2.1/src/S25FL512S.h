@@ -54,6 +54,7 @@ public:
     void erase();
     void write(uint32_t addr, uint8_t *tx);
     void read(uint32_t addr, uint8_t *rx);
+    bool isBusy();
 };
 
 void Flash::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
@@ -221,5 +222,10 @@ void Flash::read(uint32_t addr, uint8_t *rx)
     spi_transaction.address_bits = ADDRESS_LENGTH;
     flashSPI->transmit((spi_transaction_t *)&spi_transaction, deviceHandle);
 }
+// 書き込み(Page Program)中ならtrue (Status RegisterのWIPビット)
+bool Flash::isBusy()
+{
+    return flashSPI->readByte(CMD_RDSR, deviceHandle) & 0x01;
+}
 
 #endif
\ No newline at end of file
@@ -79,6 +79,8 @@ int SPICreate::addDevice(spi_device_interface_config_t *if_cfg, int cs)
     {
         return 0;
     }
+    errorCount[deviceNum] = 0;
+    lastError[deviceNum] = ESP_OK;
     return deviceNum;
 }
 
@@ -118,28 +120,59 @@ void SPICreate::setReg(uint8_t addr, uint8_t data, int deviceHandle)
     comm.tx_data[1] = data;
     transmit(&comm, deviceHandle);
 }
-void SPICreate::transmit(uint8_t *tx, int size, int deviceHandle)
+esp_err_t SPICreate::countError(esp_err_t e, int deviceHandle)
 {
-    transmit(tx, NULL, size, deviceHandle);
+    if (e != ESP_OK)
+    {
+        errorCount[deviceHandle]++;
+        lastError[deviceHandle] = e;
+    }
+    return e;
+}
+esp_err_t SPICreate::transmit(uint8_t *tx, int size, int deviceHandle)
+{
+    return transmit(tx, NULL, size, deviceHandle);
 }
-void SPICreate::transmit(uint8_t *tx, uint8_t *rx, int size, int deviceHandle)
+esp_err_t SPICreate::transmit(uint8_t *tx, uint8_t *rx, int size, int deviceHandle)
 {
     spi_transaction_t comm = {};
     comm.length = size * 2 * 8;
     comm.rxlength = size * 8;
     comm.tx_buffer = tx;
     comm.rx_buffer = rx;
-    transmit(&comm, deviceHandle);
+    return transmit(&comm, deviceHandle);
 }
 
-void SPICreate::transmit(spi_transaction_t *transaction, int deviceHandle)
+esp_err_t SPICreate::transmit(spi_transaction_t *transaction, int deviceHandle)
 {
-    spi_device_transmit(handle[deviceHandle], transaction);
-    return;
+    return countError(spi_device_transmit(handle[deviceHandle], transaction), deviceHandle);
 }
-void SPICreate::pollTransmit(spi_transaction_t *transaction, int deviceHandle)
+esp_err_t SPICreate::pollTransmit(spi_transaction_t *transaction, int deviceHandle)
 {
-    spi_device_polling_transmit(handle[deviceHandle], transaction);
-    return;
+    return countError(spi_device_polling_transmit(handle[deviceHandle], transaction), deviceHandle);
+}
+/**
+ * @brief 送信をキューに積む 同じバスの複数のデバイスの読み出しを続けて積むと、
+ * 1つずつ送信を待つより通信の間の隙間が短くなる
+ * queue_sizeの数まで積める pollTransmitとは混ぜないこと
+ */
+esp_err_t SPICreate::queueTransmit(spi_transaction_t *transaction, int deviceHandle)
+{
+    return countError(spi_device_queue_trans(handle[deviceHandle], transaction, portMAX_DELAY), deviceHandle);
+}
+esp_err_t SPICreate::getTransmitResult(int deviceHandle, spi_transaction_t **transaction, TickType_t timeout)
+{
+    spi_transaction_t *done;
+    esp_err_t e = spi_device_get_trans_result(handle[deviceHandle], &done, timeout);
+    // timeoutを短くして完了を待たずに見に来たときのタイムアウトはエラーにしない
+    if (e != ESP_ERR_TIMEOUT)
+    {
+        countError(e, deviceHandle);
+    }
+    if (transaction != NULL)
+    {
+        *transaction = done;
+    }
+    return e;
 }
 SPICREATE_END
\ No newline at end of file
@@ -39,6 +39,11 @@ namespace arduino
                     uint8_t mode{SPI_MODE3};       // must be 1 or 3
                     int max_size{SPI_MAX_DMA_LEN}; // default size
 
+                    // デバイスごとの通信エラーの数 (ESP_OK以外が返った回数) と最後のエラー
+                    uint32_t errorCount[4] = {};
+                    esp_err_t lastError[4] = {};
+                    esp_err_t countError(esp_err_t e, int deviceHandle);
+
                 public:
 #if !(IS_S3)
                     bool begin(
@@ -63,11 +68,21 @@ namespace arduino
                     void sendCmd(uint8_t cmd, int deviceHandle);
                     void setReg(uint8_t addr, uint8_t data, int deviceHandle);
 
-                    void transmit(uint8_t *tx, int size, int deviceHandle);
-                    void transmit(uint8_t *tx, uint8_t *rx, int size, int deviceHandle);
-                    void transmit(spi_transaction_t *transaction, int deviceHandle);
+                    // ESP_OK以外ならエラーとして数える (戻り値を見なくてもgetErrorCountで分かる)
+                    esp_err_t transmit(uint8_t *tx, int size, int deviceHandle);
+                    esp_err_t transmit(uint8_t *tx, uint8_t *rx, int size, int deviceHandle);
+                    esp_err_t transmit(spi_transaction_t *transaction, int deviceHandle);
+
+                    esp_err_t pollTransmit(spi_transaction_t *transaction, int deviceHandle);
+
+                    // 送信をキューに積むだけで待たない 結果はgetTransmitResultで受け取る
+                    // transactionとバッファは結果を受け取るまで残しておくこと
+                    esp_err_t queueTransmit(spi_transaction_t *transaction, int deviceHandle);
+                    esp_err_t getTransmitResult(int deviceHandle, spi_transaction_t **transaction = NULL, TickType_t timeout = portMAX_DELAY);
 
-                    void pollTransmit(spi_transaction_t *transaction, int deviceHandle);
+                    // addDeviceしてからの通信エラーの数 readByte, setRegの分も含む
+                    uint32_t getErrorCount(int deviceHandle) { return (deviceHandle > 0 && deviceHandle < 4) ? errorCount[deviceHandle] : 0; }
+                    esp_err_t getLastError(int deviceHandle) { return (deviceHandle > 0 && deviceHandle < 4) ? lastError[deviceHandle] : ESP_OK; }
                 };
             } // dma
         } // spi